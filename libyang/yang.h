@@ -14,19 +14,36 @@
 #define YANGC_PREFIX "yangc"
 
 struct _xmlDoc;
-struct _xmlDict;
 struct _xmlNode;
+struct yang_session_s;
 
+/* Flags for yangWriteDoc and yangWriteDocNode (YANG text by default): */
+#define YWF_JSON	(1<<0)	/* Write statements as JSON objects */
+#define YWF_TREE	(1<<1)	/* Write a tree diagram of the data nodes */
+#define YWF_SERIAL	(1<<2)	/* Don't use the session's worker threads */
+
+/*
+ * These take the session to work in; NULL means the calling thread's
+ * current session
+ */
 struct _xmlDoc *
-yangLoadFile (const char *template, const char *filename,
-	      FILE *file, struct _xmlDict *dict, int partial);
+yangLoadFile (struct yang_session_s *ysnp, const char *template,
+	      const char *filename, FILE *file, int partial);
+
+int
+yangWriteDocNode (struct yang_session_s *ysnp, slaxWriterFunc_t func,
+		  void *data, struct _xmlNode *nodep, unsigned flags);
+
+int
+yangWriteDoc (struct yang_session_s *ysnp, slaxWriterFunc_t func,
+	      void *data, struct _xmlDoc *docp, unsigned flags);
 
 int
-yangWriteDocNode (slaxWriterFunc_t func, void *data,
-		  struct _xmlNode *nodep, unsigned flags);
+yangWriteDocFd (struct yang_session_s *ysnp, int fd, struct _xmlDoc *docp,
+		unsigned flags);
 
+/* Write a document as a schema blob (see yangblob.h) */
 int
-yangWriteDoc (slaxWriterFunc_t func, void *data,
-	      struct _xmlDoc *docp, unsigned flags);
+yangBlobWrite (struct yang_session_s *ysnp, int fd, struct _xmlDoc *docp);
 
 #endif /* LIBYANG_YANG_H */
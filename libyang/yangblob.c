@@ -0,0 +1,475 @@
+/*
+ * Copyright (c) 2014, Juniper Networks, Inc.
+ * All rights reserved.
+ * See ../Copyright for the status of this software
+ */
+
+/*
+ * Schema blobs (see yangblob.h for the format).  yangBlobWrite turns
+ * a compiled module into a blob; yangBlobOpen maps one for reading,
+ * checking that every index and offset in it is in range, so readers
+ * can follow them without further checks.
+ */
+
+#include <sys/queue.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <libxml/hash.h>
+
+#include "yanginternals.h"
+#include <libslax/slax.h>
+#include <libslax/slaxdata.h>
+#include <libyang/yang.h>
+#include <libyang/yangparser.h>
+#include <libyang/yangloader.h>
+#include <libyang/yangstmt.h>
+#include <libyang/yangblob.h>
+
+#define YANG_BLOB_ROUND(_x) \
+    (((_x) + YANG_BLOB_ALIGN - 1) & ~(uint64_t) (YANG_BLOB_ALIGN - 1))
+
+typedef struct yang_blob_build_s {
+    xmlNodePtr *ybb_src;	/* Source of each node */
+    yang_blob_node_t *ybb_nodes; /* Nodes, breadth first */
+    unsigned ybb_count;		/* Number of nodes */
+    unsigned ybb_max;		/* Allocated size of the node arrays */
+    yang_blob_stmt_t *ybb_stmts; /* Statements, by ys_id */
+    unsigned ybb_stmt_count;	/* Number of statements */
+    yang_buf_t ybb_strings;	/* String table */
+    xmlHashTablePtr ybb_index;	/* String -> offset + 1 */
+    yang_stmt_cache_t ybb_cache; /* Statement lookups */
+    int ybb_error;		/* errno of first failure (or zero) */
+} yang_blob_build_t;
+
+/*
+ * Return the offset of a string in the string table, adding it the
+ * first time we see it
+ */
+static uint32_t
+yangBlobIntern (yang_blob_build_t *ybbp, const char *str)
+{
+    yang_buf_t *ybp = &ybbp->ybb_strings;
+    uintptr_t off;
+    size_t len;
+
+    if (str == NULL)
+	return YANG_BLOB_NONE;
+
+    off = (uintptr_t) xmlHashLookup(ybbp->ybb_index, (const xmlChar *) str);
+    if (off)
+	return off - 1;
+
+    len = strlen(str) + 1;
+    if (ybp->yb_len + len >= YANG_BLOB_NONE) {
+	ybbp->ybb_error = E2BIG;
+	return YANG_BLOB_NONE;
+    }
+
+    off = ybp->yb_len;
+    yangBufAddRaw(ybp, str, len);
+
+    if (xmlHashAddEntry(ybbp->ybb_index, (const xmlChar *) str,
+			(void *) (off + 1)))
+	ybbp->ybb_error = ENOMEM;
+
+    return off;
+}
+
+static uint32_t
+yangBlobNodeAdd (yang_blob_build_t *ybbp, xmlNodePtr nodep, uint32_t parent)
+{
+    yang_blob_node_t *ybnp;
+
+    if (ybbp->ybb_count >= ybbp->ybb_max) {
+	unsigned max = ybbp->ybb_max ? ybbp->ybb_max * 2 : 256;
+	xmlNodePtr *srcp;
+
+	srcp = xmlRealloc(ybbp->ybb_src, max * sizeof(*srcp));
+	if (srcp == NULL) {
+	    ybbp->ybb_error = ENOMEM;
+	    return YANG_BLOB_NONE;
+	}
+	ybbp->ybb_src = srcp;
+
+	ybnp = xmlRealloc(ybbp->ybb_nodes, max * sizeof(*ybnp));
+	if (ybnp == NULL) {
+	    ybbp->ybb_error = ENOMEM;
+	    return YANG_BLOB_NONE;
+	}
+	ybbp->ybb_nodes = ybnp;
+	ybbp->ybb_max = max;
+    }
+
+    ybnp = &ybbp->ybb_nodes[ybbp->ybb_count];
+    bzero(ybnp, sizeof(*ybnp));
+    ybnp->ybn_parent = parent;
+    ybbp->ybb_src[ybbp->ybb_count] = nodep;
+
+    return ybbp->ybb_count++;
+}
+
+/*
+ * Fill in a node from its source, appending its substatements to the
+ * node array.  Since nodes are filled in the order they were added,
+ * every node's children end up contiguous.
+ */
+static void
+yangBlobNodeFill (yang_blob_build_t *ybbp, uint32_t idx)
+{
+    xmlNodePtr nodep = ybbp->ybb_src[idx], childp;
+    const char *namespace = nodep->ns ? (const char *) nodep->ns->href : NULL;
+    const char *argument;
+    const xmlChar *iargument;
+    const char *data;
+    char *alloc;
+    int ignore_children;
+    yang_stmt_t *ysp;
+    uint32_t first = ybbp->ybb_count, count = 0;
+
+    ysp = yangStmtFindNode(&ybbp->ybb_cache, nodep);
+    data = yangWriteArgument(&ybbp->ybb_cache, nodep, &argument, &iargument,
+			     &ignore_children, &alloc);
+
+    ybbp->ybb_nodes[idx].ybn_stmt = ysp ? ysp->ys_id : YANG_BLOB_NONE;
+    ybbp->ybb_nodes[idx].ybn_keyword
+	= yangBlobIntern(ybbp, (const char *) nodep->name);
+    ybbp->ybb_nodes[idx].ybn_namespace = yangBlobIntern(ybbp, namespace);
+    ybbp->ybb_nodes[idx].ybn_argument = yangBlobIntern(ybbp, data);
+    xmlFreeAndEasy(alloc);
+
+    if (!ignore_children) {
+	for (childp = nodep->children; childp; childp = childp->next) {
+	    if (childp->type != XML_ELEMENT_NODE)
+		continue;
+
+	    /* The argument element (for yin-element statements) isn't one */
+	    if (iargument ? childp->name == iargument
+		    : streq((const char *) childp->name, argument))
+		continue;
+
+	    if (yangBlobNodeAdd(ybbp, childp, idx) == YANG_BLOB_NONE)
+		break;
+	    count += 1;
+	}
+    }
+
+    ybbp->ybb_nodes[idx].ybn_child = count ? first : YANG_BLOB_NONE;
+    ybbp->ybb_nodes[idx].ybn_nchildren = count;
+}
+
+/*
+ * Describe the session's statements, so readers can make sense of
+ * the statement ids without a session of their own
+ */
+static void
+yangBlobStmts (yang_blob_build_t *ybbp)
+{
+    yang_session_t *ysnp = yangSession();
+    yang_blob_stmt_t *ybsp;
+    yang_stmt_t *ysp;
+    unsigned i;
+
+    ybbp->ybb_stmts = xmlMalloc(ysnp->ysn_stmt_count * sizeof(*ybsp) + 1);
+    if (ybbp->ybb_stmts == NULL) {
+	ybbp->ybb_error = ENOMEM;
+	return;
+    }
+
+    for (i = 0; i < ysnp->ysn_stmt_count; i++) {
+	ybsp = &ybbp->ybb_stmts[i];
+	ysp = (i < ysnp->ysn_stmt_ids_size) ? ysnp->ysn_stmt_ids[i] : NULL;
+
+	bzero(ybsp, sizeof(*ybsp));
+	if (ysp == NULL) {
+	    ybsp->ybs_name = ybsp->ybs_namespace = YANG_BLOB_NONE;
+	    ybsp->ybs_argument = YANG_BLOB_NONE;
+	    continue;
+	}
+
+	ybsp->ybs_name = yangBlobIntern(ybbp, ysp->ys_name);
+	ybsp->ybs_namespace = yangBlobIntern(ybbp, ysp->ys_namespace);
+	ybsp->ybs_argument = yangBlobIntern(ybbp, ysp->ys_argument);
+	if (ysp->ys_flags & YSF_YINELEMENT)
+	    ybsp->ybs_flags |= YBSF_YINELEMENT;
+	if (ysp->ys_flags & YSF_STANDARD)
+	    ybsp->ybs_flags |= YBSF_STANDARD;
+    }
+
+    ybbp->ybb_stmt_count = ysnp->ysn_stmt_count;
+}
+
+/*
+ * Pad the output with zeros up to the given offset
+ */
+static void
+yangBlobPad (yang_buf_t *ybp, uint64_t *offp, uint64_t to)
+{
+    static const char zeros[YANG_BLOB_ALIGN];
+
+    if (to > *offp)
+	yangBufAddRaw(ybp, zeros, to - *offp);
+    *offp = to;
+}
+
+int
+yangBlobWrite (yang_session_t *ysnp, int fd, xmlDocPtr docp)
+{
+    yang_session_t *old = yangSessionEnter(ysnp);
+    xmlNodePtr root = xmlDocGetRootElement(docp);
+    yang_blob_build_t ybb;
+    yang_blob_header_t ybh;
+    yang_buf_t yb;
+    uint64_t off, size;
+    unsigned i;
+    int rc = -1;
+
+    bzero(&ybb, sizeof(ybb));
+    yangBufInit(&ybb.ybb_strings, -1);
+    yangStmtCacheInit(&ybb.ybb_cache);
+
+    ybb.ybb_index = xmlHashCreate(0);
+    if (ybb.ybb_index == NULL || root == NULL) {
+	errno = root ? ENOMEM : EINVAL;
+	goto fail;
+    }
+
+    yangBlobIntern(&ybb, "");	/* Offset zero is the empty string */
+
+    yangBlobNodeAdd(&ybb, root, YANG_BLOB_NONE);
+    for (i = 0; i < ybb.ybb_count && ybb.ybb_error == 0; i++)
+	yangBlobNodeFill(&ybb, i);
+
+    yangBlobStmts(&ybb);
+
+    if (ybb.ybb_error == 0 && ybb.ybb_strings.yb_error)
+	ybb.ybb_error = ybb.ybb_strings.yb_error;
+    if (ybb.ybb_error) {
+	errno = ybb.ybb_error;
+	goto fail;
+    }
+
+    bzero(&ybh, sizeof(ybh));
+    memcpy(ybh.ybh_magic, YANG_BLOB_MAGIC, YANG_BLOB_MAGIC_LEN);
+    ybh.ybh_version = YANG_BLOB_VERSION;
+    ybh.ybh_byte_order = YANG_BLOB_BYTE_ORDER;
+
+    off = YANG_BLOB_ROUND(sizeof(ybh));
+    ybh.ybh_nodes = off;
+    ybh.ybh_node_count = ybb.ybb_count;
+
+    off = YANG_BLOB_ROUND(off + ybb.ybb_count * sizeof(yang_blob_node_t));
+    ybh.ybh_stmts = off;
+    ybh.ybh_stmt_count = ybb.ybb_stmt_count;
+
+    off = YANG_BLOB_ROUND(off
+			  + ybb.ybb_stmt_count * sizeof(yang_blob_stmt_t));
+    ybh.ybh_strings = off;
+    ybh.ybh_strings_size = ybb.ybb_strings.yb_len;
+
+    size = off + ybb.ybb_strings.yb_len;
+    if (size >= YANG_BLOB_NONE) {
+	errno = E2BIG;
+	goto fail;
+    }
+    ybh.ybh_size = size;
+
+    yangBufInit(&yb, fd);
+    off = 0;
+
+    yangBufAddRaw(&yb, (const char *) &ybh, sizeof(ybh));
+    off += sizeof(ybh);
+
+    yangBlobPad(&yb, &off, ybh.ybh_nodes);
+    yangBufAddRaw(&yb, (const char *) ybb.ybb_nodes,
+		  ybb.ybb_count * sizeof(yang_blob_node_t));
+    off += ybb.ybb_count * sizeof(yang_blob_node_t);
+
+    yangBlobPad(&yb, &off, ybh.ybh_stmts);
+    yangBufAddRaw(&yb, (const char *) ybb.ybb_stmts,
+		  ybb.ybb_stmt_count * sizeof(yang_blob_stmt_t));
+    off += ybb.ybb_stmt_count * sizeof(yang_blob_stmt_t);
+
+    yangBlobPad(&yb, &off, ybh.ybh_strings);
+    yangBufAddRaw(&yb, ybb.ybb_strings.yb_data, ybb.ybb_strings.yb_len);
+
+    rc = yangBufClean(&yb);
+    if (rc)
+	errno = yb.yb_error;
+
+ fail:
+    if (ybb.ybb_index)
+	xmlHashFree(ybb.ybb_index, NULL);
+    yangBufClean(&ybb.ybb_strings);
+    xmlFreeAndEasy(ybb.ybb_src);
+    xmlFreeAndEasy(ybb.ybb_nodes);
+    xmlFreeAndEasy(ybb.ybb_stmts);
+
+    yangSessionLeave(old);
+    return rc;
+}
+
+/*
+ * Is [off, off + count * size) inside the blob (and aligned)?
+ */
+static int
+yangBlobInside (const yang_blob_header_t *ybhp, uint32_t off,
+		uint32_t count, size_t size)
+{
+    if (off % YANG_BLOB_ALIGN)
+	return FALSE;
+
+    return ((uint64_t) off + (uint64_t) count * size <= ybhp->ybh_size);
+}
+
+static int
+yangBlobStringOk (const yang_blob_header_t *ybhp, uint32_t off, int optional)
+{
+    if (off == YANG_BLOB_NONE)
+	return optional;
+    return (off < ybhp->ybh_strings_size);
+}
+
+/*
+ * Check everything a reader will trust: the header, that each
+ * section is inside the blob, and that every index and string offset
+ * points where it should
+ */
+static int
+yangBlobCheck (yang_blob_t *yblp)
+{
+    const yang_blob_header_t *ybhp = yblp->ybl_header;
+    const yang_blob_node_t *ybnp;
+    const yang_blob_stmt_t *ybsp;
+    uint32_t i;
+
+    if (yblp->ybl_size < sizeof(*ybhp)
+	    || memcmp(ybhp->ybh_magic, YANG_BLOB_MAGIC, YANG_BLOB_MAGIC_LEN)
+	    || ybhp->ybh_version != YANG_BLOB_VERSION
+	    || ybhp->ybh_byte_order != YANG_BLOB_BYTE_ORDER
+	    || ybhp->ybh_size != yblp->ybl_size
+	    || ybhp->ybh_node_count == 0
+	    || ybhp->ybh_strings_size == 0)
+	return FALSE;
+
+    if (!yangBlobInside(ybhp, ybhp->ybh_nodes, ybhp->ybh_node_count,
+			sizeof(*ybnp))
+	    || !yangBlobInside(ybhp, ybhp->ybh_stmts, ybhp->ybh_stmt_count,
+			       sizeof(*ybsp))
+	    || !yangBlobInside(ybhp, ybhp->ybh_strings,
+			       ybhp->ybh_strings_size, 1))
+	return FALSE;
+
+    yblp->ybl_nodes = (const void *) (yblp->ybl_base + ybhp->ybh_nodes);
+    yblp->ybl_stmts = (const void *) (yblp->ybl_base + ybhp->ybh_stmts);
+    yblp->ybl_strings = yblp->ybl_base + ybhp->ybh_strings;
+
+    /* Every string ends before the table does */
+    if (yblp->ybl_strings[ybhp->ybh_strings_size - 1] != '\0')
+	return FALSE;
+
+    for (i = 0; i < ybhp->ybh_stmt_count; i++) {
+	ybsp = &yblp->ybl_stmts[i];
+	if (!yangBlobStringOk(ybhp, ybsp->ybs_name, TRUE)
+		|| !yangBlobStringOk(ybhp, ybsp->ybs_namespace, TRUE)
+		|| !yangBlobStringOk(ybhp, ybsp->ybs_argument, TRUE))
+	    return FALSE;
+    }
+
+    for (i = 0; i < ybhp->ybh_node_count; i++) {
+	ybnp = &yblp->ybl_nodes[i];
+	if (!yangBlobStringOk(ybhp, ybnp->ybn_keyword, FALSE)
+		|| !yangBlobStringOk(ybhp, ybnp->ybn_namespace, TRUE)
+		|| !yangBlobStringOk(ybhp, ybnp->ybn_argument, TRUE))
+	    return FALSE;
+
+	if (ybnp->ybn_stmt != YANG_BLOB_NONE
+		&& ybnp->ybn_stmt >= ybhp->ybh_stmt_count)
+	    return FALSE;
+
+	if ((i == 0) != (ybnp->ybn_parent == YANG_BLOB_NONE)
+		|| (i && ybnp->ybn_parent >= i))
+	    return FALSE;
+
+	if (ybnp->ybn_nchildren
+		&& (ybnp->ybn_child <= i
+		    || (uint64_t) ybnp->ybn_child + ybnp->ybn_nchildren
+			> ybhp->ybh_node_count))
+	    return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Map a blob read-only.  Returns NULL (with errno set) if the file
+ * can't be mapped or isn't a valid blob; EINVAL means the latter,
+ * which includes blobs written with a different byte order.
+ */
+yang_blob_t *
+yangBlobOpen (const char *filename)
+{
+    yang_blob_t *yblp;
+    struct stat st;
+    void *base;
+    int fd, save;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+	return NULL;
+
+    if (fstat(fd, &st) < 0) {
+	save = errno;
+	close(fd);
+	errno = save;
+	return NULL;
+    }
+
+    if (st.st_size < (off_t) sizeof(yang_blob_header_t)
+	    || st.st_size >= YANG_BLOB_NONE) {
+	close(fd);
+	errno = EINVAL;
+	return NULL;
+    }
+
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    save = errno;
+    close(fd);
+    if (base == MAP_FAILED) {
+	errno = save;
+	return NULL;
+    }
+
+    yblp = xmlMalloc(sizeof(*yblp));
+    if (yblp == NULL) {
+	munmap(base, st.st_size);
+	errno = ENOMEM;
+	return NULL;
+    }
+
+    bzero(yblp, sizeof(*yblp));
+    yblp->ybl_base = base;
+    yblp->ybl_size = st.st_size;
+    yblp->ybl_header = base;
+
+    if (!yangBlobCheck(yblp)) {
+	yangBlobClose(yblp);
+	errno = EINVAL;
+	return NULL;
+    }
+
+    return yblp;
+}
+
+void
+yangBlobClose (yang_blob_t *yblp)
+{
+    if (yblp == NULL)
+	return;
+
+    munmap((void *) yblp->ybl_base, yblp->ybl_size);
+    xmlFree(yblp);
+}
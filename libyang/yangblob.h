@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2014, Juniper Networks, Inc.
+ * All rights reserved.
+ * See ../Copyright for the status of this software
+ */
+
+/*
+ * Schema blobs.  A blob is a compiled module's statement tree in a
+ * form that can be mmap'd and used in place, with no parsing: flat
+ * arrays of fixed-size records that refer to each other by index,
+ * and an interned string table that they refer to by offset.  Since
+ * there are no pointers, the blob can be mapped anywhere and shared
+ * read-only by any number of processes.
+ *
+ * The layout is a header, then the nodes, the statements and the
+ * strings, each starting on an eight byte boundary.  Nodes are laid
+ * out breadth first, so a node's children are a contiguous range.
+ * Node 0 is the root (the module or submodule).  The statement table
+ * is indexed by statement id, as assigned by the compiling session,
+ * and describes each statement a node may refer to.
+ *
+ * All fields are 32-bit integers in the byte order of the machine
+ * that wrote the blob; ybh_byte_order tells a reader whether that's
+ * its own.  This header depends on nothing else in libyang, so
+ * consumers can read blobs without the compiler's headers.
+ */
+
+#ifndef LIBYANG_YANGBLOB_H
+#define LIBYANG_YANGBLOB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define YANG_BLOB_MAGIC		"YANGBLOB" /* ybh_magic (no NUL) */
+#define YANG_BLOB_MAGIC_LEN	8
+#define YANG_BLOB_VERSION	1
+#define YANG_BLOB_BYTE_ORDER	0x01020304 /* As the writer stored it */
+#define YANG_BLOB_NONE		0xffffffffU /* No index or string */
+#define YANG_BLOB_ALIGN		8	/* Alignment of each section */
+
+typedef struct yang_blob_header_s {
+    char ybh_magic[YANG_BLOB_MAGIC_LEN]; /* YANG_BLOB_MAGIC */
+    uint32_t ybh_version;	/* YANG_BLOB_VERSION */
+    uint32_t ybh_byte_order;	/* YANG_BLOB_BYTE_ORDER */
+    uint32_t ybh_size;		/* Size of the whole blob */
+    uint32_t ybh_nodes;		/* Offset of the node array */
+    uint32_t ybh_node_count;	/* Number of nodes */
+    uint32_t ybh_stmts;		/* Offset of the statement array */
+    uint32_t ybh_stmt_count;	/* Number of statements */
+    uint32_t ybh_strings;	/* Offset of the string table */
+    uint32_t ybh_strings_size;	/* Size of the string table */
+    uint32_t ybh_reserved;	/* Zero */
+} yang_blob_header_t;
+
+typedef struct yang_blob_node_s {
+    uint32_t ybn_stmt;		/* Statement id (or YANG_BLOB_NONE) */
+    uint32_t ybn_keyword;	/* String: statement keyword */
+    uint32_t ybn_namespace;	/* String: namespace (or YANG_BLOB_NONE) */
+    uint32_t ybn_argument;	/* String: argument (or YANG_BLOB_NONE) */
+    uint32_t ybn_parent;	/* Parent node (YANG_BLOB_NONE for root) */
+    uint32_t ybn_child;		/* First child node */
+    uint32_t ybn_nchildren;	/* Number of child nodes */
+    uint32_t ybn_reserved;	/* Zero */
+} yang_blob_node_t;
+
+typedef struct yang_blob_stmt_s {
+    uint32_t ybs_name;		/* String: statement keyword */
+    uint32_t ybs_namespace;	/* String: namespace (or YANG_BLOB_NONE) */
+    uint32_t ybs_argument;	/* String: argument name (or YANG_BLOB_NONE) */
+    uint32_t ybs_flags;		/* Flags (YBSF_*) */
+} yang_blob_stmt_t;
+
+/* Flags for ybs_flags */
+#define YBSF_YINELEMENT	(1<<0)	/* Argument is an element in YIN */
+#define YBSF_STANDARD	(1<<1)	/* Statement is standard YANG */
+
+/*
+ * A blob opened for reading
+ */
+typedef struct yang_blob_s {
+    const char *ybl_base;	/* Start of the mapping */
+    size_t ybl_size;		/* Size of the mapping */
+    const yang_blob_header_t *ybl_header; /* The header */
+    const yang_blob_node_t *ybl_nodes; /* The node array */
+    const yang_blob_stmt_t *ybl_stmts; /* The statement array */
+    const char *ybl_strings;	/* The string table */
+} yang_blob_t;
+
+yang_blob_t *
+yangBlobOpen (const char *filename);
+
+void
+yangBlobClose (yang_blob_t *yblp);
+
+static inline const yang_blob_node_t *
+yangBlobNode (const yang_blob_t *yblp, uint32_t idx)
+{
+    if (idx >= yblp->ybl_header->ybh_node_count)
+	return NULL;
+    return &yblp->ybl_nodes[idx];
+}
+
+static inline const yang_blob_stmt_t *
+yangBlobStmt (const yang_blob_t *yblp, uint32_t id)
+{
+    if (id >= yblp->ybl_header->ybh_stmt_count)
+	return NULL;
+    return &yblp->ybl_stmts[id];
+}
+
+static inline const char *
+yangBlobString (const yang_blob_t *yblp, uint32_t offset)
+{
+    if (offset >= yblp->ybl_header->ybh_strings_size)
+	return NULL;
+    return yblp->ybl_strings + offset;
+}
+
+#endif /* LIBYANG_YANGBLOB_H */
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2014, Juniper Networks, Inc.
+ * All rights reserved.
+ * See ../Copyright for the status of this software
+ */
+
+/*
+ * Output buffers.  The writers build their text in a growable buffer
+ * with plain memcpy (see the inline functions in yangloader.h), and
+ * the buffer is handed to the file descriptor in large writes.  A
+ * buffer with no file descriptor (or function) just grows, for callers
+ * that want the text in memory.
+ */
+
+#include <sys/queue.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <errno.h>
+
+#include "yanginternals.h"
+#include <libslax/slax.h>
+#include <libslax/slaxdata.h>
+#include <libyang/yang.h>
+#include <libyang/yangparser.h>
+#include <libyang/yangloader.h>
+
+void
+yangBufInit (yang_buf_t *ybp, int fd)
+{
+    bzero(ybp, sizeof(*ybp));
+    ybp->yb_fd = fd;
+    ybp->yb_bol = TRUE;
+}
+
+/*
+ * Send the text through a writer function (such as fprintf) instead
+ * of a file descriptor
+ */
+void
+yangBufInitFunc (yang_buf_t *ybp, slaxWriterFunc_t func, void *data)
+{
+    yangBufInit(ybp, -1);
+    ybp->yb_func = func;
+    ybp->yb_func_data = data;
+}
+
+/*
+ * Make room for len more bytes, returning where they go (or NULL)
+ */
+char *
+yangBufGrow (yang_buf_t *ybp, size_t len)
+{
+    size_t size;
+    char *newp;
+
+    if (ybp->yb_len + len <= ybp->yb_size)
+	return ybp->yb_data + ybp->yb_len;
+
+    /* Drain to the sink first, if we have one */
+    if ((ybp->yb_fd >= 0 || ybp->yb_func) && ybp->yb_len) {
+	yangBufFlush(ybp);
+	if (len <= ybp->yb_size)
+	    return ybp->yb_data;
+    }
+
+    size = ybp->yb_size ?: YANG_BUF_FLUSH;
+    while (size < ybp->yb_len + len)
+	size *= 2;
+
+    newp = xmlRealloc(ybp->yb_data, size);
+    if (newp == NULL) {
+	ybp->yb_error = ENOMEM;
+	return NULL;
+    }
+
+    ybp->yb_data = newp;
+    ybp->yb_size = size;
+    return ybp->yb_data + ybp->yb_len;
+}
+
+/*
+ * Write out whatever we're holding.  Returns -1 (with yb_error set)
+ * if the sink failed, after which output is discarded.
+ */
+int
+yangBufFlush (yang_buf_t *ybp)
+{
+    const char *cp = ybp->yb_data;
+    size_t len = ybp->yb_len;
+    ssize_t rc;
+
+    if (ybp->yb_fd < 0 && ybp->yb_func == NULL)
+	return 0;
+
+    ybp->yb_len = 0;
+    if (ybp->yb_error)
+	return -1;
+
+    if (ybp->yb_func) {
+	if (len)
+	    ybp->yb_func(ybp->yb_func_data, "%.*s", (int) len, cp);
+	return 0;
+    }
+
+    while (len > 0) {
+	rc = write(ybp->yb_fd, cp, len);
+	if (rc < 0) {
+	    if (errno == EINTR)
+		continue;
+	    ybp->yb_error = errno;
+	    return -1;
+	}
+
+	cp += rc;
+	len -= rc;
+    }
+
+    return 0;
+}
+
+/*
+ * Flush and release the buffer.  Returns -1 if any write failed.
+ */
+int
+yangBufClean (yang_buf_t *ybp)
+{
+    int rc = yangBufFlush(ybp);
+
+    xmlFreeAndEasy(ybp->yb_data);
+    ybp->yb_data = NULL;
+    ybp->yb_size = ybp->yb_len = 0;
+
+    return (rc || ybp->yb_error) ? -1 : 0;
+}
+
+/*
+ * Add a run of spaces
+ */
+void
+yangBufPad (yang_buf_t *ybp, size_t count)
+{
+    static const char spaces[] = "                                ";
+    size_t len;
+
+    while (count > 0) {
+	len = (count < sizeof(spaces) - 1) ? count : sizeof(spaces) - 1;
+	yangBufAdd(ybp, spaces, len);
+	count -= len;
+    }
+}
+
+/*
+ * Send a run of in-memory buffers to a buffer's sink, in order.  For
+ * a file descriptor, this is a writev per IOV_MAX buffers rather than
+ * a copy into one big buffer.  The buffers are stride bytes apart,
+ * so they can live inside the caller's own records.  Returns -1 if
+ * any of them failed.
+ */
+int
+yangBufConcat (yang_buf_t *ybp, yang_buf_t *parts, unsigned count,
+	       size_t stride)
+{
+    struct iovec iov[IOV_MAX];
+    yang_buf_t *partp;
+    unsigned i, niov;
+    ssize_t rc;
+
+    if (yangBufFlush(ybp))
+	return -1;
+
+    for (i = 0; i < count; ) {
+	for (niov = 0; i < count && niov < IOV_MAX; i++) {
+	    partp = (yang_buf_t *) ((char *) parts + i * stride);
+	    if (partp->yb_error)
+		ybp->yb_error = partp->yb_error;
+	    if (partp->yb_len == 0)
+		continue;
+
+	    if (ybp->yb_fd < 0) {
+		if (ybp->yb_func == NULL)
+		    yangBufAddRaw(ybp, partp->yb_data, partp->yb_len);
+		else if (!ybp->yb_error)
+		    ybp->yb_func(ybp->yb_func_data, "%.*s",
+				 (int) partp->yb_len, partp->yb_data);
+		continue;
+	    }
+
+	    iov[niov].iov_base = partp->yb_data;
+	    iov[niov].iov_len = partp->yb_len;
+	    niov += 1;
+	}
+
+	struct iovec *iovp = iov;
+	while (niov > 0 && !ybp->yb_error) {
+	    rc = writev(ybp->yb_fd, iovp, niov);
+	    if (rc < 0) {
+		if (errno != EINTR)
+		    ybp->yb_error = errno;
+		continue;
+	    }
+
+	    /* Skip what was written, trimming a partly written buffer */
+	    for ( ; niov > 0 && (size_t) rc >= iovp->iov_len; iovp++, niov--)
+		rc -= iovp->iov_len;
+	    if (niov > 0) {
+		iovp->iov_base = (char *) iovp->iov_base + rc;
+		iovp->iov_len -= rc;
+	    }
+	}
+    }
+
+    return ybp->yb_error ? -1 : 0;
+}
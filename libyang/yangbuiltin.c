@@ -21,6 +21,7 @@
 #include "yangparser.h"
 #include "yangloader.h"
 #include "yangstmt.h"
+#include "yangtrace.h"
 
 /*
  * Decide if a standard YANG statment is being used in a non-standard
@@ -80,7 +81,7 @@ yangStmtSetTopNamespaces (slax_data_t *sdp, yang_data_t *ydp)
 
     char *prefix = yangStmtGetValue(sdp, parent, pref_stmtp);
 
-    slaxLog("yang: prefix '%s' for namespace '%s'",
+    yangTrace(YTF_STMT, "yang: prefix '%s' for namespace '%s'",
 	    prefix ?: "", namespace);
 
     xmlNodePtr rootp = ydp->yd_filep->yf_root;
@@ -119,7 +120,7 @@ yangStmtSetTopNamespaces (slax_data_t *sdp, yang_data_t *ydp)
 static int
 yangStmtSetArgPrefixOrNamespace (YANG_STMT_SETARG_ARGS)
 {
-    slaxLog("yang: arg: prefix %p %p", sdp, ysp);
+    yangTrace(YTF_STMT, "yang: arg: prefix %p %p", sdp, ysp);
 
     return yangStmtSetTopNamespaces(sdp, ydp);
 }
@@ -127,7 +128,7 @@ yangStmtSetArgPrefixOrNamespace (YANG_STMT_SETARG_ARGS)
 static int
 yangStmtSetArgModuleOrSubmodule (YANG_STMT_SETARG_ARGS)
 {
-    slaxLog("yang: arg: %s %p %p", ysp->ys_name, sdp, ysp);
+    yangTrace(YTF_STMT, "yang: arg: %s %p %p", ysp->ys_name, sdp, ysp);
 
     if (streq(ysp->ys_name, YS_MODULE))
 	ydp->yd_filep->yf_flags |= YFF_MODULE;
@@ -139,7 +140,7 @@ yangStmtSetArgModuleOrSubmodule (YANG_STMT_SETARG_ARGS)
 static int
 yangStmtSetArgHelp (YANG_STMT_SETARG_ARGS)
 {
-    slaxLog("yang: arg: %s %p %p", ysp->ys_name, sdp, ysp);
+    yangTrace(YTF_STMT, "yang: arg: %s %p %p", ysp->ys_name, sdp, ysp);
 
     xmlNodePtr nodep = sdp->sd_ctxt->node;
     xmlDocPtr docp = nodep->doc;
@@ -163,11 +164,42 @@ yangStmtSetArgHelp (YANG_STMT_SETARG_ARGS)
 static int
 yangStmtCloseType (YANG_STMT_CLOSE_ARGS)
 {
-    slaxLog("yang: type: %p %p", sdp, ysp);
+    yangTrace(YTF_STMT, "yang: type: %p %p", sdp, ysp);
 
     return 0;
 }
 
+/*
+ * Add a top-level grouping, typedef, identity, feature or extension
+ * to the file's symbol table
+ */
+static int
+yangStmtCloseSymbol (YANG_STMT_CLOSE_ARGS)
+{
+    yang_parse_stack_t *ypsp = ydp->yd_stackp;
+    yang_parse_stack_t *parent = yangStackParent(ydp, ypsp);
+    xmlNodePtr nodep = sdp->sd_ctxt->node;
+
+    if (ypsp == NULL || (ypsp->yps_flags & YPSF_DISCARD)
+	    || parent == NULL || parent->yps_stmt == NULL
+	    || ydp->yd_filep == NULL || yangStmtIgnore(sdp))
+	return 0;
+
+    const char *pname = parent->yps_stmt->ys_name;
+    if (!streq(pname, YS_MODULE) && !streq(pname, YS_SUBMODULE))
+	return 0;
+
+    char *name = slaxGetAttrib(nodep, YS_NAME);
+    if (name == NULL)
+	return 0;
+
+    if (yangSymbolAdd(ydp->yd_filep, ysp->ys_name, name, nodep))
+	yangError(sdp, "duplicate %s '%s'", ysp->ys_name, name);
+
+    xmlFree(name);
+    return 0;
+}
+
 static int
 yangStmtCloseExtension (YANG_STMT_CLOSE_ARGS)
 {
@@ -176,13 +208,13 @@ yangStmtCloseExtension (YANG_STMT_CLOSE_ARGS)
     char *element = yangStmtGetValue(sdp, nodep, arg_stmtp);
     char *name = slaxGetAttrib(nodep, YS_NAME);
 
-    slaxLog("yang: extension: %p %p '%s' -> '%s'",
+    yangTrace(YTF_STMT, "yang: extension: %p %p '%s' -> '%s'",
 	    sdp, ysp, name, element ?: "");
 
     xmlFreeAndEasy(name);
     xmlFreeAndEasy(element);
 
-    return 0;
+    return yangStmtCloseSymbol(sdp, ydp, ysp);
 }
 
 /* YS_ANYXML */
@@ -807,6 +839,7 @@ static yang_stmt_t yangStmtBuiltin[] = {
     .ys_flags = 0,
     .ys_type = Y_IDENT,
     .ys_children = ys_feature_children,
+    .ys_close = yangStmtCloseSymbol,
     },
 
     { /* "fraction-digits" statement */
@@ -822,6 +855,7 @@ static yang_stmt_t yangStmtBuiltin[] = {
     .ys_flags = 0,
     .ys_type = Y_IDENT,
     .ys_children = ys_grouping_children,
+    .ys_close = yangStmtCloseSymbol,
     },
 
     { /* "identity" statement */
@@ -830,6 +864,7 @@ static yang_stmt_t yangStmtBuiltin[] = {
     .ys_flags = 0,
     .ys_type = Y_IDENT,
     .ys_children = ys_identity_children,
+    .ys_close = yangStmtCloseSymbol,
     },
 
     { /* "if-feature" statement */
@@ -1100,6 +1135,7 @@ static yang_stmt_t yangStmtBuiltin[] = {
     .ys_flags = 0,
     .ys_type = Y_IDENT,
     .ys_children = ys_typedef_children,
+    .ys_close = yangStmtCloseSymbol,
     },
 
     { /* "unique" statement */
@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) 2014, Juniper Networks, Inc.
+ * All rights reserved.
+ * See ../Copyright for the status of this software
+ */
+
+/*
+ * Dependency tracking.  The loader records every file a compilation
+ * reads (the source, each import and include, and parameter files),
+ * which we can write as a make rule (like "gcc -MD") or keep in a
+ * build manifest.  The manifest holds, for each output, a content
+ * hash of the output and of every file it depends on, and a hash of
+ * the options it was built with; if none of them has changed since
+ * the last run, the output is up to date and the compilation can be
+ * skipped.
+ *
+ * The manifest is a text file, one record per line:
+ *     output <hash> <path>
+ *     options <hash> <path>
+ *     dep <hash> <path>
+ * where each "options" and "dep" belongs to the "output" above it.
+ * Updates are serialized by an flock on "<manifest>.lock", so builds
+ * sharing a manifest don't lose each other's entries.  The list of
+ * files read is kept in the session.
+ */
+
+#include <sys/queue.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <libxml/hash.h>
+
+#include "yanginternals.h"
+#include <libslax/slax.h>
+#include <libslax/slaxdata.h>
+#include <libyang/yang.h>
+#include <libyang/yangparser.h>
+#include <libyang/yangloader.h>
+#include <libyang/yangtrace.h>
+
+#define YANG_MANIFEST_OUTPUT	"output"
+#define YANG_MANIFEST_OPTIONS	"options"
+#define YANG_MANIFEST_DEP	"dep"
+
+void
+yangDependAdd (const char *path)
+{
+    yang_session_t *ysnp = yangSession();
+
+    if (path == NULL || slaxFilenameIsStd(path))
+	return;
+
+    if (ysnp->ysn_depend_seen == NULL) {
+	ysnp->ysn_depend_seen = xmlHashCreate(0);
+	if (ysnp->ysn_depend_seen == NULL)
+	    return;
+    }
+
+    if (xmlHashLookup(ysnp->ysn_depend_seen, (const xmlChar *) path))
+	return;
+
+    slax_data_node_t *dnp = slaxDataListAddNul(&ysnp->ysn_depends, path);
+    if (dnp)
+	xmlHashAddEntry(ysnp->ysn_depend_seen, (const xmlChar *) path, dnp);
+}
+
+/*
+ * Add a file and everything it imports or includes, transitively
+ */
+void
+yangDependAddFile (yang_file_t *yfp)
+{
+    xmlHashTablePtr seen = yangSession()->ysn_depend_seen;
+    yang_import_t *yip;
+
+    if (yfp == NULL || yfp->yf_path == NULL)
+	return;
+
+    if (seen && xmlHashLookup(seen, (const xmlChar *) yfp->yf_path))
+	return;
+
+    yangDependAdd(yfp->yf_path);
+
+    TAILQ_FOREACH(yip, &yfp->yf_imports, yi_link) {
+	yangDependAddFile(yip->yi_file);
+    }
+}
+
+void
+yangDependClean (void)
+{
+    yang_session_t *ysnp = yangSession();
+
+    if (ysnp->ysn_depend_seen) {
+	xmlHashFree(ysnp->ysn_depend_seen, NULL);
+	ysnp->ysn_depend_seen = NULL;
+	slaxDataListClean(&ysnp->ysn_depends);
+	slaxDataListInit(&ysnp->ysn_depends);
+    }
+}
+
+/*
+ * Write the escapes make needs for a file name
+ */
+static void
+yangDependWriteName (FILE *fp, const char *name)
+{
+    for ( ; *name; name++) {
+	if (*name == ' ' || *name == '#' || *name == '\\')
+	    fputc('\\', fp);
+	else if (*name == '$')
+	    fputc('$', fp);
+	fputc(*name, fp);
+    }
+}
+
+/*
+ * Write a make rule for the target.  Like "gcc -MP", each dependency
+ * also gets an empty rule, so make doesn't fail when one is removed.
+ */
+int
+yangDependWrite (const char *filename, const char *target)
+{
+    slax_data_list_t *listp = &yangSession()->ysn_depends;
+    slax_data_node_t *dnp;
+    FILE *fp;
+
+    fp = fopen(filename, "w");
+    if (fp == NULL) {
+	slaxError("%s: cannot open dependency file: %s",
+		  filename, strerror(errno));
+	return -1;
+    }
+
+    yangDependWriteName(fp, target);
+    fputc(':', fp);
+
+    SLAXDATALIST_FOREACH(dnp, listp) {
+	fputs(" \\\n  ", fp);
+	yangDependWriteName(fp, dnp->dn_data);
+    }
+
+    fputc('\n', fp);
+
+    SLAXDATALIST_FOREACH(dnp, listp) {
+	fputc('\n', fp);
+	yangDependWriteName(fp, dnp->dn_data);
+	fputs(":\n", fp);
+    }
+
+    return fclose(fp) ? -1 : 0;
+}
+
+/*
+ * Hash a file's contents.  Returns -1 if it can't be read.
+ */
+int
+yangHashFile (const char *path, uint64_t *hashp)
+{
+    uint64_t hash = YANG_HASH_INIT;
+    char data[BUFSIZ];
+    size_t len;
+    FILE *fp;
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+	return -1;
+
+    while ((len = fread(data, 1, sizeof(data), fp)) > 0)
+	hash = yangHash(hash, data, len);
+
+    int rc = ferror(fp) ? -1 : 0;
+    fclose(fp);
+
+    *hashp = hash;
+    return rc;
+}
+
+/*
+ * Split a manifest line into its kind, hash and path
+ */
+static int
+yangManifestParse (char *line, char **kindp, uint64_t *hashp, char **pathp)
+{
+    char *cp, *ep;
+
+    cp = strchr(line, '\n');
+    if (cp)
+	*cp = '\0';
+
+    cp = strchr(line, ' ');
+    if (cp == NULL)
+	return -1;
+    *cp++ = '\0';
+
+    *hashp = strtoull(cp, &ep, 16);
+    if (ep == cp || *ep != ' ')
+	return -1;
+
+    *kindp = line;
+    *pathp = ep + 1;
+    return 0;
+}
+
+/*
+ * Fold the session's options into the caller's: anything that changes
+ * what a load builds, and our version
+ */
+static uint64_t
+yangManifestOptions (uint64_t options)
+{
+    yang_session_t *ysnp = yangSession();
+    uint64_t hash = yangHash(YANG_HASH_INIT, &options, sizeof(options));
+    slax_data_node_t *dnp;
+    int flags[] = { ysnp->ysn_features_complete, ysnp->ysn_expand_uses };
+
+    hash = yangHash(hash, YANGC_VERSION, sizeof(YANGC_VERSION));
+    hash = yangHash(hash, flags, sizeof(flags));
+
+    SLAXDATALIST_FOREACH(dnp, &ysnp->ysn_features) {
+	hash = yangHashString(hash, dnp->dn_data);
+    }
+
+    hash = yangHashString(hash, NULL);	/* Between the two lists */
+
+    SLAXDATALIST_FOREACH(dnp, &ysnp->ysn_includes) {
+	hash = yangHashString(hash, dnp->dn_data);
+    }
+
+    return hash;
+}
+
+/*
+ * Is the output up to date?  It is if it has an entry in the
+ * manifest, was built with the same options, and it and all of its
+ * dependencies still have the content hashes recorded there.  If so,
+ * the dependencies are added to the session's list, as if we'd
+ * loaded them, so they can still be written with yangDependWrite.
+ */
+int
+yangManifestIsCurrent (const char *manifest, const char *output,
+		       uint64_t options)
+{
+    char line[MAXPATHLEN + 64], *kind, *path;
+    uint64_t hash, now, want = yangManifestOptions(options);
+    int found = FALSE, current = FALSE, matched = FALSE;
+    FILE *fp;
+
+    fp = fopen(manifest, "r");
+    if (fp == NULL)
+	return FALSE;
+
+    while (fgets(line, sizeof(line), fp)) {
+	if (yangManifestParse(line, &kind, &hash, &path))
+	    continue;
+
+	if (streq(kind, YANG_MANIFEST_OUTPUT)) {
+	    if (found)
+		break;		/* End of our entry */
+	    if (!streq(path, output))
+		continue;
+
+	    found = current = TRUE;
+
+	} else if (!found) {
+	    continue;
+
+	} else if (streq(kind, YANG_MANIFEST_OPTIONS)) {
+	    if (hash != want) {
+		yangTrace(YTF_LOADER, "yang: manifest: options for '%s' "
+			  "changed", output);
+		current = FALSE;
+		break;
+	    }
+	    matched = TRUE;
+	    continue;
+
+	} else if (!streq(kind, YANG_MANIFEST_DEP)) {
+	    continue;
+	}
+
+	if (yangHashFile(path, &now) || now != hash) {
+	    yangTrace(YTF_LOADER, "yang: manifest: '%s' changed", path);
+	    current = FALSE;
+	    break;
+	}
+
+	if (!streq(kind, YANG_MANIFEST_OUTPUT))
+	    yangDependAdd(path);
+    }
+
+    fclose(fp);
+
+    if (current && !matched)	/* Written before options were kept */
+	current = FALSE;
+
+    if (current)
+	yangTrace(YTF_LOADER, "yang: manifest: '%s' is up to date", output);
+    else if (found)
+	yangDependClean();
+
+    return current;
+}
+
+/*
+ * Record the output, options and dependencies of this run in the
+ * manifest, replacing any previous entry for the output.  The new
+ * manifest is written beside the old and renamed into place, under
+ * the lock, so concurrent updates are applied one after another.
+ */
+int
+yangManifestUpdate (const char *manifest, const char *output,
+		    uint64_t options)
+{
+    char tmp[MAXPATHLEN], line[MAXPATHLEN + 64], copy[sizeof(line)];
+    char *kind, *path;
+    uint64_t hash, *hashes;
+    slax_data_node_t *dnp;
+    FILE *in, *out;
+    int fd, lockfd, skipping = FALSE, complete;
+    unsigned i, ndeps = 0;
+
+    snprintf(tmp, sizeof(tmp), "%s.lock", manifest);
+    lockfd = open(tmp, O_RDWR | O_CREAT, 0644);
+    if (lockfd < 0 || flock(lockfd, LOCK_EX) < 0) {
+	slaxError("%s: cannot lock manifest: %s", manifest, strerror(errno));
+	if (lockfd >= 0)
+	    close(lockfd);
+	return -1;
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", manifest);
+    fd = mkstemp(tmp);
+    if (fd < 0 || (out = fdopen(fd, "w")) == NULL) {
+	slaxError("%s: cannot write manifest: %s", manifest, strerror(errno));
+	if (fd >= 0) {
+	    close(fd);
+	    unlink(tmp);
+	}
+	close(lockfd);
+	return -1;
+    }
+
+    fchmod(fd, 0644);		/* mkstemp makes it private */
+
+    /* Copy every other output's entry */
+    in = fopen(manifest, "r");
+    if (in) {
+	while (fgets(line, sizeof(line), in)) {
+	    memcpy(copy, line, sizeof(line));
+	    if (yangManifestParse(copy, &kind, &hash, &path))
+		continue;
+
+	    if (streq(kind, YANG_MANIFEST_OUTPUT))
+		skipping = streq(path, output);
+
+	    if (!skipping)
+		fputs(line, out);
+	}
+	fclose(in);
+    }
+
+    /*
+     * Hash everything before writing anything.  An entry missing a
+     * dependency would never go stale when that file changed, so if
+     * one can't be read, the output gets no entry at all and the
+     * next run does the work.
+     */
+    SLAXDATALIST_FOREACH(dnp, &yangSession()->ysn_depends) {
+	ndeps += 1;
+    }
+
+    hashes = xmlMalloc((ndeps + 1) * sizeof(*hashes));
+    complete = (hashes != NULL && yangHashFile(output, &hash) == 0);
+
+    i = 0;
+    SLAXDATALIST_FOREACH(dnp, &yangSession()->ysn_depends) {
+	if (!complete)
+	    break;
+	if (yangHashFile(dnp->dn_data, &hashes[i++]))
+	    complete = FALSE;
+    }
+
+    if (complete) {
+	fprintf(out, "%s %016llx %s\n", YANG_MANIFEST_OUTPUT,
+		(unsigned long long) hash, output);
+	fprintf(out, "%s %016llx %s\n", YANG_MANIFEST_OPTIONS,
+		(unsigned long long) yangManifestOptions(options), output);
+
+	i = 0;
+	SLAXDATALIST_FOREACH(dnp, &yangSession()->ysn_depends) {
+	    fprintf(out, "%s %016llx %s\n", YANG_MANIFEST_DEP,
+		    (unsigned long long) hashes[i++], dnp->dn_data);
+	}
+    } else {
+	slaxError("%s: cannot hash dependencies of '%s'; not recorded",
+		  manifest, output);
+    }
+
+    xmlFreeAndEasy(hashes);
+
+    int rc = 0;
+    if (fclose(out) || rename(tmp, manifest) < 0) {
+	slaxError("%s: cannot write manifest: %s", manifest, strerror(errno));
+	unlink(tmp);
+	rc = -1;
+    }
+
+    close(lockfd);		/* Releases the lock */
+    return rc;
+}
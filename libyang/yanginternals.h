@@ -21,6 +21,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
 
@@ -30,6 +31,50 @@
 
 #include <libxslt/documents.h>
 
-extern int yangYyDebug;		/* yydebug from yangparser.c */
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_LIBPTHREAD)
+#include <pthread.h>
+#define YANG_HAVE_THREADS
+#endif
+
+/*
+ * yydebug from yangparser.c.  Unlike the rest of our state, this is
+ * process-wide, since bison makes yydebug a plain global; it only
+ * controls trace output.
+ */
+extern int yangYyDebug;
+
+/*
+ * 64-bit FNV-1a, used for cache keys and content hashes.  Start with
+ * YANG_HASH_INIT and feed data in as many pieces as needed.
+ */
+#define YANG_HASH_INIT	0xcbf29ce484222325ULL
+#define YANG_HASH_PRIME	0x100000001b3ULL
+
+static inline uint64_t
+yangHash (uint64_t hash, const void *data, size_t len)
+{
+    const unsigned char *cp = data;
+
+    for ( ; len > 0; len--, cp++) {
+	hash ^= *cp;
+	hash *= YANG_HASH_PRIME;
+    }
+
+    return hash;
+}
+
+/*
+ * Hash a string that may be NULL, keeping NULL distinct from ""
+ */
+static inline uint64_t
+yangHashString (uint64_t hash, const char *str)
+{
+    static const char none = '\377'; /* Never appears in UTF-8 */
+
+    if (str == NULL)
+	return yangHash(hash, &none, sizeof(none));
+
+    return yangHash(hash, str, strlen(str) + 1);
+}
 
 #endif /* YANG_INTERNALS_H */
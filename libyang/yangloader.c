@@ -6,7 +6,9 @@
 
 #include <ctype.h>
 #include <sys/queue.h>
+#include <sys/stat.h>
 #include <errno.h>
+#include <stdint.h>
 
 #include <libxslt/extensions.h>
 #include <libxslt/documents.h>
@@ -20,23 +22,306 @@
 #include <libyang/yangparser.h>
 #include <libyang/yangloader.h>
 #include <libyang/yangstmt.h>
-
-static slax_data_list_t yang_features;
-static int yang_features_initted;
+#include <libyang/yangtrace.h>
 
 void
 yangFeatureAdd (const char *feature_name)
 {
-    if (!yang_features_initted) {
-	yang_features_initted += 1;
-	TAILQ_INIT(&yang_features);
+    slaxDataListAdd(&yangSession()->ysn_features, feature_name);
+}
+
+/*
+ * Forget all features, for callers that reuse a session
+ */
+void
+yangFeaturesClean (void)
+{
+    yang_session_t *ysnp = yangSession();
+
+    slaxDataListClean(&ysnp->ysn_features);
+    slaxDataListInit(&ysnp->ysn_features);
+}
+
+/*
+ * When the feature list is complete (--prune-features), content for
+ * features that aren't in it can never be used, so we drop it at
+ * compile time: statements guarded by "if-feature" on a missing
+ * feature, and "xsl:if" elements whose test is just a feature.
+ * Live "xsl:if"s are replaced by their contents.  Feature names are
+ * compared without their prefix, since --feature takes plain names.
+ */
+void
+yangFeaturesSetComplete (int complete)
+{
+    yangSession()->ysn_features_complete = complete;
+}
+
+static int
+yangFeatureIsEnabled (xmlHashTablePtr enabled, const char *name)
+{
+    const char *cp = strchr(name, ':');
+
+    if (cp)
+	name = cp + 1;
+
+    return xmlHashLookup(enabled, (const xmlChar *) name) ? TRUE : FALSE;
+}
+
+/*
+ * Is the context node for this xsl:if the "/features" input root?
+ * That's true inside the "/features" template, unless an xsl:for-each
+ * has moved the context.
+ */
+static int
+yangFeatureContext (xmlNodePtr nodep)
+{
+    for (nodep = nodep->parent; nodep; nodep = nodep->parent) {
+	if (nodep->type != XML_ELEMENT_NODE || nodep->ns == NULL
+		|| !streq((const char *) nodep->ns->href, XSL_URI))
+	    continue;
+
+	if (streq((const char *) nodep->name, "for-each"))
+	    return FALSE;
+
+	if (streq((const char *) nodep->name, ELT_TEMPLATE)) {
+	    char *match = slaxGetAttrib(nodep, ATT_MATCH);
+	    int res = (match && streq(match, "/features"));
+
+	    xmlFreeAndEasy(match);
+	    return res;
+	}
+    }
+
+    return FALSE;
+}
+
+/*
+ * If an xsl:if test is just a feature, return its name.  That's
+ * "/features/name" anywhere, or a bare "name" when the context node
+ * is the features root.
+ */
+static const char *
+yangFeatureTest (xmlNodePtr nodep, const char *test)
+{
+    static const char features[] = "/features/";
+    const char *cp;
+
+    while (isspace((int) *test))
+	test += 1;
+
+    if (strncmp(test, features, sizeof(features) - 1) == 0)
+	test += sizeof(features) - 1;
+    else if (!yangFeatureContext(nodep))
+	return NULL;
+
+    if (*test == '\0' || !(isalpha((int) *test) || *test == '_'))
+	return NULL;
+
+    for (cp = test; *cp; cp++)
+	if (!(isalnum((int) *cp) || *cp == '-' || *cp == '_' || *cp == '.'))
+	    break;
+
+    while (isspace((int) *cp))
+	cp += 1;
+
+    return (*cp == '\0') ? test : NULL;
+}
+
+/*
+ * Does this statement have an "if-feature" on a disabled feature?
+ */
+static int
+yangFeatureIsPruned (xmlHashTablePtr enabled, xmlNodePtr nodep)
+{
+    xmlNodePtr childp;
+
+    for (childp = nodep->children; childp; childp = childp->next) {
+	if (childp->type != XML_ELEMENT_NODE || childp->ns == NULL
+		|| !streq((const char *) childp->ns->href, YIN_URI)
+		|| !streq((const char *) childp->name, YS_IF_FEATURE))
+	    continue;
+
+	char *name = slaxGetAttrib(childp, YS_NAME);
+	int live = (name == NULL || yangFeatureIsEnabled(enabled, name));
+
+	xmlFreeAndEasy(name);
+	if (!live)
+	    return TRUE;
+    }
+
+    return FALSE;
+}
+
+static unsigned
+yangFeaturesPruneTree (xmlHashTablePtr enabled, xmlNodePtr parent)
+{
+    xmlNodePtr nodep, nextp, childp;
+    unsigned count = 0;
+
+    for (nodep = parent->children; nodep; nodep = nextp) {
+	nextp = nodep->next;
+
+	if (nodep->type != XML_ELEMENT_NODE)
+	    continue;
+
+	if (yangFeatureIsPruned(enabled, nodep)) {
+	    xmlUnlinkNode(nodep);
+	    xmlFreeNode(nodep);
+	    count += 1;
+	    continue;
+	}
+
+	if (nodep->ns && streq((const char *) nodep->ns->href, XSL_URI)
+		&& streq((const char *) nodep->name, ELT_IF)) {
+	    char *test = slaxGetAttrib(nodep, ATT_TEST);
+	    const char *name = test ? yangFeatureTest(nodep, test) : NULL;
+
+	    if (name) {
+		int live = yangFeatureIsEnabled(enabled, name);
+
+		/* Hoist the contents of a live test; they're walked next */
+		if (live) {
+		    xmlNodePtr prevp = nodep->prev;
+
+		    while ((childp = nodep->children) != NULL) {
+			xmlUnlinkNode(childp);
+			xmlAddPrevSibling(nodep, childp);
+		    }
+
+		    nextp = prevp ? prevp->next : parent->children;
+		}
+
+		xmlFreeAndEasy(test);
+		xmlUnlinkNode(nodep);
+		xmlFreeNode(nodep);
+		count += 1;
+		continue;
+	    }
+
+	    xmlFreeAndEasy(test);
+	}
+
+	count += yangFeaturesPruneTree(enabled, nodep);
+    }
+
+    return count;
+}
+
+/*
+ * Drop content for features that aren't enabled, if we've been told
+ * the feature list is complete
+ */
+static void
+yangFeaturesPrune (yang_file_t *yfp)
+{
+    yang_session_t *ysnp = yangSession();
+    xmlHashTablePtr enabled;
+    slax_data_node_t *dnp;
+
+    if (!ysnp->ysn_features_complete || yfp->yf_root == NULL)
+	return;
+
+    enabled = xmlHashCreate(0);
+    if (enabled == NULL)
+	return;
+
+    SLAXDATALIST_FOREACH(dnp, &ysnp->ysn_features) {
+	const char *name = dnp->dn_data;
+	const char *cp = strchr(name, '=');
+	size_t len = cp ? (size_t) (cp - name) : strlen(name);
+	char buf[len + 1];
+
+	memcpy(buf, name, len);
+	buf[len] = '\0';
+	xmlHashAddEntry(enabled, (const xmlChar *) buf, (void *) dnp);
+    }
+
+    unsigned count = yangFeaturesPruneTree(enabled, yfp->yf_root);
+
+    yangTrace(YTF_LOADER, "yang: pruned %u feature-dependent nodes from '%s'",
+	      count, yfp->yf_name);
+
+    xmlHashFree(enabled, NULL);
+}
+
+/*
+ * One dictionary is shared by everything a run builds: the source
+ * document and every module it loads, parameter files, the input
+ * document and (through the stylesheet) the XSLT result.  Names are
+ * interned once, and nodes with the same name have the same pointer.
+ */
+xmlDictPtr
+yangDictGet (void)
+{
+    yang_session_t *ysnp = yangSession();
+
+    if (ysnp->ysn_dict == NULL)
+	ysnp->ysn_dict = xmlDictCreate();
+
+    return ysnp->ysn_dict;
+}
+
+void
+yangDictClean (void)
+{
+    yang_session_t *ysnp = yangSession();
+
+    if (ysnp->ysn_dict) {
+	/* Documents hold their own references */
+	xmlDictFree(ysnp->ysn_dict);
+	ysnp->ysn_dict = NULL;
     }
+}
+
+/*
+ * Give a parser context our dictionary in place of its own
+ */
+static void
+yangDictUse (xmlParserCtxtPtr ctxt, xmlDictPtr dict)
+{
+    if (dict == NULL)
+	return;
 
-    slaxDataListAdd(&yang_features, feature_name);
+    if (ctxt->dict)
+	xmlDictFree(ctxt->dict);
+
+    ctxt->dict = dict;
+    xmlDictReference(ctxt->dict);
+}
+
+/*
+ * Read an XML file using the given dictionary
+ */
+static xmlDocPtr
+yangReadFileDict (const char *filename, const char *encoding, int options,
+		  xmlDictPtr dict)
+{
+    xmlParserCtxtPtr ctxt;
+    xmlDocPtr docp;
+
+    ctxt = xmlNewParserCtxt();
+    if (ctxt == NULL)
+	return NULL;
+
+    yangDictUse(ctxt, dict);
+    docp = xmlCtxtReadFile(ctxt, filename, encoding, options);
+    xmlFreeParserCtxt(ctxt);
+
+    return docp;
 }
 
 xmlDocPtr
-yangFeaturesBuildInputDoc (void)
+yangReadFile (const char *filename, const char *encoding, int options)
+{
+    return yangReadFileDict(filename, encoding, options, yangDictGet());
+}
+
+/*
+ * Build a "features" input document from a list of features.  The
+ * dictionary may be NULL, for documents built on other threads.
+ */
+xmlDocPtr
+yangFeaturesBuildDoc (slax_data_list_t *listp, xmlDictPtr dict)
 {
     xmlDocPtr docp;
     xmlNodePtr top, nodep;
@@ -47,7 +332,9 @@ yangFeaturesBuildInputDoc (void)
 	return NULL;
 
     docp->standalone = 1;
-    docp->dict = xmlDictCreate();
+    docp->dict = dict;
+    if (docp->dict)
+	xmlDictReference(docp->dict);
 
     top = xmlNewDocNode(docp, NULL, (const xmlChar *) "features", NULL);
     if (top == NULL) {
@@ -57,38 +344,42 @@ yangFeaturesBuildInputDoc (void)
 
     xmlDocSetRootElement(docp, top);
 
-    if (yang_features_initted) {
-	SLAXDATALIST_FOREACH(dnp, &yang_features) {
-	    char *name = dnp->dn_data;
-
-	    /*
-	     * The feature is either a simple name or a "name=value"
-	     * format.  If there's an equal sign, break it into the
-	     * two pieces and put the value as the content of the node.
-	     */
-	    const char *cp = strchr(name, '=');
-	    if (cp) {
-		size_t len = cp - name;
-		char *newp = alloca(len + 1);
-		memcpy(newp, name, len);
-		newp[len] = '\0';
-
-		name = newp;
-		cp += 1;
-	    }
+    SLAXDATALIST_FOREACH(dnp, listp) {
+	char *name = dnp->dn_data;
+
+	/*
+	 * The feature is either a simple name or a "name=value"
+	 * format.  If there's an equal sign, break it into the
+	 * two pieces and put the value as the content of the node.
+	 */
+	const char *cp = strchr(name, '=');
+	if (cp) {
+	    size_t len = cp - name;
+	    char *newp = alloca(len + 1);
+	    memcpy(newp, name, len);
+	    newp[len] = '\0';
+
+	    name = newp;
+	    cp += 1;
+	}
 
-	    nodep = xmlNewDocNode(docp, NULL, (const xmlChar *) name,
-				  (const xmlChar *) cp);
-	    if (nodep == NULL)
-		break;
+	nodep = xmlNewDocNode(docp, NULL, (const xmlChar *) name,
+			      (const xmlChar *) cp);
+	if (nodep == NULL)
+	    break;
 
-	    xmlAddChild(top, nodep);
-	}
+	xmlAddChild(top, nodep);
     }
 
     return docp;
 }
 
+xmlDocPtr
+yangFeaturesBuildInputDoc (void)
+{
+    return yangFeaturesBuildDoc(&yangSession()->ysn_features, yangDictGet());
+}
+
 #if 0
 static xmlNodePtr
 yangFindMain (yang_file_t *yfp)
@@ -107,56 +398,106 @@ yangFindMain (yang_file_t *yfp)
 }
 #endif
 
-static yang_file_t *
-yangFileLoadContents (yang_file_list_t *listp,
-		      const char *template, const char *name UNUSED,
-		      const char *filename, FILE *file,
-		      xmlDictPtr dict, int partial UNUSED)
+static void
+yangFileFree (yang_file_t *yfp, int free_doc);
+
+void
+yangParserInit (yang_parser_t *yprp)
 {
-    slax_data_t sd;
-    yang_data_t yd;
-    int rc;
-    xmlParserCtxtPtr ctxt = xmlNewParserCtxt();
-    yang_file_t *yfp;
+    bzero(yprp, sizeof(*yprp));
+}
 
-    if (ctxt == NULL)
-	return NULL;
+void
+yangParserClean (yang_parser_t *yprp)
+{
+    if (yprp->ypr_ctxt)
+	xmlFreeParserCtxt(yprp->ypr_ctxt);
 
-    yfp = xmlMalloc(sizeof(*yfp));
-    if (yfp == NULL)
-	return NULL;
+    yangDataCleanup(&yprp->ypr_data);
+    bzero(yprp, sizeof(*yprp));
+}
 
-    bzero(yfp, sizeof(*yfp));
-    yfp->yf_name = strdup(name);
-    yfp->yf_path = strdup(filename);
-    TAILQ_INSERT_TAIL(listp, yfp, yf_link);
+/*
+ * Get the parser context, ready for a new file.  A context keeps the
+ * dictionary it was given, so it's only reused for the same one.
+ */
+static xmlParserCtxtPtr
+yangParserCtxt (yang_parser_t *yprp, xmlDictPtr dict)
+{
+    xmlParserCtxtPtr ctxt = yprp->ypr_ctxt;
+
+    if (ctxt && yprp->ypr_dict != dict) {
+	xmlFreeParserCtxt(ctxt);
+	ctxt = yprp->ypr_ctxt = NULL;
+    }
+
+    if (ctxt == NULL) {
+	ctxt = xmlNewParserCtxt();
+	if (ctxt == NULL)
+	    return NULL;
+
+	yangDictUse(ctxt, dict);
+	yprp->ypr_ctxt = ctxt;
+	yprp->ypr_dict = dict;
+    } else {
+	xmlCtxtReset(ctxt);
+    }
 
     /*
      * Turn on line number recording in each node
      */
     ctxt->linenumbers = 1;
 
-    if (dict) {
-	if (ctxt->dict)
-	    xmlDictFree(ctxt->dict);
+    return ctxt;
+}
 
-    	ctxt->dict = dict;
- 	xmlDictReference(ctxt->dict);
-    }
+/*
+ * Get the parser data, ready for a new file.  Frames are zeroed as
+ * they are pushed, so only those used by the last parse need clearing.
+ */
+static yang_data_t *
+yangParserData (yang_parser_t *yprp)
+{
+    yang_data_t *ydp = &yprp->ypr_data;
+
+    if (ydp->yd_stack_high)
+	bzero(ydp->yd_stack, (ydp->yd_stack_high - ydp->yd_stack + 1)
+	      * sizeof(ydp->yd_stack[0]));
+
+    ydp->yd_stackp = ydp->yd_stack_high = NULL;
+    ydp->yd_nsp = NULL;
+    ydp->yd_filep = NULL;
+    ydp->yd_file_list = NULL;
+    ydp->yd_for_count = 0;
+
+    return ydp;
+}
+
+/*
+ * Set up the slax parser data for a file, using a pooled context
+ */
+static xmlParserCtxtPtr
+yangParserStart (yang_parser_t *yprp, slax_data_t *sdp,
+		 const char *filename, FILE *file, xmlDictPtr dict)
+{
+    xmlParserCtxtPtr ctxt = yangParserCtxt(yprp, dict);
+
+    if (ctxt == NULL)
+	return NULL;
 
-    bzero(&sd, sizeof(sd));
+    bzero(sdp, sizeof(*sdp));
 
     /* We want to parse SLAX, either full or partial */
-    sd.sd_parse = sd.sd_ttype = M_YANG;
-    sd.sd_flags |= SDF_SLSH_COMMENTS;
+    sdp->sd_parse = sdp->sd_ttype = M_YANG;
+    sdp->sd_flags |= SDF_SLSH_COMMENTS;
 
-    strncpy(sd.sd_filename, filename, sizeof(sd.sd_filename));
-    sd.sd_file = file;
+    strncpy(sdp->sd_filename, filename, sizeof(sdp->sd_filename));
+    sdp->sd_file = file;
 
-    sd.sd_ctxt = ctxt;
+    sdp->sd_ctxt = ctxt;
 
     ctxt->version = xmlCharStrdup(XML_DEFAULT_VERSION);
-    ctxt->userData = &sd;
+    ctxt->userData = sdp;
 
     /*
      * Fake up an inputStream so the error mechanisms will work
@@ -164,9 +505,58 @@ yangFileLoadContents (yang_file_list_t *listp,
     if (filename)
 	xmlSetupParserForBuffer(ctxt, (const xmlChar *) "", filename);
 
-    sd.sd_docp = slaxBuildDoc(&sd, ctxt);
+    return ctxt;
+}
+
+/*
+ * Take the pooled context back before slaxDataCleanup can free it
+ */
+static void
+yangParserFinish (yang_parser_t *yprp, slax_data_t *sdp)
+{
+    if (sdp->sd_ctxt && sdp->sd_ctxt == yprp->ypr_ctxt) {
+	sdp->sd_ctxt->myDoc = NULL;
+	sdp->sd_ctxt->userData = NULL;
+	sdp->sd_ctxt = NULL;
+    }
+
+    slaxDataCleanup(sdp);
+}
+
+static yang_file_t *
+yangFileLoadContents (yang_file_list_t *listp,
+		      const char *template, const char *name UNUSED,
+		      const char *filename, FILE *file,
+		      xmlDictPtr dict, int partial UNUSED,
+		      yang_parser_t *yprp)
+{
+    slax_data_t sd;
+    yang_data_t *ydp;
+    int rc;
+    yang_file_t *yfp;
+
+    /* The session's parser serves its own thread; workers bring theirs */
+    if (yprp == NULL)
+	yprp = &yangSession()->ysn_parser;
+
+    if (yangParserStart(yprp, &sd, filename, file, dict) == NULL)
+	return NULL;
+
+    yfp = xmlMalloc(sizeof(*yfp));
+    if (yfp == NULL)
+	return NULL;
+
+    bzero(yfp, sizeof(*yfp));
+    yfp->yf_name = strdup(name);
+    yfp->yf_path = strdup(filename);
+    TAILQ_INIT(&yfp->yf_imports);
+    TAILQ_INSERT_TAIL(listp, yfp, yf_link);
+
+    sd.sd_docp = slaxBuildDoc(&sd, sd.sd_ctxt);
     if (sd.sd_docp == NULL) {
-	slaxDataCleanup(&sd);
+	yangParserFinish(yprp, &sd);
+	TAILQ_REMOVE(listp, yfp, yf_link);
+	yangFileFree(yfp, FALSE);
 	return NULL;
     }
 
@@ -192,14 +582,16 @@ yangFileLoadContents (yang_file_list_t *listp,
 	}
     }
 
-    bzero(&yd, sizeof(yd));
-    sd.sd_opaque = &yd;		/* Hang our data off the slax parser */
-    yd.yd_nsp = nsp;
-    yd.yd_filep = yfp;
-    yd.yd_file_list = listp;
+    ydp = yangParserData(yprp);
+    sd.sd_opaque = ydp;		/* Hang our data off the slax parser */
+    ydp->yd_nsp = nsp;
+    ydp->yd_filep = yfp;
+    ydp->yd_file_list = listp;
 
     rc = yangParse(&sd);
 
+    yangSymbolSetPrefix(yfp);
+
     if (yfp->yf_main == NULL) {
 	slaxError("%s: no module or submodule found", sd.sd_filename);
 	sd.sd_errors += 1;
@@ -209,13 +601,16 @@ yangFileLoadContents (yang_file_list_t *listp,
 	slaxError("%s: %d error%s detected during parsing (%d)",
 	  sd.sd_filename, sd.sd_errors, (sd.sd_errors == 1) ? "" : "s", rc);
 
-	slaxDataCleanup(&sd);
+	yangParserFinish(yprp, &sd);
+	TAILQ_REMOVE(listp, yfp, yf_link);
+	yfp->yf_docp = NULL;	/* Freed by slaxDataCleanup */
+	yangFileFree(yfp, FALSE);
 	return NULL;
     }
 
     /* Save docp before slaxDataCleanup nukes it */
     sd.sd_docp = NULL;
-    slaxDataCleanup(&sd);
+    yangParserFinish(yprp, &sd);
 
     return yfp;
 }    
@@ -248,24 +643,58 @@ yangFileFind (yang_file_list_t *listp, const char *name)
     return NULL;
 }
 
+static char yang_ext[] = ".yang";
+
 static FILE *
 yangFindIncludeFile (const char *name, char *buf, int bufsiz)
 {
-    static char yang_ext[] = ".yang";
-    int len = strlen(name);
-    char filename[len + sizeof(yang_ext)];
+    return yangIncludeFind(name, buf, bufsiz);
+}
 
-    memcpy(filename, name, len);
-    memcpy(filename + len, yang_ext, sizeof(yang_ext));
+/*
+ * Find the file for a module, preferring "name@revision.yang" when
+ * a revision is requested, then falling back to "name.yang".
+ */
+static FILE *
+yangFindModuleFile (const char *name, const char *rev, char *buf, int bufsiz)
+{
+    if (rev) {
+	int nlen = strlen(name), rlen = strlen(rev);
+	char revname[nlen + rlen + 2];
+	FILE *fp;
+
+	memcpy(revname, name, nlen);
+	revname[nlen] = '@';
+	memcpy(revname + nlen + 1, rev, rlen + 1);
+
+	fp = yangFindIncludeFile(revname, buf, bufsiz);
+	if (fp)
+	    return fp;
+    }
 
-    return slaxFindIncludeFile(filename, buf, bufsiz);
+    return yangFindIncludeFile(name, buf, bufsiz);
 }
 
 static void
 yangFileFree (yang_file_t *yfp, int free_doc)
 {
+    yang_import_t *yip;
+
+    for (;;) {
+	yip = TAILQ_FIRST(&yfp->yf_imports);
+	if (yip == NULL)
+	    break;
+	TAILQ_REMOVE(&yfp->yf_imports, yip, yi_link);
+	xmlFreeAndEasy(yip->yi_prefix);
+	xmlFree(yip);
+    }
+
+    yangSymbolClean(yfp);
+
     xmlFreeAndEasy(yfp->yf_name);
     xmlFreeAndEasy(yfp->yf_path);
+    xmlFreeAndEasy(yfp->yf_revision);
+    xmlFreeAndEasy(yfp->yf_prefix);
 
     if (free_doc && yfp->yf_docp)
 	xmlFreeDoc(yfp->yf_docp);
@@ -288,7 +717,7 @@ yangFileParse (yang_file_list_t *listp, const char *template,
 	return yfp;
 
     yfp = yangFileLoadContents(listp, template, name, filename,
-				sourcefile, dict, partial);
+				sourcefile, dict, partial, NULL);
 
     fclose(sourcefile);
 
@@ -327,14 +756,19 @@ yangFileLoader (const char *template, const char *name,
 			 dict, partial);
 }
 
-static void
-yangImportFile (yang_file_list_t *listp UNUSED, xmlNodePtr insp UNUSED,
-		 const char *fname, const char *pref,
-		 const char *rev, int is_import)
-{
-    slaxLog("yang: import: '%s' '%s' '%s' %s",
-	    fname ?: "", pref ?: "", rev ?: "", is_import ? " is-import" : "");
-}
+/*
+ * The module cache holds every module and submodule loaded through an
+ * import or include, keyed by name and revision-date.  Each one is
+ * parsed once per run, no matter how many files refer to it.  The
+ * list keeps load order (for cleanup); lookups go through two hash
+ * tables, one keyed by (name, revision) and one by name alone, where
+ * the first module loaded under a name wins.  The cache belongs to
+ * the session.
+ */
+
+static int
+yangHandleImports (yang_file_list_t *listp UNUSED, yang_file_t *filep,
+		   int merge);
 
 static const char *
 yangGetValue (xmlNodePtr nodep, const char *elt_name, const char *attr_name)
@@ -353,22 +787,713 @@ yangGetValue (xmlNodePtr nodep, const char *elt_name, const char *attr_name)
     return NULL;
 }
 
+static yang_file_t *
+yangModuleCacheFind (const char *name, const char *rev)
+{
+    yang_session_t *ysnp = yangSession();
+
+    if (ysnp->ysn_module_names == NULL)
+	return NULL;
+
+    if (rev)
+	return xmlHashLookup2(ysnp->ysn_module_revs, (const xmlChar *) name,
+			      (const xmlChar *) rev);
+
+    return xmlHashLookup(ysnp->ysn_module_names, (const xmlChar *) name);
+}
+
 /*
- * Find and load all imported modules, from which we extract all
- * groupings, typedefs, extensions, features, and identities.  We
- * also handle includes.n
+ * Remember a module whose prefetch failed.  Its errors were reported
+ * by the worker, so the import that follows takes the failure from
+ * here instead of parsing the file again and repeating them.
  */
 static void
-yangHandleImports (yang_file_list_t *listp UNUSED, yang_file_t *filep UNUSED)
+yangModuleFailedAdd (const char *name, const char *rev)
 {
-    xmlNodePtr insp, mainp, nodep, nextp;
-    int is_import;
+    yang_session_t *ysnp = yangSession();
 
-    mainp = filep->yf_main;	/* Look at the current module */
-    insp = mainp->parent->parent->children; /* Insertion point */
+    if (ysnp->ysn_module_failed == NULL) {
+	ysnp->ysn_module_failed = xmlHashCreate(0);
+	if (ysnp->ysn_module_failed == NULL)
+	    return;
+    }
 
-    for (nodep = mainp->children; nodep; nodep = nextp) {
-	nextp = nodep->next;
+    xmlHashAddEntry2(ysnp->ysn_module_failed, (const xmlChar *) name,
+		     (const xmlChar *) rev, ysnp);
+}
+
+/*
+ * Take a failed prefetch, returning TRUE if there was one
+ */
+static int
+yangModuleFailedTake (const char *name, const char *rev)
+{
+    yang_session_t *ysnp = yangSession();
+
+    if (ysnp->ysn_module_failed == NULL)
+	return FALSE;
+
+    return (xmlHashRemoveEntry2(ysnp->ysn_module_failed,
+				(const xmlChar *) name,
+				(const xmlChar *) rev, NULL) == 0);
+}
+
+/*
+ * The persistent cache keeps the parsed form of each module in a
+ * directory, as plain XML that libxml2 can read far faster than we
+ * can run the YANG parser.  Entries are named by a hash of the
+ * source contents, the yangc version, the feature set and the
+ * registered statements (extensions included), so a stale entry is
+ * simply never found.  Writes go to a temporary file
+ * that is renamed into place, so concurrent builds can share it.
+ */
+void
+yangLoaderSetCacheDir (const char *dir)
+{
+    yang_session_t *ysnp = yangSession();
+
+    xmlFreeAndEasy(ysnp->ysn_cache_dir);
+    ysnp->ysn_cache_dir = dir ? strdup(dir) : NULL;
+
+    if (ysnp->ysn_cache_dir && mkdir(ysnp->ysn_cache_dir, 0755) < 0
+	    && errno != EEXIST)
+	slaxError("%s: cannot create cache directory: %s",
+		  ysnp->ysn_cache_dir, strerror(errno));
+}
+
+/*
+ * Build the cache path for a source file, leaving the file rewound
+ */
+static int
+yangCacheKey (FILE *fp, char *buf, size_t bufsiz)
+{
+    yang_session_t *ysnp = yangSession();
+    uint64_t hash = YANG_HASH_INIT;
+    slax_data_node_t *dnp;
+    yang_stmt_t *ysp;
+    yang_relative_t *yrp;
+    char data[BUFSIZ];
+    size_t len;
+
+    while ((len = fread(data, 1, sizeof(data), fp)) > 0)
+	hash = yangHash(hash, data, len);
+
+    if (ferror(fp))
+	return -1;
+    rewind(fp);
+
+    hash = yangHash(hash, YANGC_VERSION, sizeof(YANGC_VERSION));
+
+    SLAXDATALIST_FOREACH(dnp, &ysnp->ysn_features) {
+	hash = yangHash(hash, dnp->dn_data, strlen(dnp->dn_data) + 1);
+    }
+
+    /* Extensions change what the parser accepts, and so what it builds */
+    TAILQ_FOREACH(ysp, &ysnp->ysn_stmts, ys_link) {
+	hash = yangHashString(hash, ysp->ys_name);
+	hash = yangHashString(hash, ysp->ys_namespace);
+	hash = yangHashString(hash, ysp->ys_argument);
+	hash = yangHash(hash, &ysp->ys_flags, sizeof(ysp->ys_flags));
+
+	for (yrp = ysp->ys_children; yrp && yrp->yr_name; yrp++) {
+	    hash = yangHashString(hash, yrp->yr_name);
+	    hash = yangHashString(hash, yrp->yr_namespace);
+	    hash = yangHash(hash, &yrp->yr_flags, sizeof(yrp->yr_flags));
+	}
+    }
+
+    snprintf(buf, bufsiz, "%s/%016llx.yin", ysnp->ysn_cache_dir,
+	     (unsigned long long) hash);
+    return 0;
+}
+
+/*
+ * Find the main module node in a document built by
+ * yangFileLoadContents: xsl:template[@match]/{,sub}module
+ */
+static xmlNodePtr
+yangFindMainNode (xmlNodePtr rootp)
+{
+    xmlNodePtr nodep, childp;
+
+    for (nodep = rootp ? rootp->children : NULL; nodep; nodep = nodep->next) {
+	if (nodep->type != XML_ELEMENT_NODE
+		|| !streq((const char *) nodep->name, ELT_TEMPLATE)
+		|| !xmlHasProp(nodep, (const xmlChar *) ATT_MATCH))
+	    continue;
+
+	for (childp = nodep->children; childp; childp = childp->next) {
+	    if (childp->type == XML_ELEMENT_NODE
+		&& (streq((const char *) childp->name, YS_MODULE)
+		    || streq((const char *) childp->name, YS_SUBMODULE)))
+		return childp;
+	}
+    }
+
+    return NULL;
+}
+
+static yang_file_t *
+yangCacheLoad (yang_file_list_t *listp, const char *name,
+	       const char *filename, const char *cachepath, xmlDictPtr dict)
+{
+    xmlDocPtr docp;
+    xmlNodePtr mainp;
+    yang_file_t *yfp;
+
+    if (access(cachepath, R_OK) < 0)
+	return NULL;
+
+    docp = yangReadFileDict(cachepath, NULL, XML_PARSE_NONET, dict);
+    if (docp == NULL)
+	return NULL;
+
+    mainp = yangFindMainNode(xmlDocGetRootElement(docp));
+    if (mainp == NULL) {
+	xmlFreeDoc(docp);
+	return NULL;
+    }
+
+    yfp = xmlMalloc(sizeof(*yfp));
+    if (yfp == NULL) {
+	xmlFreeDoc(docp);
+	return NULL;
+    }
+
+    bzero(yfp, sizeof(*yfp));
+    yfp->yf_name = strdup(name);
+    yfp->yf_path = strdup(filename);
+    TAILQ_INIT(&yfp->yf_imports);
+    TAILQ_INSERT_TAIL(listp, yfp, yf_link);
+
+    yfp->yf_docp = docp;
+    yfp->yf_root = xmlDocGetRootElement(docp);
+    yfp->yf_main = mainp;
+    if (streq((const char *) mainp->name, YS_MODULE))
+	yfp->yf_flags |= YFF_MODULE;
+
+    yangSymbolScan(yfp);
+
+    /* Errors should name the source, not the cache entry */
+    xmlFree(const_drop(docp->URL));
+    docp->URL = xmlStrdup((const xmlChar *) filename);
+
+    yangTrace(YTF_LOADER, "yang: cache hit for '%s' (%s)", name, cachepath);
+    return yfp;
+}
+
+static void
+yangCacheSave (yang_file_t *yfp, const char *cachepath)
+{
+    char tmp[MAXPATHLEN];
+    int fd;
+
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", cachepath);
+    fd = mkstemp(tmp);
+    if (fd < 0)
+	return;
+
+    /* mkstemp makes it private, but the cache is shared */
+    fchmod(fd, 0644);
+    close(fd);
+
+    if (xmlSaveFile(tmp, yfp->yf_docp) < 0 || rename(tmp, cachepath) < 0) {
+	yangTrace(YTF_LOADER, "yang: cache write failed for '%s': %s",
+		  cachepath, strerror(errno));
+	unlink(tmp);
+    }
+}
+
+/*
+ * Strip a trailing ".yang", so "include foo.yang;" works as well as
+ * "include foo;".  The buffer must be at least as big as fname.
+ */
+static char *
+yangModuleName (const char *fname, char *buf)
+{
+    int len = strlen(fname);
+    int elen = sizeof(yang_ext) - 1;
+
+    memcpy(buf, fname, len + 1);
+    if (len > elen && streq(buf + len - elen, yang_ext))
+	buf[len - elen] = '\0';
+
+    return buf;
+}
+
+/*
+ * Parse a module onto the given list.  This touches no shared loader
+ * state, so it's safe to run on a worker thread with a private list.
+ * libxml2 dictionaries aren't safe for concurrent lookups, so workers
+ * pass a NULL dict and get a private one.
+ */
+static yang_file_t *
+yangModuleParse (yang_file_list_t *listp, const char *name, const char *rev,
+		 xmlDictPtr dict, yang_parser_t *yprp)
+{
+    char path[MAXPATHLEN], cachepath[MAXPATHLEN];
+    yang_file_t *yfp;
+    FILE *fp;
+
+    fp = yangFindModuleFile(name, rev, path, sizeof(path));
+    if (fp == NULL)
+	return NULL;
+
+    cachepath[0] = '\0';
+    if (yangSession()->ysn_cache_dir
+	    && yangCacheKey(fp, cachepath, sizeof(cachepath)) == 0) {
+	yfp = yangCacheLoad(listp, name, path, cachepath, dict);
+	if (yfp) {
+	    fclose(fp);
+	    return yfp;
+	}
+    }
+
+    yfp = yangFileLoadContents(listp, NULL, name, path, fp, dict, FALSE, yprp);
+    fclose(fp);
+
+    if (yfp && cachepath[0])
+	yangCacheSave(yfp, cachepath);
+
+    return yfp;
+}
+
+/*
+ * Move a freshly parsed module from its private list into the cache
+ */
+static yang_file_t *
+yangModuleCacheAdd (yang_file_list_t *listp, yang_file_t *yfp,
+		    const char *rev, int is_import)
+{
+    yang_session_t *ysnp = yangSession();
+
+    if (ysnp->ysn_module_names == NULL) {
+	ysnp->ysn_module_revs = xmlHashCreate(0);
+	ysnp->ysn_module_names = xmlHashCreate(0);
+    }
+
+    TAILQ_REMOVE(listp, yfp, yf_link);
+    TAILQ_INSERT_TAIL(&ysnp->ysn_modules, yfp, yf_link);
+
+    yfp->yf_flags |= YFF_CACHED | (is_import ? YFF_IMPORT : 0);
+    if (rev)
+	yfp->yf_revision = strdup(rev);
+    else
+	yfp->yf_revision = (char *) yangGetValue(yfp->yf_main,
+						 YS_REVISION, YS_DATE);
+
+    /* Duplicates are fine; the first entry stays put */
+    if (yfp->yf_revision)
+	xmlHashAddEntry2(ysnp->ysn_module_revs,
+			 (const xmlChar *) yfp->yf_name,
+			 (const xmlChar *) yfp->yf_revision, yfp);
+    xmlHashAddEntry(ysnp->ysn_module_names,
+		    (const xmlChar *) yfp->yf_name, yfp);
+
+    yangTrace(YTF_LOADER, "yang: loaded '%s' (%s) from '%s'",
+	      yfp->yf_name, yfp->yf_revision ?: "no revision", yfp->yf_path);
+
+    return yfp;
+}
+
+/*
+ * Load a module into the cache.  Its own imports are resolved later,
+ * by yangModuleResolve.
+ */
+static yang_file_t *
+yangModuleLoad (const char *name, const char *rev, int is_import)
+{
+    yang_file_list_t list;
+    yang_file_t *yfp;
+
+    TAILQ_INIT(&list);
+    yfp = yangModuleParse(&list, name, rev, yangDictGet(), NULL);
+    if (yfp == NULL)
+	return NULL;
+
+    return yangModuleCacheAdd(&list, yfp, rev, is_import);
+}
+
+/*
+ * Resolve the imports and includes of a cached module, once.  Cached
+ * files are not merged into anything; that's done for the top-level
+ * file by yangMergeInclude.
+ */
+static int
+yangModuleResolve (yang_file_t *yfp)
+{
+    if (!(yfp->yf_flags & YFF_RESOLVED)) {
+	yfp->yf_flags |= YFF_LOADING | YFF_RESOLVED;
+	if (yangHandleImports(&yangSession()->ysn_modules, yfp, FALSE))
+	    yfp->yf_flags |= YFF_FAILED;
+	yfp->yf_flags &= ~YFF_LOADING;
+    }
+
+    return (yfp->yf_flags & YFF_FAILED) ? -1 : 0;
+}
+
+/*
+ * Parallel loading: before a file's imports are resolved one by one,
+ * all the ones that aren't in the cache yet are parsed together on a
+ * pool of worker threads.  Each worker parses onto a private list
+ * with its own parser context, slax_data_t and yang_data_t.  Results
+ * are added to the cache in declaration order, not completion order,
+ * so the output matches a serial run byte for byte.  Workers share
+ * the caller's session, which they only read.
+ *
+ * The parses run concurrently, with no lock.  Both grammars are pure
+ * parsers, and everything a parse changes is its own: the libslax
+ * lexer's input and keyword state are in the slax_data_t, the
+ * grammar's in the yang_data_t, and the document and dictionary in
+ * the worker's parser context.  The lexer's token tables are built
+ * once, by slaxEnable, which a program calls before any parse (and
+ * so before any thread starts).
+ */
+typedef struct yang_load_job_s {
+    char *ylj_name;		/* Module name */
+    char *ylj_rev;		/* Revision-date (or NULL) */
+    int ylj_is_import;		/* Import (vs include) */
+    yang_file_list_t ylj_list;	/* Private list for the worker */
+    yang_file_t *ylj_file;	/* Parsed file (or NULL) */
+} yang_load_job_t;
+
+typedef struct yang_load_batch_s {
+    yang_load_job_t *ylb_jobs;	/* Array of jobs */
+    unsigned ylb_count;		/* Number of jobs */
+    unsigned ylb_next;		/* Next job to hand out */
+    xmlDictPtr ylb_dict;	/* Dictionary (NULL when threaded) */
+    yang_session_t *ylb_session; /* Caller's session */
+#ifdef YANG_HAVE_THREADS
+    pthread_mutex_t ylb_mutex;	/* Protects ylb_next */
+#endif /* YANG_HAVE_THREADS */
+} yang_load_batch_t;
+
+void
+yangLoaderSetJobs (unsigned jobs)
+{
+    yangSession()->ysn_jobs = jobs ?: 1;
+}
+
+static void *
+yangModuleLoadWorker (void *arg)
+{
+    yang_load_batch_t *ylbp = arg;
+    yang_load_job_t *yljp;
+    unsigned idx;
+    yang_parser_t parser, *yprp = NULL;
+    yang_session_t *old = yangSessionSet(ylbp->ylb_session);
+
+    /* Threaded workers (no shared dict) each need their own parser */
+    if (ylbp->ylb_dict == NULL) {
+	yangParserInit(&parser);
+	yprp = &parser;
+    }
+
+    for (;;) {
+#ifdef YANG_HAVE_THREADS
+	pthread_mutex_lock(&ylbp->ylb_mutex);
+#endif /* YANG_HAVE_THREADS */
+	idx = ylbp->ylb_next++;
+#ifdef YANG_HAVE_THREADS
+	pthread_mutex_unlock(&ylbp->ylb_mutex);
+#endif /* YANG_HAVE_THREADS */
+
+	if (idx >= ylbp->ylb_count)
+	    break;
+
+	yljp = &ylbp->ylb_jobs[idx];
+	yljp->ylj_file = yangModuleParse(&yljp->ylj_list, yljp->ylj_name,
+					 yljp->ylj_rev, ylbp->ylb_dict, yprp);
+    }
+
+    if (yprp)
+	yangParserClean(yprp);
+
+    yangSessionSet(old);
+    return NULL;
+}
+
+static void
+yangModuleLoadBatch (yang_load_batch_t *ylbp)
+{
+    unsigned nthreads = yangSession()->ysn_jobs;
+
+    if (nthreads > ylbp->ylb_count)
+	nthreads = ylbp->ylb_count;
+
+    /* The index must exist before the workers read it */
+    yangIncludeIndexBuild();
+    ylbp->ylb_session = yangSession();
+
+#ifdef YANG_HAVE_THREADS
+    if (nthreads > 1) {
+	pthread_t threads[nthreads];
+	unsigned i, started = 0;
+
+	pthread_mutex_init(&ylbp->ylb_mutex, NULL);
+	ylbp->ylb_dict = NULL;
+
+	for (i = 0; i < nthreads; i++) {
+	    if (pthread_create(&threads[i], NULL,
+			       yangModuleLoadWorker, ylbp) != 0)
+		break;
+	    started += 1;
+	}
+
+	/* The caller's thread works too, and picks up any slack */
+	yangModuleLoadWorker(ylbp);
+
+	for (i = 0; i < started; i++)
+	    pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&ylbp->ylb_mutex);
+	return;
+    }
+#endif /* YANG_HAVE_THREADS */
+
+    ylbp->ylb_dict = yangDictGet();
+    yangModuleLoadWorker(ylbp);
+}
+
+/*
+ * Parse all the uncached imports and includes of a file in parallel
+ */
+static void
+yangModulePrefetch (yang_file_t *filep)
+{
+    xmlNodePtr nodep;
+    yang_load_batch_t batch;
+    yang_load_job_t *yljp;
+    unsigned i, count = 0;
+
+    for (nodep = filep->yf_main->children; nodep; nodep = nodep->next) {
+	if (nodep->type == XML_ELEMENT_NODE
+	    && (streq((const char *) nodep->name, YS_IMPORT)
+		|| streq((const char *) nodep->name, YS_INCLUDE)))
+	    count += 1;
+    }
+
+    if (count < 2)		/* Nothing to overlap */
+	return;
+
+    bzero(&batch, sizeof(batch));
+    batch.ylb_jobs = xmlMalloc(count * sizeof(*batch.ylb_jobs));
+    if (batch.ylb_jobs == NULL)
+	return;
+
+    for (nodep = filep->yf_main->children; nodep; nodep = nodep->next) {
+	if (nodep->type != XML_ELEMENT_NODE)
+	    continue;
+
+	int is_import = streq((const char *) nodep->name, YS_IMPORT);
+	if (!is_import && !streq((const char *) nodep->name, YS_INCLUDE))
+	    continue;
+
+	char *fname = slaxGetAttrib(nodep, YS_MODULE);
+	if (fname == NULL)
+	    continue;
+
+	char *rev = (char *) yangGetValue(nodep, YS_REVISION_DATE, YS_DATE);
+	yangModuleName(fname, fname);
+
+	/* Skip cached modules, ourselves, and repeats within the batch */
+	for (i = 0; i < batch.ylb_count; i++) {
+	    yljp = &batch.ylb_jobs[i];
+	    if (streq(fname, yljp->ylj_name)
+		    && (rev == NULL
+			|| (yljp->ylj_rev && streq(rev, yljp->ylj_rev))))
+		break;
+	}
+
+	if (i < batch.ylb_count || streq(fname, filep->yf_name)
+	        || yangModuleCacheFind(fname, rev)) {
+	    xmlFreeAndEasy(fname);
+	    xmlFreeAndEasy(rev);
+	    continue;
+	}
+
+	yljp = &batch.ylb_jobs[batch.ylb_count++];
+	bzero(yljp, sizeof(*yljp));
+	yljp->ylj_name = fname;
+	yljp->ylj_rev = rev;
+	yljp->ylj_is_import = is_import;
+	TAILQ_INIT(&yljp->ylj_list);
+    }
+
+    if (batch.ylb_count > 1) {
+	yangTrace(YTF_LOADER, "yang: loading %u modules for '%s' (%u jobs)",
+		  batch.ylb_count, filep->yf_name, yangSession()->ysn_jobs);
+
+	yangModuleLoadBatch(&batch);
+    } else if (batch.ylb_count == 1) {
+	yljp = &batch.ylb_jobs[0];
+	yljp->ylj_file = yangModuleParse(&yljp->ylj_list, yljp->ylj_name,
+					 yljp->ylj_rev, yangDictGet(), NULL);
+    }
+
+    /*
+     * Add the results in declaration order.  A failure has already
+     * reported its errors, so it's remembered rather than parsed again.
+     */
+    for (i = 0; i < batch.ylb_count; i++) {
+	yljp = &batch.ylb_jobs[i];
+	if (yljp->ylj_file)
+	    yangModuleCacheAdd(&yljp->ylj_list, yljp->ylj_file,
+			       yljp->ylj_rev, yljp->ylj_is_import);
+	else
+	    yangModuleFailedAdd(yljp->ylj_name, yljp->ylj_rev);
+	xmlFreeAndEasy(yljp->ylj_name);
+	xmlFreeAndEasy(yljp->ylj_rev);
+    }
+
+    xmlFree(batch.ylb_jobs);
+}
+
+static int
+yangIsSubmoduleHeader (xmlNodePtr nodep)
+{
+    static const char *names[] = {
+	YS_BELONGS_TO, YS_CONTACT, YS_DESCRIPTION, YS_IMPORT, YS_INCLUDE,
+	YS_ORGANIZATION, YS_REFERENCE, YS_REVISION, YS_YANG_VERSION, NULL
+    };
+    const char **cpp;
+
+    for (cpp = names; *cpp; cpp++)
+	if (streq((const char *) nodep->name, *cpp))
+	    return TRUE;
+
+    return FALSE;
+}
+
+/*
+ * Merge an included submodule into the file being loaded.  Its body
+ * statements are copied in before "anchor" (the include statement),
+ * while its params and templates become globals before "insp".  The
+ * cached document is left untouched, so other loads can share it.
+ * Nested includes are merged once, however often they're reached.
+ */
+static void
+yangMergeInclude (xmlDocPtr docp, xmlNodePtr anchor, xmlNodePtr insp,
+		  yang_file_t *yfp)
+{
+    unsigned generation = yangSession()->ysn_generation;
+    xmlNodePtr nodep, newp;
+    yang_import_t *yip;
+
+    if (yfp->yf_merged == generation || yfp->yf_main == NULL)
+	return;
+    yfp->yf_merged = generation;
+
+    for (nodep = yfp->yf_main->children; nodep; nodep = nodep->next) {
+	if (nodep->type != XML_ELEMENT_NODE || yangIsSubmoduleHeader(nodep))
+	    continue;
+
+	newp = xmlDocCopyNode(nodep, docp, 1);
+	if (newp == NULL)
+	    break;
+
+	if (streq((const char *) nodep->name, ELT_PARAM)
+	    || streq((const char *) nodep->name, ELT_TEMPLATE))
+	    xmlAddPrevSibling(insp, newp);
+	else
+	    xmlAddPrevSibling(anchor, newp);
+    }
+
+    TAILQ_FOREACH(yip, &yfp->yf_imports, yi_link) {
+	if (!(yip->yi_flags & YFF_IMPORT))
+	    yangMergeInclude(docp, anchor, insp, yip->yi_file);
+    }
+}
+
+/*
+ * Import or include a file.  Returns -1 if it can't be loaded, or if
+ * it (or something it imports) is circular or can't be loaded.
+ */
+static int
+yangImportFile (yang_file_t *filep, xmlNodePtr nodep, xmlNodePtr insp,
+		const char *fname, const char *pref, const char *rev,
+		int is_import, int merge)
+{
+    yang_file_t *yfp;
+    yang_import_t *yip;
+    int rc = 0;
+
+    yangTrace(YTF_LOADER, "yang: import: '%s' '%s' '%s' %s",
+	    fname ?: "", pref ?: "", rev ?: "", is_import ? " is-import" : "");
+
+    if (fname == NULL)
+	return 0;
+
+    char name[strlen(fname) + 1];
+    yangModuleName(fname, name);
+
+    /* A file still resolving its own imports means we've looped */
+    yfp = yangModuleCacheFind(name, rev);
+    if (streq(name, filep->yf_name)
+	    || (yfp && (yfp->yf_flags & YFF_LOADING))) {
+	slaxError("%s: circular %s of '%s'", filep->yf_path,
+		  is_import ? "import" : "include", name);
+	return -1;
+    }
+
+    if (yfp == NULL && !yangModuleFailedTake(name, rev))
+	yfp = yangModuleLoad(name, rev, is_import);
+
+    if (yfp == NULL) {
+	slaxError("%s: could not load %s '%s'", filep->yf_path,
+		  is_import ? "module" : "submodule", name);
+	return -1;
+    }
+
+    /* The failure was reported where it happened */
+    if (yangModuleResolve(yfp))
+	rc = -1;
+
+    yip = xmlMalloc(sizeof(*yip));
+    if (yip == NULL)
+	return -1;
+
+    bzero(yip, sizeof(*yip));
+    yip->yi_file = yfp;
+    yip->yi_prefix = pref ? strdup(pref) : NULL;
+    yip->yi_flags = is_import ? YFF_IMPORT : 0;
+    TAILQ_INSERT_TAIL(&filep->yf_imports, yip, yi_link);
+
+    if (is_import && pref && yangPrefixAdd(filep, pref, yfp)) {
+	slaxError("%s: duplicate prefix '%s' for import of '%s'",
+		  filep->yf_path, pref, name);
+	rc = -1;
+    }
+
+    if (merge && !is_import)
+	yangMergeInclude(filep->yf_docp, nodep, insp, yfp);
+
+    return rc;
+}
+
+/*
+ * Find and load all imported modules, from which we extract all
+ * groupings, typedefs, extensions, features, and identities.  We
+ * also handle includes.  Imported and included files come from the
+ * module cache; when "merge" is set, included submodules are merged
+ * into this file.  Every import is tried, so all the errors are
+ * reported, but -1 is returned if any of them failed.
+ */
+static int
+yangHandleImports (yang_file_list_t *listp UNUSED, yang_file_t *filep,
+		   int merge)
+{
+    xmlNodePtr insp, mainp, nodep, nextp;
+    int is_import, rc = 0;
+
+    mainp = filep->yf_main;	/* Look at the current module */
+    insp = mainp->parent->parent->children; /* Insertion point */
+
+    if (yangSession()->ysn_jobs > 1)
+	yangModulePrefetch(filep);
+
+    for (nodep = mainp->children; nodep; nodep = nextp) {
+	nextp = nodep->next;
 
 	if (nodep->type != XML_ELEMENT_NODE)
 	    continue;
@@ -382,12 +1507,53 @@ yangHandleImports (yang_file_list_t *listp UNUSED, yang_file_t *filep UNUSED)
 	else
 	    continue;
 
-	const char *fname = slaxGetAttrib(nodep, YS_MODULE);
-	const char *pref
-	    = is_import ? yangGetValue(nodep, YS_PREFIX, YS_VALUE): NULL;
-	const char *rev = yangGetValue(nodep, YS_REVISION_DATE, YS_DATE);
+	char *fname = slaxGetAttrib(nodep, YS_MODULE);
+	char *pref = is_import
+	    ? (char *) yangGetValue(nodep, YS_PREFIX, YS_VALUE) : NULL;
+	char *rev = (char *) yangGetValue(nodep, YS_REVISION_DATE, YS_DATE);
+
+	if (yangImportFile(filep, nodep, insp, fname, pref, rev,
+			   is_import, merge))
+	    rc = -1;
 
-	yangImportFile(listp, insp, fname, pref, rev, is_import);
+	xmlFreeAndEasy(fname);
+	xmlFreeAndEasy(pref);
+	xmlFreeAndEasy(rev);
+    }
+
+    return rc;
+}
+
+/*
+ * Release every module in the module cache, and the pooled parser
+ */
+void
+yangModuleCacheClean (void)
+{
+    yang_session_t *ysnp = yangSession();
+    yang_file_t *yfp;
+
+    yangParserClean(&ysnp->ysn_parser);
+
+    if (ysnp->ysn_module_failed) {
+	xmlHashFree(ysnp->ysn_module_failed, NULL);
+	ysnp->ysn_module_failed = NULL;
+    }
+
+    if (ysnp->ysn_module_names == NULL)
+	return;
+
+    /* The tables don't own their entries; the list does */
+    xmlHashFree(ysnp->ysn_module_revs, NULL);
+    xmlHashFree(ysnp->ysn_module_names, NULL);
+    ysnp->ysn_module_revs = ysnp->ysn_module_names = NULL;
+
+    for (;;) {
+	yfp = TAILQ_FIRST(&ysnp->ysn_modules);
+	if (yfp == NULL)
+	    break;
+	TAILQ_REMOVE(&ysnp->ysn_modules, yfp, yf_link);
+	yangFileFree(yfp, TRUE);
     }
 }
 
@@ -411,7 +1577,7 @@ yangHandleGlobals (yang_file_list_t *listp UNUSED, yang_file_t *filep)
 
 	if (streq((const char *) nodep->name, ELT_PARAM)
 	    || streq((const char *) nodep->name, ELT_TEMPLATE)) {
-	    slaxLog("moving global '%s' (%p)",
+	    yangTrace(YTF_LOADER, "moving global '%s' (%p)",
 		    (const char *) nodep->name, nodep);
 	} else {
 	    continue;
@@ -423,13 +1589,15 @@ yangHandleGlobals (yang_file_list_t *listp UNUSED, yang_file_t *filep)
 }
 
 xmlDocPtr
-yangLoadFile (const char *template, const char *filename, FILE *file,
-	      xmlDictPtr dict, int partial UNUSED)
+yangLoadFile (yang_session_t *ysnp, const char *template,
+	      const char *filename, FILE *file, int partial UNUSED)
 {
     int len = strlen(filename) + 1;
     char name[len], *cp, *sp;
     yang_file_list_t list;
     yang_file_t *yfp;
+    yang_session_t *old = yangSessionEnter(ysnp);
+    xmlDictPtr dict = yangDictGet();
 
     TAILQ_INIT(&list);
 
@@ -440,15 +1608,26 @@ yangLoadFile (const char *template, const char *filename, FILE *file,
 	*cp = '\0';
 
     yfp = yangFileParse(&list, template, name, filename, file, dict, partial);
-    if (yfp == NULL)
+    if (yfp == NULL) {
+	yangSessionLeave(old);
 	return NULL;
+    }
 
     xmlDocPtr docp = yfp->yf_docp;
     if (docp) {
-	yangHandleImports(&list, yfp);
-	yangHandleGlobals(&list, yfp);
+	yangSession()->ysn_generation += 1;
 
-	slaxDynLoad(yfp->yf_docp); /* Check dynamic extensions */
+	/* A module whose imports failed is as broken as a parse error */
+	if (yangHandleImports(&list, yfp, TRUE)) {
+	    docp = NULL;
+	} else {
+	    yangHandleGlobals(&list, yfp);
+	    yangUsesExpandFile(yfp);
+	    yangFeaturesPrune(yfp);
+	    yangDependAddFile(yfp);
+
+	    slaxDynLoad(yfp->yf_docp); /* Check dynamic extensions */
+	}
     }
 
     yang_file_t *xp;
@@ -457,60 +1636,29 @@ yangLoadFile (const char *template, const char *filename, FILE *file,
         if (xp == NULL)
             break;
         TAILQ_REMOVE(&list, xp, yf_link);
-	yangFileFree(xp, (xp != yfp));
+	yangFileFree(xp, (xp != yfp || docp == NULL));
     }
 
+    yangSessionLeave(old);
     return docp;
 }
 
-xmlDocPtr
-yangLoadParams (const char *filename, FILE *file,
-		xmlDictPtr dict)
+static xmlDocPtr
+yangLoadParamsFile (const char *filename, FILE *file)
 {
+    yang_parser_t *yprp = &yangSession()->ysn_parser;
     slax_data_t sd;
-    yang_data_t yd;
+    yang_data_t *ydp;
     int rc;
-    xmlParserCtxtPtr ctxt = xmlNewParserCtxt();
 
-    if (ctxt == NULL)
+    if (yangParserStart(yprp, &sd, filename, file, yangDictGet()) == NULL)
 	return NULL;
 
-    /*
-     * Turn on line number recording in each node
-     */
-    ctxt->linenumbers = 1;
-
-    if (dict) {
-	if (ctxt->dict)
-	    xmlDictFree(ctxt->dict);
-
-    	ctxt->dict = dict;
- 	xmlDictReference(ctxt->dict);
-    }
-
-    bzero(&sd, sizeof(sd));
-
-    /* We want to parse SLAX, either full or partial */
-    sd.sd_parse = sd.sd_ttype = M_YANG;
-    sd.sd_flags |= SDF_SLSH_COMMENTS;
-
-    strncpy(sd.sd_filename, filename, sizeof(sd.sd_filename));
-    sd.sd_file = file;
-
-    sd.sd_ctxt = ctxt;
+    yangDependAdd(filename);
 
-    ctxt->version = xmlCharStrdup(XML_DEFAULT_VERSION);
-    ctxt->userData = &sd;
-
-    /*
-     * Fake up an inputStream so the error mechanisms will work
-     */
-    if (filename)
-	xmlSetupParserForBuffer(ctxt, (const xmlChar *) "", filename);
-
-    sd.sd_docp = slaxBuildDoc(&sd, ctxt);
+    sd.sd_docp = slaxBuildDoc(&sd, sd.sd_ctxt);
     if (sd.sd_docp == NULL) {
-	slaxDataCleanup(&sd);
+	yangParserFinish(yprp, &sd);
 	return NULL;
     }
 
@@ -521,8 +1669,8 @@ yangLoadParams (const char *filename, FILE *file,
     xmlNewNs(sd.sd_ctxt->node, (const xmlChar *) YIN_URI,
 			    (const xmlChar *) YIN_PREFIX);
 
-    bzero(&yd, sizeof(yd));
-    sd.sd_opaque = &yd;		/* Hang our data off the slax parser */
+    ydp = yangParserData(yprp);
+    sd.sd_opaque = ydp;		/* Hang our data off the slax parser */
 
     rc = yangParse(&sd);
 
@@ -530,14 +1678,24 @@ yangLoadParams (const char *filename, FILE *file,
 	slaxError("%s: %d error%s detected during parsing (%d)",
 	  sd.sd_filename, sd.sd_errors, (sd.sd_errors == 1) ? "" : "s", rc);
 
-	slaxDataCleanup(&sd);
+	yangParserFinish(yprp, &sd);
 	return NULL;
     }
 
     /* Save docp before slaxDataCleanup nukes it */
     xmlDocPtr docp = sd.sd_docp;
     sd.sd_docp = NULL;
-    slaxDataCleanup(&sd);
+    yangParserFinish(yprp, &sd);
 
     return docp;
 }    
+
+xmlDocPtr
+yangLoadParams (yang_session_t *ysnp, const char *filename, FILE *file)
+{
+    yang_session_t *old = yangSessionEnter(ysnp);
+    xmlDocPtr docp = yangLoadParamsFile(filename, file);
+
+    yangSessionLeave(old);
+    return docp;
+}
@@ -7,6 +7,22 @@
  * LICENSE.
  */
 
+struct yang_file_s;
+
+/*
+ * A reference from one file to a file it imports or includes.  The
+ * referenced file is owned by the module cache, so the same
+ * yang_file_t is shared by every file that refers to it.
+ */
+typedef struct yang_import_s {
+    TAILQ_ENTRY(yang_import_s) yi_link; /* Next import */
+    struct yang_file_s *yi_file;      /* Imported or included file */
+    char *yi_prefix;		      /* Prefix (imports only) */
+    unsigned yi_flags;		      /* Flags (YFF_IMPORT) */
+} yang_import_t;
+
+typedef TAILQ_HEAD(yang_import_list_s, yang_import_s) yang_import_list_t;
+
 typedef struct yang_file_s {
     TAILQ_ENTRY(yang_file_s) yf_link; /* Next file */
     char *yf_name;		      /* Name of this module or submodule */
@@ -19,6 +35,10 @@ typedef struct yang_file_s {
     char *yf_path;		      /* Full path to the file */
     char *yf_revision;		      /* Revision date (or null) */
     xmlXPathContextPtr yf_context;    /* Context for functions/select */
+    yang_import_list_t yf_imports;    /* Files we import or include */
+    unsigned yf_merged;		      /* Load that last merged us */
+    xmlHashTablePtr yf_symbols;	      /* (name, kind) -> definition */
+    xmlHashTablePtr yf_prefixes;      /* Import prefix -> yang_file_t */
 } yang_file_t;
 
 typedef TAILQ_HEAD(yang_file_list_s, yang_file_s) yang_file_list_t;
@@ -26,15 +46,27 @@ typedef TAILQ_HEAD(yang_file_list_s, yang_file_s) yang_file_list_t;
 /* Flags for yf_flags: */
 #define YFF_IMPORT	(1<<0)	/* Imported (not included) */
 #define YFF_MODULE	(1<<1)	/* File is a module */
+#define YFF_LOADING	(1<<2)	/* Imports are being resolved */
+#define YFF_CACHED	(1<<3)	/* Owned by the module cache */
+#define YFF_RESOLVED	(1<<4)	/* Imports have been resolved */
+#define YFF_FAILED	(1<<5)	/* An import or include failed */
 
-#define YANG_MAX_STATEMENT_MAP 256
+#define YANG_MAX_STATEMENT_MAP 256 /* Minimum size of the seen map (bits) */
 #ifndef NBBY
 #define NBBY 8
 #endif /* NBBY */
 
-typedef unsigned char yang_seen_elt_t;
+/*
+ * The seen map is a bitmap of the substatements (by ys_id) that have
+ * been seen inside a statement.  It's sized to cover every registered
+ * statement, so it grows as extension statements are added.
+ */
+typedef unsigned long yang_seen_elt_t;
+#define YANG_SEEN_BITS (sizeof(yang_seen_elt_t) * NBBY)
+#define YANG_SEEN_WORDS(_bits) (((_bits) + YANG_SEEN_BITS - 1) / YANG_SEEN_BITS)
+
 typedef struct yang_seen_s {
-    yang_seen_elt_t yss_map[YANG_MAX_STATEMENT_MAP / NBBY];
+    yang_seen_elt_t *yss_map;	/* Bitmap (yd_seen_words long) */
 } yang_seen_t;
 
 typedef struct yang_parse_stack_s {
@@ -54,8 +86,113 @@ typedef struct yang_data_s {
     xmlNsPtr yd_nsp;		/* Point to the 'yin' namespace */
     yang_file_t *yd_filep;	/* Current file */
     yang_file_list_t *yd_file_list; /* List of current files */
+    yang_seen_elt_t *yd_seen_maps; /* Backing store for yps_seen maps */
+    unsigned yd_seen_words;	/* Number of words in each seen map */
+    yang_parse_stack_t *yd_stack_high; /* Deepest frame used */
+    unsigned yd_for_count;	/* "for" loops seen, for variable names */
 } yang_data_t;
 
+/*
+ * A parser holds the parts of a parse that can be reused from one
+ * file to the next: the libxml2 parser context and the yang_data_t
+ * (with its seen maps).  Resetting the stack only touches the frames
+ * that were used.  A parser must only be used by one thread at a time.
+ */
+typedef struct yang_parser_s {
+    xmlParserCtxtPtr ypr_ctxt;	/* Pooled parser context */
+    xmlDictPtr ypr_dict;	/* Dictionary given to ypr_ctxt (or NULL) */
+    yang_data_t ypr_data;	/* Reused parser data */
+} yang_parser_t;
+
+void
+yangParserInit (yang_parser_t *yprp);
+
+/*
+ * A session owns all the mutable state of a compilation: the
+ * statement registry, features, dictionary, module cache, include
+ * path and so on.  Sessions share nothing, so threads can compile
+ * concurrently, each in its own session.  Functions that don't take
+ * a session use the calling thread's current one (yangSessionSet),
+ * which defaults to a process-wide session.
+ */
+typedef struct yang_session_s {
+    unsigned ysn_flags;		/* Flags (YSNF_*) */
+
+    /* Statement registry (yangstmt.c) */
+    TAILQ_HEAD(, yang_stmt_s) ysn_stmts; /* Registered statements */
+    xmlDictPtr ysn_stmt_dict;	/* Dictionary for the tables' keys */
+    xmlHashTablePtr ysn_stmt_table; /* (name, namespace) -> statement */
+    xmlHashTablePtr ysn_stmt_names; /* name -> first statement */
+    unsigned ysn_stmt_count;	/* Number of registered statements */
+    struct yang_stmt_s **ysn_stmt_ids; /* Statements, by ys_id */
+    unsigned ysn_stmt_ids_size;	/* Allocated entries in ysn_stmt_ids */
+    unsigned ysn_stmt_unknown;	/* Statements with unregistered children */
+
+    /* Features (--feature, --prune-features) */
+    slax_data_list_t ysn_features; /* Enabled features */
+    int ysn_features_complete;	/* Prune features not in the list */
+
+    /* Loader (yangloader.c) */
+    xmlDictPtr ysn_dict;	/* Dictionary shared by all documents */
+    yang_parser_t ysn_parser;	/* Parser for the session's own thread */
+    yang_file_list_t ysn_modules; /* Module cache, in load order */
+    xmlHashTablePtr ysn_module_revs; /* (name, revision) -> file */
+    xmlHashTablePtr ysn_module_names; /* name -> file */
+    xmlHashTablePtr ysn_module_failed; /* Failed prefetches (name, rev) */
+    unsigned ysn_generation;	/* Bumped for each yangLoadFile */
+    char *ysn_cache_dir;	/* Persistent cache directory */
+    unsigned ysn_jobs;		/* Number of worker threads */
+
+    /* Include path (yangpath.c) */
+    slax_data_list_t ysn_includes; /* Include directories, in order */
+    xmlHashTablePtr ysn_include_index; /* "name" or "name@rev" -> path */
+    xmlHashTablePtr ysn_include_latest; /* "name" -> newest "name@rev" */
+    xmlHashTablePtr ysn_include_misses; /* Names no search could find */
+#ifdef YANG_HAVE_THREADS
+    pthread_mutex_t ysn_include_mutex; /* Protects ysn_include_misses */
+#endif /* YANG_HAVE_THREADS */
+
+    /* Uses expansion (yanguses.c) */
+    int ysn_expand_uses;	/* Expand "uses" (--expand-uses) */
+    xmlDocPtr ysn_expand_doc;	/* Holds memoized expansions */
+    xmlHashTablePtr ysn_expand_memo; /* (grouping, changes) -> holder */
+    xmlHashTablePtr ysn_expand_active; /* Groupings being expanded */
+
+    /* Dependencies (yangdepend.c) */
+    slax_data_list_t ysn_depends; /* Files read, in order */
+    xmlHashTablePtr ysn_depend_seen; /* Paths in ysn_depends */
+
+    /* Parameter files (yangparams.c) */
+    xmlHashTablePtr ysn_param_docs; /* Filename -> parsed document */
+} yang_session_t;
+
+/* Flags for ysn_flags: */
+#define YSNF_INITTED	(1<<0)	/* Lists have been initialized */
+
+yang_session_t *
+yangSessionCreate (void);
+
+void
+yangSessionFree (yang_session_t *ysnp);
+
+yang_session_t *
+yangSession (void);
+
+yang_session_t *
+yangSessionSet (yang_session_t *ysnp);
+
+yang_session_t *
+yangSessionEnter (yang_session_t *ysnp);
+
+void
+yangSessionLeave (yang_session_t *old);
+
+void
+yangSessionClean (void);
+
+void
+yangParserClean (yang_parser_t *yprp);
+
 /*
  * Find parent parse stack frame
  */
@@ -76,6 +213,9 @@ yangData (slax_data_t *sdp)
     return sdp->sd_opaque;
 }
 
+void
+yangDataCleanup (yang_data_t *ydp);
+
 /*
  * The bison-based parser's main function
  */
@@ -92,8 +232,235 @@ yangError (slax_data_t *sdp, const char *fmt, ...);
 void
 yangFeatureAdd (const char *feature_name);
 
+void
+yangFeaturesClean (void);
+
+xmlDocPtr
+yangFeaturesBuildDoc (slax_data_list_t *listp, xmlDictPtr dict);
+
 xmlDocPtr
 yangFeaturesBuildInputDoc (void);
 
+void
+yangFeaturesSetComplete (int complete);
+
+void
+yangModuleCacheClean (void);
+
+xmlDictPtr
+yangDictGet (void);
+
+void
+yangDictClean (void);
+
+xmlDocPtr
+yangReadFile (const char *filename, const char *encoding, int options);
+
+void
+yangIncludeAdd (const char *dir);
+
+void
+yangIncludeAddPath (const char *path);
+
+void
+yangIncludeIndexBuild (void);
+
+void
+yangIncludeIndexClean (void);
+
+FILE *
+yangIncludeFind (const char *name, char *buf, int bufsiz);
+
+void
+yangIncludeClean (void);
+
+int
+yangSymbolIsKind (const char *kind);
+
+int
+yangSymbolAdd (yang_file_t *yfp, const char *kind, const char *name,
+	       xmlNodePtr nodep);
+
+int
+yangPrefixAdd (yang_file_t *yfp, const char *prefix, yang_file_t *target);
+
+yang_file_t *
+yangPrefixFind (yang_file_t *yfp, const char *prefix);
+
+xmlNodePtr
+yangSymbolResolveFile (yang_file_t *yfp, const char *kind, const char *ref,
+		       yang_file_t **filepp);
+
+void
+yangSymbolSetPrefix (yang_file_t *yfp);
+
+void
+yangSymbolScan (yang_file_t *yfp);
+
+void
+yangSymbolClean (yang_file_t *yfp);
+
+void
+yangLoaderSetExpandUses (int expand);
+
+void
+yangUsesExpandFile (yang_file_t *yfp);
+
+void
+yangDependAdd (const char *path);
+
+void
+yangDependAddFile (yang_file_t *yfp);
+
+int
+yangDependWrite (const char *filename, const char *target);
+
+void
+yangDependClean (void);
+
+int
+yangHashFile (const char *path, uint64_t *hashp);
+
+int
+yangManifestIsCurrent (const char *manifest, const char *output,
+		       uint64_t options);
+
+int
+yangManifestUpdate (const char *manifest, const char *output,
+		    uint64_t options);
+
+void
+yangLoaderSetJobs (unsigned jobs);
+
+void
+yangLoaderSetCacheDir (const char *dir);
+
 xmlDocPtr
-yangLoadParams (const char *filename, FILE *file, xmlDictPtr dict);
+yangLoadParams (yang_session_t *ysnp, const char *filename, FILE *file);
+
+/*
+ * Output buffers (yangbuf.c).  Text is copied into the buffer and
+ * written out in large pieces.  Indentation is added lazily, at the
+ * first text on each line, so a caller changing the indent before
+ * writing a closing brace gets the brace at the outer level.
+ */
+#define YANG_BUF_FLUSH	(64 * 1024) /* Initial size and write size */
+#define YANG_BUF_INDENT	4	/* Spaces per indent level */
+
+typedef struct yang_buf_s {
+    char *yb_data;		/* Buffered text */
+    size_t yb_len;		/* Length of yb_data */
+    size_t yb_size;		/* Allocated size of yb_data */
+    unsigned yb_indent;		/* Current indent level */
+    int yb_bol;			/* At the beginning of a line */
+    int yb_fd;			/* File descriptor to write to (or -1) */
+    slaxWriterFunc_t yb_func;	/* Or a function to write through */
+    void *yb_func_data;		/* Opaque data for yb_func */
+    int yb_error;		/* errno of first failure (or zero) */
+    struct yang_stmt_cache_s *yb_stmts; /* Writer's statement cache */
+} yang_buf_t;
+
+void
+yangBufInit (yang_buf_t *ybp, int fd);
+
+void
+yangBufInitFunc (yang_buf_t *ybp, slaxWriterFunc_t func, void *data);
+
+char *
+yangBufGrow (yang_buf_t *ybp, size_t len);
+
+int
+yangBufFlush (yang_buf_t *ybp);
+
+int
+yangBufClean (yang_buf_t *ybp);
+
+void
+yangBufPad (yang_buf_t *ybp, size_t count);
+
+int
+yangBufConcat (yang_buf_t *ybp, yang_buf_t *parts, unsigned count,
+	       size_t stride);
+
+/*
+ * Shared by the writers (yangwriter.c, yangblob.c)
+ */
+const char *
+yangWriteArgument (struct yang_stmt_cache_s *yscp, xmlNodePtr nodep,
+		   const char **argumentp, const xmlChar **iargumentp,
+		   int *onlyp, char **freep);
+
+/*
+ * Add text without any indentation
+ */
+static inline void
+yangBufAddRaw (yang_buf_t *ybp, const char *data, size_t len)
+{
+    char *cp;
+
+    if (ybp->yb_len + len <= ybp->yb_size)
+	cp = ybp->yb_data + ybp->yb_len;
+    else if ((cp = yangBufGrow(ybp, len)) == NULL)
+	return;
+
+    memcpy(cp, data, len);
+    ybp->yb_len += len;
+}
+
+static inline void
+yangBufAdd (yang_buf_t *ybp, const char *data, size_t len)
+{
+    if (ybp->yb_bol) {
+	ybp->yb_bol = FALSE;
+	if (ybp->yb_indent)
+	    yangBufPad(ybp, ybp->yb_indent * YANG_BUF_INDENT);
+    }
+
+    yangBufAddRaw(ybp, data, len);
+}
+
+static inline void
+yangBufAddString (yang_buf_t *ybp, const char *str)
+{
+    yangBufAdd(ybp, str, strlen(str));
+}
+
+static inline void
+yangBufAddChar (yang_buf_t *ybp, char ch)
+{
+    yangBufAdd(ybp, &ch, 1);
+}
+
+static inline void
+yangBufNewline (yang_buf_t *ybp)
+{
+    yangBufAddRaw(ybp, "\n", 1);
+    ybp->yb_bol = TRUE;
+}
+
+/*
+ * Parameter overlays (yangparams.c)
+ */
+typedef struct yang_overlay_s yang_overlay_t;
+
+xmlDocPtr
+yangParamsLoad (const char *filename);
+
+void
+yangParamsClean (void);
+
+yang_overlay_t *
+yangOverlayCreate (void);
+
+void
+yangOverlayFree (yang_overlay_t *yovp);
+
+int
+yangOverlaySet (yang_overlay_t *yovp, const char *name, const char *value,
+		const char *layer);
+
+int
+yangOverlayAddFile (yang_overlay_t *yovp, const char *filename);
+
+const char **
+yangOverlayParams (yang_overlay_t *yovp);
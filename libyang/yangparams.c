@@ -0,0 +1,342 @@
+/*
+ * Copyright (c) 2014, Juniper Networks, Inc.
+ * All rights reserved.
+ * See ../Copyright for the status of this software
+ */
+
+/*
+ * Parameter overlays.  A parameter file supplies local values for a
+ * script's parameters, and several can be layered, much as multiple
+ * junos-defaults files are loaded, with the last layer winning.
+ * Rather than merging the files into the script, we parse each file
+ * once (keeping it in the session), and build an overlay: an index of
+ * parameter names to the value from the topmost layer that sets them.
+ * The overlay yields the name/value pairs that xsltApplyStylesheet
+ * takes, so the compiled stylesheet is never copied or reparsed.
+ *
+ * Values are XPath expressions: a parameter's "select" attribute, or
+ * its text content as a string literal.  Command line values (-a)
+ * can be added as a final layer with yangOverlaySet.
+ */
+
+#include <sys/queue.h>
+#include <errno.h>
+
+#include <libxml/hash.h>
+
+#include "yanginternals.h"
+#include <libslax/slax.h>
+#include <libslax/slaxdata.h>
+#include <libyang/yang.h>
+#include <libyang/yangparser.h>
+#include <libyang/yangloader.h>
+#include <libyang/yangtrace.h>
+
+typedef struct yang_overlay_param_s {
+    TAILQ_ENTRY(yang_overlay_param_s) yop_link; /* Next parameter */
+    char *yop_name;		/* Parameter name */
+    char *yop_value;		/* XPath expression */
+    const char *yop_layer;	/* Layer that set the value */
+} yang_overlay_param_t;
+
+struct yang_overlay_s {
+    TAILQ_HEAD(, yang_overlay_param_s) yo_params; /* In first-set order */
+    xmlHashTablePtr yo_index;	/* Name -> yang_overlay_param_t */
+    unsigned yo_count;		/* Number of parameters */
+};
+
+static void
+yangParamsFreeDoc (void *payload, const xmlChar *name UNUSED)
+{
+    xmlFreeDoc(payload);
+}
+
+/*
+ * Return a parsed parameter file, parsing it only the first time
+ */
+xmlDocPtr
+yangParamsLoad (const char *filename)
+{
+    yang_session_t *ysnp = yangSession();
+    xmlDocPtr docp;
+    FILE *fp;
+
+    if (ysnp->ysn_param_docs == NULL) {
+	ysnp->ysn_param_docs = xmlHashCreate(0);
+	if (ysnp->ysn_param_docs == NULL)
+	    return NULL;
+    }
+
+    docp = xmlHashLookup(ysnp->ysn_param_docs, (const xmlChar *) filename);
+    if (docp) {
+	yangDependAdd(filename);
+	return docp;
+    }
+
+    fp = fopen(filename, "r");
+    if (fp == NULL) {
+	slaxError("%s: cannot open parameter file: %s",
+		  filename, strerror(errno));
+	return NULL;
+    }
+
+    docp = yangLoadParams(NULL, filename, fp);
+    fclose(fp);
+
+    if (docp && xmlHashAddEntry(ysnp->ysn_param_docs,
+				(const xmlChar *) filename, docp)) {
+	xmlFreeDoc(docp);
+	return NULL;
+    }
+
+    return docp;
+}
+
+/*
+ * Forget all parsed parameter files
+ */
+void
+yangParamsClean (void)
+{
+    yang_session_t *ysnp = yangSession();
+
+    if (ysnp->ysn_param_docs) {
+	xmlHashFree(ysnp->ysn_param_docs, yangParamsFreeDoc);
+	ysnp->ysn_param_docs = NULL;
+    }
+}
+
+yang_overlay_t *
+yangOverlayCreate (void)
+{
+    yang_overlay_t *yovp;
+
+    yovp = xmlMalloc(sizeof(*yovp));
+    if (yovp == NULL)
+	return NULL;
+
+    bzero(yovp, sizeof(*yovp));
+    TAILQ_INIT(&yovp->yo_params);
+
+    yovp->yo_index = xmlHashCreate(0);
+    if (yovp->yo_index == NULL) {
+	xmlFree(yovp);
+	return NULL;
+    }
+
+    return yovp;
+}
+
+void
+yangOverlayFree (yang_overlay_t *yovp)
+{
+    yang_overlay_param_t *yopp;
+
+    if (yovp == NULL)
+	return;
+
+    while ((yopp = TAILQ_FIRST(&yovp->yo_params)) != NULL) {
+	TAILQ_REMOVE(&yovp->yo_params, yopp, yop_link);
+	xmlFree(yopp->yop_name);
+	xmlFree(yopp->yop_value);
+	xmlFree(yopp);
+    }
+
+    xmlHashFree(yovp->yo_index, NULL);
+    xmlFree(yovp);
+}
+
+/*
+ * Set a parameter, replacing any value from a lower layer.  The
+ * value is an XPath expression.
+ */
+int
+yangOverlaySet (yang_overlay_t *yovp, const char *name, const char *value,
+		const char *layer)
+{
+    yang_overlay_param_t *yopp;
+    char *newp;
+
+    newp = (char *) xmlStrdup((const xmlChar *) value);
+    if (newp == NULL)
+	return -1;
+
+    yopp = xmlHashLookup(yovp->yo_index, (const xmlChar *) name);
+    if (yopp) {
+	yangTrace(YTF_EVAL, "yang: param '%s': '%s' (%s) overrides '%s' (%s)",
+		  name, value, layer ?: "", yopp->yop_value,
+		  yopp->yop_layer ?: "");
+	xmlFree(yopp->yop_value);
+	yopp->yop_value = newp;
+	yopp->yop_layer = layer;
+	return 0;
+    }
+
+    yopp = xmlMalloc(sizeof(*yopp));
+    if (yopp == NULL) {
+	xmlFree(newp);
+	return -1;
+    }
+
+    bzero(yopp, sizeof(*yopp));
+    yopp->yop_name = (char *) xmlStrdup((const xmlChar *) name);
+    yopp->yop_value = newp;
+    yopp->yop_layer = layer;
+
+    if (yopp->yop_name == NULL
+	    || xmlHashAddEntry(yovp->yo_index, (const xmlChar *) name, yopp)) {
+	xmlFreeAndEasy(yopp->yop_name);
+	xmlFree(newp);
+	xmlFree(yopp);
+	return -1;
+    }
+
+    TAILQ_INSERT_TAIL(&yovp->yo_params, yopp, yop_link);
+    yovp->yo_count += 1;
+
+    return 0;
+}
+
+/*
+ * Turn a string into an XPath string literal.  A string holding both
+ * kinds of quote has to be built with concat().
+ */
+static char *
+yangParamsQuote (const char *value)
+{
+    size_t len = strlen(value);
+    char *res, *cp;
+    const char *sp;
+
+    if (strchr(value, '"') == NULL || strchr(value, '\'') == NULL) {
+	char quote = strchr(value, '"') ? '\'' : '"';
+
+	res = xmlMalloc(len + 3);
+	if (res)
+	    snprintf(res, len + 3, "%c%s%c", quote, value, quote);
+	return res;
+    }
+
+    /* concat('...', "'", '...'), with each quote as its own piece */
+    res = cp = xmlMalloc(len * 6 + 16);
+    if (res == NULL)
+	return NULL;
+
+    cp += sprintf(cp, "concat(''");
+    for (sp = value; *sp; sp++) {
+	if (*sp == '\'') {
+	    cp += sprintf(cp, ", \"'\"");
+	    continue;
+	}
+
+	if (sp == value || sp[-1] == '\'')
+	    cp += sprintf(cp, ", '");
+	*cp++ = *sp;
+	if (sp[1] == '\0' || sp[1] == '\'')
+	    *cp++ = '\'';
+    }
+    sprintf(cp, ")");
+
+    return res;
+}
+
+/*
+ * The value of a parameter declaration, as an XPath expression
+ */
+static char *
+yangParamsValue (xmlNodePtr nodep, const char *filename, const char *name)
+{
+    xmlNodePtr childp;
+    char *value, *res;
+
+    value = slaxGetAttrib(nodep, ATT_SELECT);
+    if (value)
+	return value;
+
+    for (childp = nodep->children; childp; childp = childp->next) {
+	if (childp->type != XML_TEXT_NODE
+		&& childp->type != XML_CDATA_SECTION_NODE) {
+	    slaxError("%s: parameter '%s': only simple values can be "
+		      "overlaid", filename, name);
+	    return NULL;
+	}
+    }
+
+    value = (char *) xmlNodeGetContent(nodep);
+    res = yangParamsQuote(value ?: "");
+    xmlFreeAndEasy(value);
+
+    return res;
+}
+
+/*
+ * Add a parameter file as the overlay's new top layer.  Returns -1
+ * if the file can't be loaded or holds anything but parameters.
+ */
+int
+yangOverlayAddFile (yang_overlay_t *yovp, const char *filename)
+{
+    xmlDocPtr docp = yangParamsLoad(filename);
+    xmlNodePtr root, nodep;
+    int rc = 0;
+
+    if (docp == NULL)
+	return -1;
+
+    root = xmlDocGetRootElement(docp);
+    if (root == NULL)
+	return 0;
+
+    for (nodep = root->children; nodep; nodep = nodep->next) {
+	if (nodep->type != XML_ELEMENT_NODE)
+	    continue;
+
+	if (nodep->ns == NULL
+		|| !streq((const char *) nodep->ns->href, XSL_URI)
+		|| !streq((const char *) nodep->name, ELT_PARAM)) {
+	    slaxError("%s: '%s' cannot be overlaid; only parameters can",
+		      filename, nodep->name);
+	    rc = -1;
+	    continue;
+	}
+
+	char *name = slaxGetAttrib(nodep, ATT_NAME);
+	if (name == NULL)
+	    continue;
+
+	char *value = yangParamsValue(nodep, filename, name);
+	if (value == NULL
+		|| yangOverlaySet(yovp, name, value, (const char *) docp->URL))
+	    rc = -1;
+
+	xmlFreeAndEasy(value);
+	xmlFree(name);
+    }
+
+    return rc;
+}
+
+/*
+ * Return the overlay as a NULL-terminated array of name/value pairs
+ * for xsltApplyStylesheet.  The array is the caller's to xmlFree;
+ * the strings belong to the overlay.
+ */
+const char **
+yangOverlayParams (yang_overlay_t *yovp)
+{
+    yang_overlay_param_t *yopp;
+    const char **params;
+    unsigned i = 0;
+
+    params = xmlMalloc((yovp->yo_count * 2 + 1) * sizeof(*params));
+    if (params == NULL)
+	return NULL;
+
+    TAILQ_FOREACH(yopp, &yovp->yo_params, yop_link) {
+	params[i++] = yopp->yop_name;
+	params[i++] = yopp->yop_value;
+    }
+
+    params[i] = NULL;
+    return params;
+}
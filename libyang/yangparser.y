@@ -1964,12 +1964,11 @@ for_stmt :
 		     * }
 		     * This allows "." to remain unchanged.
 		     */
-		    static unsigned for_count;
 		    char buf[BUFSIZ];
 
 		    /* var $slax-dot-xxx = . */
-		    snprintf(buf, sizeof(buf), "%s%u",
-			     FOR_VARIABLE_PREFIX, ++for_count);
+		    yangStmtForVariable(slax_data, FOR_VARIABLE_PREFIX,
+					buf, sizeof(buf));
 		    slaxElementPush(slax_data, ELT_VARIABLE,
 				    ATT_NAME, buf + 1);
 		    slaxAttribAddLiteral(slax_data, ATT_SELECT, ".");
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2014, Juniper Networks, Inc.
+ * All rights reserved.
+ * See ../Copyright for the status of this software
+ */
+
+/*
+ * Include path handling.  We keep our own copy of the include
+ * directories (as well as handing them to libslax) so we can build a
+ * one-time index of the ".yang" files in each.  After that, finding
+ * a module is a hash lookup and a single fopen.  This matters when
+ * the include path is long and lives on NFS.  Modules the index
+ * doesn't know are still searched for, since libslax may know of
+ * places (or files) that the index doesn't, but a search that fails
+ * is remembered, so it's only made once.  (Imports with a revision
+ * look for "name@rev" before "name", so the miss is the common case.)
+ * The directories, the index and the misses belong to the session,
+ * and the misses are dropped with the index.
+ */
+
+#include <sys/queue.h>
+#include <sys/param.h>
+#include <dirent.h>
+#include <errno.h>
+
+#include <libxml/hash.h>
+
+#include "yanginternals.h"
+#include <libslax/slax.h>
+#include <libslax/slaxdata.h>
+#include <libyang/yang.h>
+#include <libyang/yangparser.h>
+#include <libyang/yangloader.h>
+#include <libyang/yangtrace.h>
+
+static const char yang_ext[] = ".yang";
+
+static void
+yangIncludeFreePath (void *payload, const xmlChar *name UNUSED)
+{
+    xmlFree(payload);
+}
+
+/*
+ * Drop the index, so the next lookup rebuilds it
+ */
+void
+yangIncludeIndexClean (void)
+{
+    yang_session_t *ysnp = yangSession();
+
+    if (ysnp->ysn_include_index) {
+	xmlHashFree(ysnp->ysn_include_index, yangIncludeFreePath);
+	ysnp->ysn_include_index = NULL;
+    }
+
+    if (ysnp->ysn_include_latest) {
+	xmlHashFree(ysnp->ysn_include_latest, yangIncludeFreePath);
+	ysnp->ysn_include_latest = NULL;
+    }
+
+    if (ysnp->ysn_include_misses) {
+	xmlHashFree(ysnp->ysn_include_misses, NULL);
+	ysnp->ysn_include_misses = NULL;
+    }
+}
+
+void
+yangIncludeAdd (const char *dir)
+{
+    slaxIncludeAdd(dir);
+    slaxDataListAddNul(&yangSession()->ysn_includes, dir);
+    yangIncludeIndexClean();
+}
+
+/*
+ * Add a colon-separated list of directories
+ */
+void
+yangIncludeAddPath (const char *path)
+{
+    const char *cp, *ep;
+
+    for (cp = path; cp && *cp; cp = ep) {
+	ep = strchr(cp, ':');
+	size_t len = ep ? (size_t) (ep - cp) : strlen(cp);
+	char dir[len + 1];
+
+	memcpy(dir, cp, len);
+	dir[len] = '\0';
+	if (len)
+	    yangIncludeAdd(dir);
+
+	if (ep)
+	    ep += 1;
+    }
+}
+
+/*
+ * Record one directory's ".yang" files.  Earlier directories win,
+ * matching the search order of slaxFindIncludeFile.  For each
+ * "name@revision.yang", we also remember the newest revision under
+ * the bare name, for imports that don't ask for a revision.
+ */
+static void
+yangIncludeIndexDir (yang_session_t *ysnp, const char *dir)
+{
+    DIR *dirp;
+    struct dirent *dp;
+    size_t dlen = strlen(dir);
+    const size_t elen = sizeof(yang_ext) - 1;
+    unsigned count = 0;
+
+    dirp = opendir(dir);
+    if (dirp == NULL)
+	return;
+
+    while ((dp = readdir(dirp)) != NULL) {
+	size_t len = strlen(dp->d_name);
+	if (len <= elen || !streq(dp->d_name + len - elen, yang_ext))
+	    continue;
+
+	char stem[len - elen + 1];
+	memcpy(stem, dp->d_name, len - elen);
+	stem[len - elen] = '\0';
+
+	if (xmlHashLookup(ysnp->ysn_include_index, (const xmlChar *) stem))
+	    continue;
+
+	char *path = xmlMalloc(dlen + len + 2);
+	if (path == NULL)
+	    break;
+
+	memcpy(path, dir, dlen);
+	path[dlen] = '/';
+	memcpy(path + dlen + 1, dp->d_name, len + 1);
+
+	if (xmlHashAddEntry(ysnp->ysn_include_index,
+			    (const xmlChar *) stem, path)) {
+	    xmlFree(path);
+	    continue;
+	}
+	count += 1;
+
+	char *at = strchr(stem, '@');
+	if (at == NULL)
+	    continue;
+
+	*at++ = '\0';
+	const char *old = xmlHashLookup(ysnp->ysn_include_latest,
+					(const xmlChar *) stem);
+	if (old && strcmp(at, old) <= 0)
+	    continue;
+
+	char *rev = (char *) xmlStrdup((const xmlChar *) at);
+	if (rev)
+	    xmlHashUpdateEntry(ysnp->ysn_include_latest,
+			       (const xmlChar *) stem, rev,
+			       yangIncludeFreePath);
+    }
+
+    closedir(dirp);
+
+    yangTrace(YTF_LOADER, "yang: indexed %u files in '%s'", count, dir);
+}
+
+/*
+ * Build the index of the current directory and each include directory.
+ * This is done once, before any lookups; after that the tables are
+ * read-only, so parallel loaders can share them without locking.
+ */
+void
+yangIncludeIndexBuild (void)
+{
+    yang_session_t *ysnp = yangSession();
+    slax_data_node_t *dnp;
+
+    if (ysnp->ysn_include_index)
+	return;
+
+    ysnp->ysn_include_index = xmlHashCreate(0);
+    ysnp->ysn_include_latest = xmlHashCreate(0);
+    if (ysnp->ysn_include_index == NULL
+	    || ysnp->ysn_include_latest == NULL) {
+	yangIncludeIndexClean();
+	return;
+    }
+
+    yangIncludeIndexDir(ysnp, ".");
+
+    SLAXDATALIST_FOREACH(dnp, &ysnp->ysn_includes) {
+	yangIncludeIndexDir(ysnp, dnp->dn_data);
+    }
+}
+
+/*
+ * Find a module's file the slow way, by searching the include path.
+ * Parallel loaders search at the same time, so the misses are kept
+ * under the session's lock; the search itself isn't.
+ */
+static FILE *
+yangIncludeSearch (const char *name, char *buf, int bufsiz)
+{
+    yang_session_t *ysnp = yangSession();
+    int len = strlen(name), missed;
+    char filename[len + sizeof(yang_ext)];
+    FILE *fp;
+
+#ifdef YANG_HAVE_THREADS
+    pthread_mutex_lock(&ysnp->ysn_include_mutex);
+#endif /* YANG_HAVE_THREADS */
+    missed = (ysnp->ysn_include_misses
+	      && xmlHashLookup(ysnp->ysn_include_misses,
+			       (const xmlChar *) name) != NULL);
+#ifdef YANG_HAVE_THREADS
+    pthread_mutex_unlock(&ysnp->ysn_include_mutex);
+#endif /* YANG_HAVE_THREADS */
+
+    if (missed) {
+	yangTrace(YTF_LOADER, "yang: module '%s' already missed", name);
+	return NULL;
+    }
+
+    memcpy(filename, name, len);
+    memcpy(filename + len, yang_ext, sizeof(yang_ext));
+
+    fp = slaxFindIncludeFile(filename, buf, bufsiz);
+    if (fp)
+	return fp;
+
+#ifdef YANG_HAVE_THREADS
+    pthread_mutex_lock(&ysnp->ysn_include_mutex);
+#endif /* YANG_HAVE_THREADS */
+    if (ysnp->ysn_include_misses == NULL)
+	ysnp->ysn_include_misses = xmlHashCreate(0);
+    if (ysnp->ysn_include_misses)
+	xmlHashAddEntry(ysnp->ysn_include_misses, (const xmlChar *) name,
+			ysnp);		/* Any non-NULL payload will do */
+#ifdef YANG_HAVE_THREADS
+    pthread_mutex_unlock(&ysnp->ysn_include_mutex);
+#endif /* YANG_HAVE_THREADS */
+
+    return NULL;
+}
+
+/*
+ * Find the file for a module (or "module@revision") by name, using
+ * the index.  A bare name that has no "name.yang" falls back to the
+ * newest "name@revision.yang".  Anything the index can't answer (a
+ * name with a directory in it, a name it doesn't know, or a file
+ * that's gone since it was built) goes to slaxFindIncludeFile, so
+ * the index only ever makes lookups faster.
+ */
+FILE *
+yangIncludeFind (const char *name, char *buf, int bufsiz)
+{
+    yang_session_t *ysnp = yangSession();
+    const char *path;
+    FILE *fp;
+
+    yangIncludeIndexBuild();
+
+    if (ysnp->ysn_include_index == NULL || strchr(name, '/'))
+	return yangIncludeSearch(name, buf, bufsiz);
+
+    path = xmlHashLookup(ysnp->ysn_include_index, (const xmlChar *) name);
+    if (path == NULL && strchr(name, '@') == NULL) {
+	const char *rev = xmlHashLookup(ysnp->ysn_include_latest,
+					(const xmlChar *) name);
+	if (rev) {
+	    int nlen = strlen(name), rlen = strlen(rev);
+	    char revname[nlen + rlen + 2];
+
+	    memcpy(revname, name, nlen);
+	    revname[nlen] = '@';
+	    memcpy(revname + nlen + 1, rev, rlen + 1);
+
+	    path = xmlHashLookup(ysnp->ysn_include_index,
+				 (const xmlChar *) revname);
+	}
+    }
+
+    if (path == NULL) {
+	yangTrace(YTF_LOADER, "yang: module '%s' not indexed", name);
+	return yangIncludeSearch(name, buf, bufsiz);
+    }
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+	return yangIncludeSearch(name, buf, bufsiz);
+
+    snprintf(buf, bufsiz, "%s", path);
+    return fp;
+}
+
+/*
+ * Release the include list and its index
+ */
+void
+yangIncludeClean (void)
+{
+    yang_session_t *ysnp = yangSession();
+
+    yangIncludeIndexClean();
+
+    slaxDataListClean(&ysnp->ysn_includes);
+    slaxDataListInit(&ysnp->ysn_includes);
+}
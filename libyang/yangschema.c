@@ -0,0 +1,535 @@
+/*
+ * Copyright (c) 2014, Juniper Networks, Inc.
+ * All rights reserved.
+ * See ../Copyright for the status of this software
+ */
+
+/*
+ * Schema path index (see yangschema.h).  The nodes are found with one
+ * walk of the evaluated document, then each node with children gets
+ * two hash tables: its schema children, as a schema-node-id names
+ * them, and its data children, which see through choice and case
+ * (which never appear in data paths).
+ *
+ * Only the module's own schema nodes are indexed.  Evaluation leaves
+ * "uses" statements in place (unless compiled with --expand-uses), so
+ * the walk expands them itself: the grouping's nodes are indexed as
+ * children of the "uses" parent, each instance getting its own
+ * numbers, with ysm_node pointing into the grouping.  A grouping is
+ * found in the nearest enclosing statement, up to the module, where
+ * included submodules' groupings have been merged.  Augments, both
+ * inside a "uses" and at the top of the module, add their nodes to
+ * their targets, after the rest.  Groupings and targets in imported
+ * modules aren't in the document, so they're skipped.
+ */
+
+#include <sys/queue.h>
+#include <errno.h>
+
+#include <libxml/hash.h>
+
+#include "yanginternals.h"
+#include <libslax/slax.h>
+#include <libslax/slaxdata.h>
+#include <libyang/yang.h>
+#include <libyang/yangparser.h>
+#include <libyang/yangloader.h>
+#include <libyang/yangstmt.h>
+#include <libyang/yangschema.h>
+
+/*
+ * Statements that are schema nodes, and whether they are data nodes
+ */
+static const struct {
+    const char *name;
+    int data;
+} yangSchemaKinds[] = {
+    { YS_ANYXML, TRUE },
+    { YS_CASE, FALSE },
+    { YS_CHOICE, FALSE },
+    { YS_CONTAINER, TRUE },
+    { YS_INPUT, TRUE },
+    { YS_LEAF, TRUE },
+    { YS_LEAF_LIST, TRUE },
+    { YS_LIST, TRUE },
+    { YS_NOTIFICATION, TRUE },
+    { YS_OUTPUT, TRUE },
+    { YS_RPC, TRUE },
+    { NULL, FALSE }
+};
+
+/*
+ * Return 1 for a data node, 0 for choice or case, or -1 if the node
+ * isn't a schema node at all
+ */
+static int
+yangSchemaKind (xmlNodePtr nodep)
+{
+    int i;
+
+    if (nodep->type != XML_ELEMENT_NODE)
+	return -1;
+
+    if (nodep->ns && !streq((const char *) nodep->ns->href, YIN_URI))
+	return -1;
+
+    for (i = 0; yangSchemaKinds[i].name; i++)
+	if (streq((const char *) nodep->name, yangSchemaKinds[i].name))
+	    return yangSchemaKinds[i].data;
+
+    return -1;
+}
+
+#define YANG_SCHEMA_MAX_USES 64	/* Deepest nesting of uses expansions */
+
+/*
+ * Is this node the given YANG statement?
+ */
+static int
+yangSchemaIsStmt (xmlNodePtr nodep, const char *name)
+{
+    if (nodep->type != XML_ELEMENT_NODE)
+	return FALSE;
+
+    if (nodep->ns && !streq((const char *) nodep->ns->href, YIN_URI))
+	return FALSE;
+
+    return streq((const char *) nodep->name, name);
+}
+
+/*
+ * Strip our own prefix (or module name) from a reference.  Returns
+ * NULL if the reference is to another module.
+ */
+static const char *
+yangSchemaLocalName (yang_schema_t *yscp, const char *ref)
+{
+    const char *cp = strchr(ref, ':');
+
+    if (cp == NULL)
+	return ref;
+
+    size_t len = cp - ref;
+    if ((yscp->ysc_prefix && strlen(yscp->ysc_prefix) == len
+	     && strncmp(ref, yscp->ysc_prefix, len) == 0)
+	    || (yscp->ysc_module && strlen(yscp->ysc_module) == len
+		&& strncmp(ref, yscp->ysc_module, len) == 0))
+	return cp + 1;
+
+    return NULL;
+}
+
+/*
+ * Find the grouping a "uses" names, in the nearest statement around
+ * it that defines one
+ */
+static xmlNodePtr
+yangSchemaGrouping (yang_schema_t *yscp, xmlNodePtr usesp)
+{
+    char *ref = slaxGetAttrib(usesp, YS_NAME);
+    const char *name = ref ? yangSchemaLocalName(yscp, ref) : NULL;
+    xmlNodePtr parent, nodep, found = NULL;
+
+    for (parent = usesp->parent; name && found == NULL && parent
+	     && parent->type == XML_ELEMENT_NODE; parent = parent->parent) {
+	for (nodep = parent->children; nodep; nodep = nodep->next) {
+	    if (!yangSchemaIsStmt(nodep, YS_GROUPING))
+		continue;
+
+	    char *gname = slaxGetAttrib(nodep, YS_NAME);
+	    int match = (gname && streq(gname, name));
+	    xmlFreeAndEasy(gname);
+	    if (match) {
+		found = nodep;
+		break;
+	    }
+	}
+    }
+
+    xmlFreeAndEasy(ref);
+    return found;
+}
+
+static int
+yangSchemaAdd (yang_schema_t *yscp, xmlNodePtr nodep, unsigned parent,
+	       unsigned *maxp, int data)
+{
+    yang_schema_node_t *ysmp;
+
+    if (yscp->ysc_count >= *maxp) {
+	unsigned max = *maxp ? *maxp * 2 : 256;
+
+	ysmp = xmlRealloc(yscp->ysc_nodes, max * sizeof(*ysmp));
+	if (ysmp == NULL)
+	    return -1;
+
+	yscp->ysc_nodes = ysmp;
+	*maxp = max;
+    }
+
+    ysmp = &yscp->ysc_nodes[yscp->ysc_count];
+    bzero(ysmp, sizeof(*ysmp));
+    ysmp->ysm_id = yscp->ysc_count++;
+    ysmp->ysm_parent = parent;
+    ysmp->ysm_node = nodep;
+    if (data)
+	ysmp->ysm_flags |= YSMF_DATA;
+
+    /* input and output have no argument; they go by their keyword */
+    ysmp->ysm_name = slaxGetAttrib(nodep, YS_NAME);
+    if (ysmp->ysm_name == NULL)
+	ysmp->ysm_name = (char *) xmlStrdup(nodep->name);
+
+    return (ysmp->ysm_name == NULL) ? -1 : 0;
+}
+
+/*
+ * Find a child of a node, by name, among those numbered so far (the
+ * tables aren't built yet).  Returns 0 (the root, which is no one's
+ * child) if there's none.
+ */
+static unsigned
+yangSchemaChild (yang_schema_t *yscp, unsigned parent, const char *name)
+{
+    unsigned i;
+
+    for (i = parent + 1; i < yscp->ysc_count; i++) {
+	yang_schema_node_t *ysmp = &yscp->ysc_nodes[i];
+
+	if (ysmp->ysm_parent == parent && streq(ysmp->ysm_name, name))
+	    return i;
+    }
+
+    return YANG_SCHEMA_ROOT;
+}
+
+/*
+ * Find an augment's target, a schema node id taken from "id" (the
+ * root for an absolute one).  Returns 0 if it isn't one of ours.
+ */
+static unsigned
+yangSchemaTarget (yang_schema_t *yscp, unsigned id, xmlNodePtr augp)
+{
+    char *path = slaxGetAttrib(augp, YS_TARGET_NODE);
+    char *step, *last;
+    const char *name;
+
+    if (path == NULL)
+	return YANG_SCHEMA_ROOT;
+
+    for (step = strtok_r(path, "/", &last); step;
+	 step = strtok_r(NULL, "/", &last)) {
+	name = yangSchemaLocalName(yscp, step);
+	id = name ? yangSchemaChild(yscp, id, name) : YANG_SCHEMA_ROOT;
+	if (id == YANG_SCHEMA_ROOT)
+	    break;
+    }
+
+    xmlFree(path);
+    return id;
+}
+
+static int
+yangSchemaWalk (yang_schema_t *yscp, xmlNodePtr parent, unsigned id,
+		unsigned *maxp, unsigned depth);
+
+/*
+ * Expand a "uses" under the node it appears in, then apply the
+ * augments it carries
+ */
+static int
+yangSchemaUses (yang_schema_t *yscp, xmlNodePtr usesp, unsigned id,
+		unsigned *maxp, unsigned depth)
+{
+    xmlNodePtr groupp, nodep;
+    unsigned first = yscp->ysc_count, target;
+
+    groupp = yangSchemaGrouping(yscp, usesp);
+    if (groupp == NULL || depth >= YANG_SCHEMA_MAX_USES)
+	return 0;
+
+    if (yangSchemaWalk(yscp, groupp, id, maxp, depth + 1) < 0)
+	return -1;
+
+    for (nodep = usesp->children; nodep; nodep = nodep->next) {
+	if (!yangSchemaIsStmt(nodep, YS_AUGMENT))
+	    continue;
+
+	/* The target is relative to the expansion, which starts at "id" */
+	target = yangSchemaTarget(yscp, id, nodep);
+	if (target >= first
+		&& yangSchemaWalk(yscp, nodep, target, maxp, depth + 1) < 0)
+	    return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Number the schema nodes under a parent, in document order
+ */
+static int
+yangSchemaWalk (yang_schema_t *yscp, xmlNodePtr parent, unsigned id,
+		unsigned *maxp, unsigned depth)
+{
+    xmlNodePtr nodep;
+    unsigned child;
+    int data;
+
+    for (nodep = parent->children; nodep; nodep = nodep->next) {
+	if (yangSchemaIsStmt(nodep, YS_USES)) {
+	    if (yangSchemaUses(yscp, nodep, id, maxp, depth) < 0)
+		return -1;
+	    continue;
+	}
+
+	data = yangSchemaKind(nodep);
+	if (data < 0)
+	    continue;
+
+	child = yscp->ysc_count;
+	if (yangSchemaAdd(yscp, nodep, id, maxp, data) < 0
+		|| yangSchemaWalk(yscp, nodep, child, maxp, depth) < 0)
+	    return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Apply the module's own top-level augments
+ */
+static int
+yangSchemaAugments (yang_schema_t *yscp, xmlNodePtr root, unsigned *maxp)
+{
+    xmlNodePtr nodep;
+    unsigned target;
+
+    for (nodep = root->children; nodep; nodep = nodep->next) {
+	if (!yangSchemaIsStmt(nodep, YS_AUGMENT))
+	    continue;
+
+	target = yangSchemaTarget(yscp, YANG_SCHEMA_ROOT, nodep);
+	if (target != YANG_SCHEMA_ROOT
+		&& yangSchemaWalk(yscp, nodep, target, maxp, 0) < 0)
+	    return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Add a schema child to a table, creating it on first use.  The
+ * first node with a given name wins.
+ */
+static int
+yangSchemaTableAdd (xmlHashTablePtr *tablep, yang_schema_node_t *ysmp)
+{
+    if (*tablep == NULL) {
+	*tablep = xmlHashCreate(0);
+	if (*tablep == NULL)
+	    return -1;
+    }
+
+    xmlHashAddEntry(*tablep, (const xmlChar *) ysmp->ysm_name, ysmp);
+    return 0;
+}
+
+/*
+ * Find the nearest ancestor that's a data node (or the root), which
+ * is whose data child a node is
+ */
+static yang_schema_node_t *
+yangSchemaDataParent (yang_schema_t *yscp, yang_schema_node_t *ysmp)
+{
+    do {
+	ysmp = &yscp->ysc_nodes[ysmp->ysm_parent];
+    } while (ysmp->ysm_id != YANG_SCHEMA_ROOT
+	     && !(ysmp->ysm_flags & YSMF_DATA));
+
+    return ysmp;
+}
+
+static char *
+yangSchemaSubArg (xmlNodePtr parent, const char *name, const char *name2,
+		  const char *attrib)
+{
+    xmlNodePtr nodep;
+
+    for (nodep = parent->children; nodep; nodep = nodep->next) {
+	if (nodep->type != XML_ELEMENT_NODE)
+	    continue;
+
+	if (streq((const char *) nodep->name, name)) {
+	    if (name2)
+		return yangSchemaSubArg(nodep, name2, NULL, attrib);
+	    return slaxGetAttrib(nodep, attrib);
+	}
+    }
+
+    return NULL;
+}
+
+yang_schema_t *
+yangSchemaBuild (xmlDocPtr docp)
+{
+    xmlNodePtr root = xmlDocGetRootElement(docp);
+    yang_schema_t *yscp;
+    yang_schema_node_t *ysmp, *parentp;
+    unsigned i, max = 0;
+
+    if (root == NULL)
+	return NULL;
+
+    yscp = xmlMalloc(sizeof(*yscp));
+    if (yscp == NULL)
+	return NULL;
+
+    bzero(yscp, sizeof(*yscp));
+    yscp->ysc_doc = docp;
+    yscp->ysc_module = slaxGetAttrib(root, YS_NAME);
+    yscp->ysc_prefix = yangSchemaSubArg(root, YS_PREFIX, NULL, YS_VALUE);
+    if (yscp->ysc_prefix == NULL)	/* A submodule */
+	yscp->ysc_prefix = yangSchemaSubArg(root, YS_BELONGS_TO, YS_PREFIX,
+					    YS_VALUE);
+
+    if (yangSchemaAdd(yscp, root, YANG_SCHEMA_ROOT, &max, TRUE) < 0
+	    || yangSchemaWalk(yscp, root, YANG_SCHEMA_ROOT, &max, 0) < 0
+	    || yangSchemaAugments(yscp, root, &max) < 0)
+	goto fail;
+
+    /* Now that the array won't move, the tables can point into it */
+    for (i = 1; i < yscp->ysc_count; i++) {
+	ysmp = &yscp->ysc_nodes[i];
+	parentp = &yscp->ysc_nodes[ysmp->ysm_parent];
+
+	if (yangSchemaTableAdd(&parentp->ysm_children, ysmp) < 0)
+	    goto fail;
+
+	if (!(ysmp->ysm_flags & YSMF_DATA))
+	    continue;
+
+	parentp = yangSchemaDataParent(yscp, ysmp);
+	if (yangSchemaTableAdd(&parentp->ysm_data, ysmp) < 0)
+	    goto fail;
+    }
+
+    return yscp;
+
+ fail:
+    yangSchemaFree(yscp);
+    return NULL;
+}
+
+void
+yangSchemaFree (yang_schema_t *yscp)
+{
+    yang_schema_node_t *ysmp;
+    unsigned i;
+
+    if (yscp == NULL)
+	return;
+
+    for (i = 0; i < yscp->ysc_count; i++) {
+	ysmp = &yscp->ysc_nodes[i];
+	xmlFreeAndEasy(ysmp->ysm_name);
+	if (ysmp->ysm_children)
+	    xmlHashFree(ysmp->ysm_children, NULL);
+	if (ysmp->ysm_data)
+	    xmlHashFree(ysmp->ysm_data, NULL);
+    }
+
+    xmlFreeAndEasy(yscp->ysc_nodes);
+    xmlFreeAndEasy(yscp->ysc_module);
+    xmlFreeAndEasy(yscp->ysc_prefix);
+    xmlFree(yscp);
+}
+
+/*
+ * Walk a path, one step at a time.  Each step is "name" or
+ * "prefix:name", and may carry predicates ("[name='eth0']"), which
+ * are skipped.  The prefix must be the module's prefix or its name.
+ * The path is relative to the module whether or not it starts with
+ * a slash.
+ */
+static yang_schema_node_t *
+yangSchemaFind (yang_schema_t *yscp, const char *path, int data)
+{
+    yang_schema_node_t *ysmp = &yscp->ysc_nodes[YANG_SCHEMA_ROOT];
+    size_t len = strlen(path);
+    char *buf = alloca(len + 1);
+    const char *cp = path;
+    char *name, *bp, *colon;
+    char quote;
+
+    while (*cp) {
+	if (*cp == '/') {
+	    cp += 1;
+	    continue;
+	}
+
+	/* Copy out the step's name, skipping any predicates */
+	bp = buf;
+	colon = NULL;
+	for ( ; *cp && *cp != '/'; cp++) {
+	    if (*cp == '[') {
+		for (quote = 0; *cp; cp++) {
+		    if (quote) {
+			if (*cp == quote)
+			    quote = 0;
+		    } else if (*cp == '\'' || *cp == '"') {
+			quote = *cp;
+		    } else if (*cp == ']') {
+			break;
+		    }
+		}
+		if (*cp == '\0')
+		    return NULL;	/* Unterminated predicate */
+		continue;
+	    }
+
+	    if (*cp == ':' && colon == NULL)
+		colon = bp;
+	    *bp++ = *cp;
+	}
+	*bp = '\0';
+
+	name = buf;
+	if (colon) {
+	    *colon = '\0';
+	    if (!(yscp->ysc_prefix && streq(buf, yscp->ysc_prefix))
+		    && !(yscp->ysc_module && streq(buf, yscp->ysc_module)))
+		return NULL;
+	    name = colon + 1;
+	}
+
+	xmlHashTablePtr table = data ? ysmp->ysm_data : ysmp->ysm_children;
+	if (table == NULL)
+	    return NULL;
+
+	ysmp = xmlHashLookup(table, (const xmlChar *) name);
+	if (ysmp == NULL)
+	    return NULL;
+    }
+
+    return ysmp;
+}
+
+/*
+ * Find a node by data path, where choice and case don't appear
+ */
+yang_schema_node_t *
+yangSchemaFindPath (yang_schema_t *yscp, const char *path)
+{
+    return yangSchemaFind(yscp, path, TRUE);
+}
+
+/*
+ * Find a node by schema-node-id, which names every schema node on
+ * the way, including choice and case
+ */
+yang_schema_node_t *
+yangSchemaFindNodeId (yang_schema_t *yscp, const char *nodeid)
+{
+    return yangSchemaFind(yscp, nodeid, FALSE);
+}
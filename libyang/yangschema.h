@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2014, Juniper Networks, Inc.
+ * All rights reserved.
+ * See ../Copyright for the status of this software
+ */
+
+/*
+ * Schema path index.  Built once from an evaluated module, the index
+ * resolves a data path ("/system/syslog/file/contents") or a
+ * schema-node-id ("/sys:system/sys:syslog") to a schema node, one
+ * hash lookup per step.  Each schema node gets a dense number, in
+ * document order (with groupings expanded where they're used, and
+ * augmented nodes last), so callers can keep their own per-node data
+ * in arrays indexed by ysm_id.
+ */
+
+#ifndef LIBYANG_YANGSCHEMA_H
+#define LIBYANG_YANGSCHEMA_H
+
+#include <libxml/tree.h>
+#include <libxml/hash.h>
+
+#define YANG_SCHEMA_ROOT	0 /* ysm_id of the module itself */
+
+typedef struct yang_schema_node_s {
+    unsigned ysm_id;		/* Dense node number */
+    unsigned ysm_parent;	/* Parent's ysm_id (the root is its own) */
+    xmlNodePtr ysm_node;	/* Statement in the evaluated document */
+    char *ysm_name;		/* Node name (keyword for input/output) */
+    unsigned ysm_flags;		/* Flags (YSMF_*) */
+    xmlHashTablePtr ysm_children; /* Name -> schema child */
+    xmlHashTablePtr ysm_data;	/* Name -> data child (through choices) */
+} yang_schema_node_t;
+
+/* Flags for ysm_flags */
+#define YSMF_DATA	(1<<0)	/* Data node (not choice or case) */
+
+typedef struct yang_schema_s {
+    xmlDocPtr ysc_doc;		/* Evaluated document (not ours) */
+    char *ysc_module;		/* Module name */
+    char *ysc_prefix;		/* Module prefix */
+    yang_schema_node_t *ysc_nodes; /* Nodes, by ysm_id */
+    unsigned ysc_count;		/* Number of nodes */
+} yang_schema_t;
+
+yang_schema_t *
+yangSchemaBuild (xmlDocPtr docp);
+
+void
+yangSchemaFree (yang_schema_t *yscp);
+
+yang_schema_node_t *
+yangSchemaFindPath (yang_schema_t *yscp, const char *path);
+
+yang_schema_node_t *
+yangSchemaFindNodeId (yang_schema_t *yscp, const char *nodeid);
+
+static inline yang_schema_node_t *
+yangSchemaNode (yang_schema_t *yscp, unsigned id)
+{
+    return (id < yscp->ysc_count) ? &yscp->ysc_nodes[id] : NULL;
+}
+
+#endif /* LIBYANG_YANGSCHEMA_H */
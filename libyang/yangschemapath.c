@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2014, Juniper Networks, Inc.
+ * All rights reserved.
+ * See ../Copyright for the status of this software
+ */
+
+/*
+ * Driver for the schema path index.  Builds the index from an
+ * evaluated module (the YIN "yangc -e" writes), then resolves each
+ * argument as a data path and as a schema-node-id, printing the node
+ * each one finds as its full schema-node-id.  With no paths, it lists
+ * every node.  Build it with "make schema-path" in libyang; it isn't
+ * installed.  ../test/schema/run.sh uses it.
+ *
+ *     yangschemapath file.yin [path ...]
+ */
+
+#include <sys/queue.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libxml/hash.h>
+#include <libxml/parser.h>
+
+#include "yanginternals.h"
+#include <libslax/slax.h>
+#include <libslax/slaxdata.h>
+#include <libyang/yang.h>
+#include <libyang/yangparser.h>
+#include <libyang/yangloader.h>
+#include <libyang/yangstmt.h>
+#include <libyang/yangschema.h>
+
+/*
+ * Print a node as the schema-node-id from the root down to it
+ */
+static void
+schema_print (yang_schema_t *yscp, yang_schema_node_t *ysmp)
+{
+    yang_schema_node_t *parentp;
+
+    if (ysmp->ysm_id == YANG_SCHEMA_ROOT)
+	return;
+
+    parentp = yangSchemaNode(yscp, ysmp->ysm_parent);
+    schema_print(yscp, parentp);
+    printf("/%s", ysmp->ysm_name);
+}
+
+/*
+ * Report what a path found, or (with no kind) just list the node
+ */
+static void
+schema_report (yang_schema_t *yscp, const char *kind, const char *path,
+	       yang_schema_node_t *ysmp)
+{
+    if (kind)
+	printf("%-7s %s: ", kind, path);
+    if (ysmp == NULL) {
+	printf("not found\n");
+	return;
+    }
+
+    printf("%u ", ysmp->ysm_id);
+    schema_print(yscp, ysmp);
+    printf("%s\n", (ysmp->ysm_flags & YSMF_DATA) ? "" : " (not data)");
+}
+
+int
+main (int argc, char **argv)
+{
+    yang_schema_t *yscp;
+    xmlDocPtr docp;
+    unsigned i;
+    int argi;
+
+    if (argc < 2) {
+	fprintf(stderr, "usage: yangschemapath file.yin [path ...]\n");
+	return 1;
+    }
+
+    docp = xmlReadFile(argv[1], NULL, XML_PARSE_NOBLANKS);
+    if (docp == NULL) {
+	fprintf(stderr, "yangschemapath: cannot parse '%s'\n", argv[1]);
+	return 1;
+    }
+
+    yscp = yangSchemaBuild(docp);
+    if (yscp == NULL) {
+	fprintf(stderr, "yangschemapath: cannot index '%s'\n", argv[1]);
+	return 1;
+    }
+
+    if (argc == 2) {
+	for (i = 1; i < yscp->ysc_count; i++)
+	    schema_report(yscp, NULL, NULL, yangSchemaNode(yscp, i));
+    }
+
+    for (argi = 2; argi < argc; argi++) {
+	schema_report(yscp, "path", argv[argi],
+		      yangSchemaFindPath(yscp, argv[argi]));
+	schema_report(yscp, "node-id", argv[argi],
+		      yangSchemaFindNodeId(yscp, argv[argi]));
+    }
+
+    yangSchemaFree(yscp);
+    xmlFreeDoc(docp);
+
+    return 0;
+}
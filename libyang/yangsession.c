@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2014, Juniper Networks, Inc.
+ * All rights reserved.
+ * See ../Copyright for the status of this software
+ */
+
+/*
+ * Sessions.  Each thread has a current session, which is where the
+ * loader, the statement registry and the rest find their state.
+ * Until a thread sets one, it uses the process-wide default session,
+ * so single-threaded callers never need to know sessions exist.
+ */
+
+#include <sys/queue.h>
+
+#include <libxml/hash.h>
+
+#include "yanginternals.h"
+#include <libslax/slax.h>
+#include <libslax/slaxdata.h>
+#include <libyang/yang.h>
+#include <libyang/yangparser.h>
+#include <libyang/yangloader.h>
+#include <libyang/yangstmt.h>
+#include <libyang/yangtrace.h>
+
+static yang_session_t yangSessionDefault;
+
+#ifdef YANG_HAVE_THREADS
+static pthread_key_t yangSessionKey;
+static pthread_once_t yangSessionOnce = PTHREAD_ONCE_INIT;
+#else /* YANG_HAVE_THREADS */
+static yang_session_t *yangSessionCurrent;
+#endif /* YANG_HAVE_THREADS */
+
+static void
+yangSessionInit (yang_session_t *ysnp)
+{
+    bzero(ysnp, sizeof(*ysnp));
+
+    TAILQ_INIT(&ysnp->ysn_stmts);
+    TAILQ_INIT(&ysnp->ysn_modules);
+    slaxDataListInit(&ysnp->ysn_features);
+    slaxDataListInit(&ysnp->ysn_includes);
+    slaxDataListInit(&ysnp->ysn_depends);
+    yangParserInit(&ysnp->ysn_parser);
+#ifdef YANG_HAVE_THREADS
+    pthread_mutex_init(&ysnp->ysn_include_mutex, NULL);
+#endif /* YANG_HAVE_THREADS */
+
+    ysnp->ysn_jobs = 1;
+    ysnp->ysn_flags |= YSNF_INITTED;
+}
+
+#ifdef YANG_HAVE_THREADS
+static void
+yangSessionOnceInit (void)
+{
+    pthread_key_create(&yangSessionKey, NULL);
+    yangSessionInit(&yangSessionDefault);
+}
+#endif /* YANG_HAVE_THREADS */
+
+/*
+ * Return the calling thread's current session
+ */
+yang_session_t *
+yangSession (void)
+{
+    yang_session_t *ysnp;
+
+#ifdef YANG_HAVE_THREADS
+    pthread_once(&yangSessionOnce, yangSessionOnceInit);
+    ysnp = pthread_getspecific(yangSessionKey);
+#else /* YANG_HAVE_THREADS */
+    if (!(yangSessionDefault.ysn_flags & YSNF_INITTED))
+	yangSessionInit(&yangSessionDefault);
+    ysnp = yangSessionCurrent;
+#endif /* YANG_HAVE_THREADS */
+
+    return ysnp ?: &yangSessionDefault;
+}
+
+/*
+ * Make a session current for the calling thread, returning the one
+ * it replaces so the caller can put it back.  NULL means the default.
+ */
+yang_session_t *
+yangSessionSet (yang_session_t *ysnp)
+{
+    yang_session_t *old = yangSession();
+
+    if (ysnp == &yangSessionDefault)
+	ysnp = NULL;
+
+#ifdef YANG_HAVE_THREADS
+    pthread_setspecific(yangSessionKey, ysnp);
+#else /* YANG_HAVE_THREADS */
+    yangSessionCurrent = ysnp;
+#endif /* YANG_HAVE_THREADS */
+
+    return old;
+}
+
+/*
+ * Make a caller's session current for the length of a library call.
+ * NULL means "the current session", and leaves the thread's setting
+ * alone: it returns NULL, which yangSessionLeave ignores.
+ */
+yang_session_t *
+yangSessionEnter (yang_session_t *ysnp)
+{
+    return ysnp ? yangSessionSet(ysnp) : NULL;
+}
+
+/*
+ * Undo yangSessionEnter
+ */
+void
+yangSessionLeave (yang_session_t *old)
+{
+    if (old)
+	yangSessionSet(old);
+}
+
+/*
+ * Create a session, with the builtin statements registered
+ */
+yang_session_t *
+yangSessionCreate (void)
+{
+    yang_session_t *ysnp, *old;
+
+    ysnp = xmlMalloc(sizeof(*ysnp));
+    if (ysnp == NULL)
+	return NULL;
+
+    yangSessionInit(ysnp);
+
+    old = yangSessionSet(ysnp);
+    yangStmtInit();
+    yangSessionSet(old);
+
+    return ysnp;
+}
+
+/*
+ * Release everything the current session holds
+ */
+void
+yangSessionClean (void)
+{
+    yang_session_t *ysnp = yangSession();
+
+    yangModuleCacheClean();
+    yangDependClean();
+    yangIncludeClean();
+    yangStmtClean();
+    yangDictClean();
+    yangFeaturesClean();
+    yangParamsClean();
+
+    xmlFreeAndEasy(ysnp->ysn_cache_dir);
+    ysnp->ysn_cache_dir = NULL;
+}
+
+void
+yangSessionFree (yang_session_t *ysnp)
+{
+    yang_session_t *old;
+
+    if (ysnp == NULL || ysnp == &yangSessionDefault)
+	return;
+
+    old = yangSessionSet(ysnp);
+    yangSessionClean();
+    yangSessionSet(old == ysnp ? NULL : old);
+
+#ifdef YANG_HAVE_THREADS
+    pthread_mutex_destroy(&ysnp->ysn_include_mutex);
+#endif /* YANG_HAVE_THREADS */
+    xmlFree(ysnp);
+}
@@ -9,6 +9,7 @@
 #include <errno.h>
 #include <sys/param.h>
 
+#include <libxml/hash.h>
 #include <libxslt/extensions.h>
 #include <libxslt/documents.h>
 #include <libexslt/exslt.h>
@@ -21,16 +22,169 @@
 #include <libyang/yangparser.h>
 #include <libyang/yangloader.h>
 #include <libyang/yangstmt.h>
+#include <libyang/yangtrace.h>
 
-static yang_stmt_list_t yangStmtList;
+/*
+ * The statement registry belongs to the session.  It's indexed by a
+ * pair of hash tables, so that yangStmtFind doesn't need to walk
+ * ysn_stmts.  ysn_stmt_table is keyed by (name, namespace), with
+ * builtin statements using a NULL namespace.  ysn_stmt_names is keyed
+ * by name alone and holds the first statement registered under that
+ * name, which is what a lookup with a NULL namespace wants.  Both
+ * share ysn_stmt_dict, so keys are interned and compare by pointer.
+ *
+ * Each session registers its own copy of a statement, since the
+ * registry fills in ys_id, the child maps and the list linkage.
+ */
+static void
+yangStmtIndex (yang_stmt_t *ysp)
+{
+    yang_session_t *ysnp = yangSession();
+
+    if (ysnp->ysn_stmt_table == NULL) {
+	ysnp->ysn_stmt_dict = xmlDictCreate();
+	ysnp->ysn_stmt_table = xmlHashCreateDict(0, ysnp->ysn_stmt_dict);
+	ysnp->ysn_stmt_names = xmlHashCreateDict(0, ysnp->ysn_stmt_dict);
+	if (ysnp->ysn_stmt_table == NULL || ysnp->ysn_stmt_names == NULL) {
+	    slaxLog("out of memory for statement table");
+	    return;
+	}
+    }
+
+    /* xmlHashAddEntry fails on duplicates, so the first one wins */
+    xmlHashAddEntry2(ysnp->ysn_stmt_table, (const xmlChar *) ysp->ys_name,
+		     (const xmlChar *) ysp->ys_namespace, ysp);
+    xmlHashAddEntry(ysnp->ysn_stmt_names, (const xmlChar *) ysp->ys_name,
+		    ysp);
+}
+
+
+#define YANG_CHILDREN_CHUNK 16 /* Growth increment for ys_children */
+
+/*
+ * Append a child to the parent's ys_children array.  The first time
+ * through, the static array is copied into an allocated one with
+ * some room to spare; after that we grow it by doubling, so adding
+ * a large set of extensions doesn't cost a realloc per statement.
+ */
+static void
+yangStmtAddChild (yang_stmt_t *parent, yang_stmt_t *ysp, unsigned flags)
+{
+    yang_relative_t *tmp, *newp;
+    unsigned max;
+
+    if (parent->ys_children_max == 0) {
+	unsigned count = 0;
+
+	for (tmp = parent->ys_children; tmp && tmp->yr_name; tmp++)
+	    count += 1;
+
+	max = count + YANG_CHILDREN_CHUNK;
+	newp = xmlMalloc((max + 1) * sizeof(*newp));
+	if (newp == NULL) {
+	    slaxLog("out of memory for '%s'", ysp->ys_name);
+	    return;
+	}
+
+	if (count)
+	    memcpy(newp, parent->ys_children, count * sizeof(*newp));
+
+	parent->ys_children = newp;
+	parent->ys_nchildren = count;
+	parent->ys_children_max = max;
+	parent->ys_flags |= YSF_CHILDREN_ALLOCED;
+
+    } else if (parent->ys_nchildren >= parent->ys_children_max) {
+	max = parent->ys_children_max * 2;
+	newp = xmlRealloc(parent->ys_children, (max + 1) * sizeof(*newp));
+	if (newp == NULL) {
+	    slaxLog("out of memory for '%s'", ysp->ys_name);
+	    return;
+	}
+
+	parent->ys_children = newp;
+	parent->ys_children_max = max;
+    }
 
+    tmp = parent->ys_children + parent->ys_nchildren++;
+    tmp->yr_name = ysp->ys_name;
+    tmp->yr_namespace = ysp->ys_namespace;
+    tmp->yr_flags = flags;
+    bzero(tmp + 1, sizeof(*tmp));
+}
+
+/*
+ * Record a child in the statement's child map, growing the map to
+ * cover the child's ys_id.  The map is sized by the statement's own
+ * children, not the whole registry, so adding statements elsewhere
+ * never touches it.  The mandatory mask is laid out like a seen map,
+ * so the close-time check is a word-wise compare; it always covers
+ * the child map.
+ */
+static void
+yangStmtSetChild (yang_stmt_t *ysp, yang_stmt_t *childp, unsigned flags)
+{
+    unsigned size = ysp->ys_child_map_size;
+    unsigned words = YANG_SEEN_WORDS(size);
+    yang_seen_elt_t *mask;
+    unsigned char *map;
+
+    if (childp->ys_id >= size) {
+	size = size ? size * 2 : YANG_SEEN_BITS;
+	while (size <= childp->ys_id)
+	    size *= 2;
+
+	map = xmlRealloc(ysp->ys_child_map, size);
+	if (map == NULL) {
+	    slaxLog("out of memory for '%s'", ysp->ys_name);
+	    return;
+	}
+
+	bzero(map + ysp->ys_child_map_size, size - ysp->ys_child_map_size);
+	ysp->ys_child_map = map;
+	ysp->ys_child_map_size = size;
+    }
+
+    if (ysp->ys_mandatory && YANG_SEEN_WORDS(size) != words) {
+	mask = xmlRealloc(ysp->ys_mandatory,
+			  YANG_SEEN_WORDS(size) * sizeof(*mask));
+	if (mask == NULL) {
+	    slaxLog("out of memory for '%s'", ysp->ys_name);
+	    return;
+	}
+
+	bzero(mask + words, (YANG_SEEN_WORDS(size) - words) * sizeof(*mask));
+	ysp->ys_mandatory = mask;
+    }
+
+    ysp->ys_child_map[childp->ys_id] = flags | YRF_PERMITTED;
+
+    if (!(flags & YRF_MANDATORY))
+	return;
+
+    if (ysp->ys_mandatory == NULL) {
+	words = YANG_SEEN_WORDS(size);
+	ysp->ys_mandatory = xmlMalloc(words * sizeof(yang_seen_elt_t));
+	if (ysp->ys_mandatory == NULL) {
+	    slaxLog("out of memory for '%s'", ysp->ys_name);
+	    return;
+	}
+
+	bzero(ysp->ys_mandatory, words * sizeof(yang_seen_elt_t));
+    }
+
+    ysp->ys_mandatory[childp->ys_id / YANG_SEEN_BITS]
+	|= 1UL << (childp->ys_id % YANG_SEEN_BITS);
+}
 
+/*
+ * Add a new statement to a parent it names in its ys_parents.  The
+ * parent's child map gets the one new entry, rather than a rebuild.
+ */
 static void
 yangStmtRebuildParents (yang_stmt_t *ysp, yang_relative_t *yrp)
 {
     yang_stmt_t *parent = yangStmtFind(yrp->yr_namespace, yrp->yr_name);
-    yang_relative_t *tmp;
-    int count = 0;
 
     if (parent == NULL) {
 	slaxLog("could not add statement: not found '%s:%s'",
@@ -38,26 +192,83 @@ yangStmtRebuildParents (yang_stmt_t *ysp, yang_relative_t *yrp)
 	return;
     }
 
-    for (tmp = parent->ys_children; tmp && tmp->yr_name; tmp++)
-	count += 1;
+    yangStmtAddChild(parent, ysp, yrp->yr_flags);
+    yangStmtSetChild(parent, ysp, yrp->yr_flags);
+}
+
+/*
+ * Build the dense child map for a statement, turning its ys_children
+ * list into a table of YRF_* flags indexed by the child's ys_id.  This
+ * makes the parent/child check in yangCheckChildren a single load.
+ * Children that aren't registered yet mark the statement, so a later
+ * yangStmtAdd can build it again.
+ */
+static void
+yangStmtBuildChildMap (yang_stmt_t *ysp)
+{
+    yang_session_t *ysnp = yangSession();
+    yang_relative_t *yrp;
+    yang_stmt_t *childp;
 
-    yang_relative_t *newp = xmlMalloc((count + 2) * sizeof(*newp));
-    if (newp == NULL) {
-	slaxLog("out of memory for '%s'", ysp->ys_name);
+    if (ysp->ys_children == NULL)
 	return;
+
+    if (ysp->ys_child_map)
+	bzero(ysp->ys_child_map, ysp->ys_child_map_size);
+    if (ysp->ys_mandatory)
+	bzero(ysp->ys_mandatory, YANG_SEEN_WORDS(ysp->ys_child_map_size)
+	      * sizeof(yang_seen_elt_t));
+
+    if (ysp->ys_flags & YSF_CHILD_UNKNOWN) {
+	ysp->ys_flags &= ~YSF_CHILD_UNKNOWN;
+	ysnp->ysn_stmt_unknown -= 1;
     }
 
-    memcpy(newp, parent->ys_children, count * sizeof(*newp));
-    tmp = newp + count;
-    tmp->yr_name = ysp->ys_name;
-    tmp->yr_namespace = ysp->ys_namespace;
-    tmp->yr_flags = yrp->yr_flags;
-    bzero(tmp + 1, sizeof(*newp));
+    for (yrp = ysp->ys_children; yrp->yr_name; yrp++) {
+	childp = yangStmtFind(yrp->yr_namespace, yrp->yr_name);
+	if (childp == NULL) {
+	    yangTrace(YTF_STMT, "unknown child '%s' for '%s'",
+		      yrp->yr_name, ysp->ys_name);
+	    if (!(ysp->ys_flags & YSF_CHILD_UNKNOWN)) {
+		ysp->ys_flags |= YSF_CHILD_UNKNOWN;
+		ysnp->ysn_stmt_unknown += 1;
+	    }
+	    continue;
+	}
 
-    if (parent->ys_flags & YSF_CHILDREN_ALLOCED)
-	xmlFreeAndEasy(parent->ys_children);
-    parent->ys_children = newp;
-    parent->ys_flags |= YSF_CHILDREN_ALLOCED;
+	yangStmtSetChild(ysp, childp, yrp->yr_flags);
+    }
+}
+
+/*
+ * Record a statement in the table indexed by ys_id, which is how a
+ * node marked by yangStmtMark finds its statement again
+ */
+static void
+yangStmtIndexId (yang_stmt_t *ysp)
+{
+    yang_session_t *ysnp = yangSession();
+
+    if (ysp->ys_id >= ysnp->ysn_stmt_ids_size) {
+	unsigned size = ysnp->ysn_stmt_ids_size ?: 64;
+	yang_stmt_t **newp;
+
+	while (size <= ysp->ys_id)
+	    size *= 2;
+
+	newp = xmlRealloc(ysnp->ysn_stmt_ids, size * sizeof(*newp));
+	if (newp == NULL) {
+	    slaxLog("out of memory for statement ids");
+	    return;
+	}
+
+	bzero(newp + ysnp->ysn_stmt_ids_size,
+	      (size - ysnp->ysn_stmt_ids_size) * sizeof(*newp));
+	ysnp->ysn_stmt_ids = newp;
+	ysnp->ysn_stmt_ids_size = size;
+    }
+
+    ysnp->ysn_stmt_ids[ysp->ys_id] = ysp;
 }
 
 /**
@@ -66,47 +277,152 @@ yangStmtRebuildParents (yang_stmt_t *ysp, yang_relative_t *yrp)
 void
 yangStmtAdd (yang_stmt_t *ysp, const char *namespace, int count)
 {
-    static unsigned ys_id;
+    yang_session_t *ysnp = yangSession();
+    yang_stmt_t *xp, *first = NULL;
+    unsigned unknown;
 
     if (count <= 0)
 	count = INT_MAX;
 
+    /* Statements still missing children from an earlier call */
+    unknown = ysnp->ysn_stmt_unknown;
+
     for ( ; count > 0 && ysp->ys_name; count--, ysp++) {
-	ysp->ys_id = ys_id++;
-	ysp->ys_namespace = namespace;
+	xp = xmlMalloc(sizeof(*xp));
+	if (xp == NULL) {
+	    slaxLog("out of memory for '%s'", ysp->ys_name);
+	    break;
+	}
 
-	if (ysp->ys_parents) {
+	memcpy(xp, ysp, sizeof(*xp));
+	xp->ys_id = ysnp->ysn_stmt_count++;
+	xp->ys_namespace = namespace;
+	xp->ys_child_map = NULL;
+	xp->ys_child_map_size = 0;
+	xp->ys_mandatory = NULL;
+	xp->ys_flags &= ~YSF_CHILD_UNKNOWN;
+	yangStmtIndex(xp);
+	yangStmtIndexId(xp);
+
+	if (xp->ys_parents) {
 	    yang_relative_t *yrp;
 
-	    for (yrp = ysp->ys_parents; yrp && yrp->yr_name; yrp++) {
-		yangStmtRebuildParents(ysp, yrp);
+	    for (yrp = xp->ys_parents; yrp && yrp->yr_name; yrp++) {
+		yangStmtRebuildParents(xp, yrp);
 	    }
 	}
 
-	TAILQ_INSERT_TAIL(&yangStmtList, ysp, ys_link);
+	TAILQ_INSERT_TAIL(&ysnp->ysn_stmts, xp, ys_link);
+	if (first == NULL)
+	    first = xp;
+    }
+
+    /*
+     * Children can refer to statements registered after their parent,
+     * so the new statements' maps are built once they're all in.  Older
+     * statements only need building again if they were waiting on a
+     * child; those that gained a child through ys_parents have already
+     * had it set.
+     */
+    if (unknown) {
+	TAILQ_FOREACH(xp, &ysnp->ysn_stmts, ys_link) {
+	    if (xp == first)
+		break;
+	    if (xp->ys_flags & YSF_CHILD_UNKNOWN)
+		yangStmtBuildChildMap(xp);
+	}
     }
+
+    for (xp = first; xp; xp = TAILQ_NEXT(xp, ys_link))
+	yangStmtBuildChildMap(xp);
 }
 
+/**
+ * Find a statement by namespace and name.  A NULL namespace matches
+ * any statement with that name; the YIN namespace matches builtin
+ * statements (which have a NULL ys_namespace) as well as any
+ * registered explicitly under YIN_URI.
+ */
 yang_stmt_t *
 yangStmtFind (const char *namespace, const char *name)
 {
+    yang_session_t *ysnp = yangSession();
     yang_stmt_t *ysp;
-    int is_yin = namespace ? streq(namespace, YIN_URI) : FALSE;
 
-    TAILQ_FOREACH(ysp, &yangStmtList, ys_link) {
-	if (namespace) {
-	    if (ysp->ys_namespace) {
-		if (!streq(namespace, ysp->ys_namespace))
-		    continue;
-	    } else if (!is_yin)
-		continue;
-	}
+    if (ysnp->ysn_stmt_table == NULL || name == NULL)
+	return NULL;
 
-	if (streq(ysp->ys_name, name))
+    if (namespace == NULL)
+	return xmlHashLookup(ysnp->ysn_stmt_names, (const xmlChar *) name);
+
+    if (streq(namespace, YIN_URI)) {
+	ysp = xmlHashLookup2(ysnp->ysn_stmt_table,
+			     (const xmlChar *) name, NULL);
+	if (ysp)
 	    return ysp;
     }
 
-    return NULL;
+    return xmlHashLookup2(ysnp->ysn_stmt_table, (const xmlChar *) name,
+			  (const xmlChar *) namespace);
+}
+
+/*
+ * Remember a node's statement, so the writers don't need to look it
+ * up again.  The node's _private holds ys_id + 1 (zero meaning
+ * unmarked).  Copies of the node (as in the result of a stylesheet)
+ * lose the mark and fall back to yangStmtFindNode's cache.
+ */
+void
+yangStmtMark (xmlNodePtr nodep, yang_stmt_t *ysp)
+{
+    nodep->_private = (void *) (uintptr_t) (ysp->ys_id + 1);
+}
+
+void
+yangStmtCacheInit (yang_stmt_cache_t *yscp)
+{
+    bzero(yscp, sizeof(*yscp));
+}
+
+/*
+ * Find the statement for a node: from its mark, if it has one, then
+ * from the cache (if given), then the hash tables.  The mark is only
+ * trusted if it names a registered statement with the node's name,
+ * since _private may belong to someone else.
+ */
+yang_stmt_t *
+yangStmtFindNode (yang_stmt_cache_t *yscp, xmlNodePtr nodep)
+{
+    yang_session_t *ysnp = yangSession();
+    uintptr_t id = (uintptr_t) nodep->_private;
+    const xmlChar *namespace = nodep->ns ? nodep->ns->href : NULL;
+    yang_stmt_cache_entry_t *ycep;
+    yang_stmt_t *ysp;
+
+    if (id && id <= ysnp->ysn_stmt_ids_size) {
+	ysp = ysnp->ysn_stmt_ids[id - 1];
+	if (ysp && streq(ysp->ys_name, (const char *) nodep->name))
+	    return ysp;
+    }
+
+    if (yscp == NULL)
+	return yangStmtFind((const char *) namespace,
+			    (const char *) nodep->name);
+
+    uintptr_t hash = ((uintptr_t) nodep->name >> 3)
+	^ ((uintptr_t) namespace >> 5);
+    ycep = &yscp->ysc_entries[hash & (YANG_STMT_CACHE_SIZE - 1)];
+
+    if (ycep->ysce_name == nodep->name && ycep->ysce_namespace == namespace)
+	return ycep->ysce_stmt;
+
+    ysp = yangStmtFind((const char *) namespace, (const char *) nodep->name);
+
+    ycep->ysce_name = nodep->name;
+    ycep->ysce_namespace = namespace;
+    ycep->ysce_stmt = ysp;
+
+    return ysp;
 }
 
 static xmlNsPtr
@@ -174,33 +490,110 @@ yangStmtGetValue (slax_data_t *sdp, xmlNodePtr nodep, yang_stmt_t *ysp)
 				ysp->ys_flags);
 }
 
-static yang_relative_t *
-yangFindRelative (yang_relative_t *listp, yang_stmt_t *ysp)
+/*
+ * Grow every frame's seen map to the given number of words.  The
+ * maps for all frames live in one array hung off the yang_data_t,
+ * so the open frames' maps are copied into the new layout and their
+ * pointers moved.
+ */
+static int
+yangSeenGrow (yang_data_t *ydp, unsigned words)
 {
-    for ( ; listp->yr_name; listp++)
-	if (streq(listp->yr_name, ysp->ys_name))
-	    return listp;
+    yang_seen_elt_t *maps, *map;
+    yang_parse_stack_t *ypsp;
 
-    return NULL;
+    maps = xmlMalloc(YANG_STACK_MAX_DEPTH * words * sizeof(*maps));
+    if (maps == NULL) {
+	slaxLog("out of memory for seen maps");
+	return -1;
+    }
+
+    if (ydp->yd_stackp) {
+	for (ypsp = ydp->yd_stack; ypsp <= ydp->yd_stackp; ypsp++) {
+	    if (ypsp->yps_seen.yss_map == NULL)
+		continue;
+
+	    map = maps + (ypsp - ydp->yd_stack) * words;
+	    memcpy(map, ypsp->yps_seen.yss_map,
+		   ydp->yd_seen_words * sizeof(*map));
+	    bzero(map + ydp->yd_seen_words,
+		  (words - ydp->yd_seen_words) * sizeof(*map));
+	    ypsp->yps_seen.yss_map = map;
+	}
+    }
+
+    xmlFreeAndEasy(ydp->yd_seen_maps);
+    ydp->yd_seen_maps = maps;
+    ydp->yd_seen_words = words;
+
+    return 0;
 }
 
+/*
+ * Test and set a statement's bit in a frame's seen map.  A statement
+ * registered after the maps were sized grows them here.
+ */
 static int
-yangSeenTestAndSet (yang_parse_stack_t *ypsp, yang_stmt_t *ysp)
+yangSeenTestAndSet (yang_data_t *ydp, yang_parse_stack_t *ypsp,
+		    yang_stmt_t *ysp)
 {
-    unsigned x = ysp->ys_id / NBBY;
-    unsigned y = ysp->ys_id % NBBY;
-    unsigned z = 1 << y;
+    unsigned x = ysp->ys_id / YANG_SEEN_BITS;
+    unsigned y = ysp->ys_id % YANG_SEEN_BITS;
+    yang_seen_elt_t z = 1UL << y;
     yang_seen_elt_t *map = ypsp->yps_seen.yss_map;
 
-    slaxLog("yangSeenTestAndSet: %d -> %d/%d/%d (%p)",
+    yangTrace(YTF_STMT, "yangSeenTestAndSet: %d -> %d/%d/%#lx (%p)",
 	    ysp->ys_id, x, y, z, map);
 
+    if (map == NULL)
+	return 0;
+
+    if (x >= ydp->yd_seen_words) {
+	if (yangSeenGrow(ydp, YANG_SEEN_WORDS(yangSession()->ysn_stmt_count))
+		|| x >= ydp->yd_seen_words)
+	    return 0;
+	map = ypsp->yps_seen.yss_map;
+    }
+
     int res = (map[x] & z) ? 1 : 0;
 
     map[x] |= z;
     return res;
 }
 
+/*
+ * Return the seen map for a newly pushed stack frame.  The maps are
+ * sized to cover every registered statement, and grow (never shrink)
+ * when statements are registered, even in the middle of a parse.
+ */
+static yang_seen_elt_t *
+yangSeenMap (yang_data_t *ydp, yang_parse_stack_t *ypsp)
+{
+    unsigned words = YANG_SEEN_WORDS(yangSession()->ysn_stmt_count);
+    yang_seen_elt_t *map;
+
+    if (words < YANG_SEEN_WORDS(YANG_MAX_STATEMENT_MAP))
+	words = YANG_SEEN_WORDS(YANG_MAX_STATEMENT_MAP);
+
+    if (ydp->yd_seen_maps == NULL || words > ydp->yd_seen_words) {
+	if (yangSeenGrow(ydp, words))
+	    return NULL;
+    }
+
+    map = ydp->yd_seen_maps + (ypsp - ydp->yd_stack) * ydp->yd_seen_words;
+    bzero(map, ydp->yd_seen_words * sizeof(*map));
+
+    return map;
+}
+
+void
+yangDataCleanup (yang_data_t *ydp)
+{
+    xmlFreeAndEasy(ydp->yd_seen_maps);
+    ydp->yd_seen_maps = NULL;
+    ydp->yd_seen_words = 0;
+}
+
 static unsigned
 yangCheckChildren (slax_data_t *sdp, yang_stmt_t *ysp, const char *name)
 {
@@ -208,15 +601,20 @@ yangCheckChildren (slax_data_t *sdp, yang_stmt_t *ysp, const char *name)
     yang_parse_stack_t *ypsp = ydp->yd_stackp;
     yang_stmt_t *parent = ypsp ? ypsp->yps_stmt : NULL;
 
-    slaxLog("check child: %s", name);
-    if (ysp && parent && parent->ys_children) {
-	yang_relative_t *yrp = yangFindRelative(parent->ys_children, ysp);
-	if (yrp == NULL) {
+    yangTrace(YTF_STMT, "check child: %s", name);
+    if (ysp && parent && parent->ys_child_map) {
+	unsigned yflags = (ysp->ys_id < parent->ys_child_map_size)
+	    ? parent->ys_child_map[ysp->ys_id] : 0;
+
+	if (!(yflags & YRF_PERMITTED)) {
 	    yangError(sdp, "statement '%s' cannot contain statement '%s'",
 		      parent->ys_name, name);
 	    return YPSF_DISCARD;
-	} else if (!(yrp->yr_flags & YRF_MULTIPLE)
-		   && yangSeenTestAndSet(ypsp, ysp)) {
+	}
+
+	/* Record every child, since the close-time check needs them */
+	if (yangSeenTestAndSet(ydp, ypsp, ysp)
+	        && !(yflags & YRF_MULTIPLE)) {
 	    yangError(sdp, "statement '%s' can only contain "
 		      "one statement '%s'",
 		      parent->ys_name, name);
@@ -227,6 +625,74 @@ yangCheckChildren (slax_data_t *sdp, yang_stmt_t *ysp, const char *name)
     return 0;
 }
 
+/*
+ * Does this node contain XSLT instructions?  If so, some of its
+ * substatements may only appear when the script is run, so we
+ * can't complain about missing ones now.
+ */
+static int
+yangHasGeneratedChildren (xmlNodePtr nodep)
+{
+    for (nodep = nodep ? nodep->children : NULL; nodep; nodep = nodep->next) {
+	if (nodep->type == XML_ELEMENT_NODE && nodep->ns && nodep->ns->href
+	    && streq((const char *) nodep->ns->href, XSL_URI))
+	    return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * Check that all mandatory substatements were seen.  The common case
+ * is a mask compare over the frame's seen map; we only walk the
+ * children list to name the missing statements when reporting.
+ */
+static void
+yangCheckMandatory (slax_data_t *sdp, yang_data_t *ydp,
+		    yang_parse_stack_t *ypsp)
+{
+    yang_stmt_t *ysp = ypsp->yps_stmt;
+    yang_seen_elt_t *map = ypsp->yps_seen.yss_map;
+    unsigned i, words;
+    int missing = FALSE;
+
+    if (ysp == NULL || ysp->ys_mandatory == NULL || map == NULL
+	    || (ypsp->yps_flags & YPSF_DISCARD))
+	return;
+
+    /* Words past the seen map are statements that were never seen */
+    words = YANG_SEEN_WORDS(ysp->ys_child_map_size);
+
+    for (i = 0; i < words; i++) {
+	if (ysp->ys_mandatory[i]
+		& ~(i < ydp->yd_seen_words ? map[i] : 0)) {
+	    missing = TRUE;
+	    break;
+	}
+    }
+
+    if (!missing || yangHasGeneratedChildren(sdp->sd_ctxt->node))
+	return;
+
+    yang_relative_t *yrp;
+    yang_stmt_t *childp;
+
+    for (yrp = ysp->ys_children; yrp->yr_name; yrp++) {
+	if (!(yrp->yr_flags & YRF_MANDATORY))
+	    continue;
+
+	childp = yangStmtFind(yrp->yr_namespace, yrp->yr_name);
+	if (childp == NULL)
+	    continue;
+
+	i = childp->ys_id / YANG_SEEN_BITS;
+	if (i >= ydp->yd_seen_words
+		|| !(map[i] & (1UL << (childp->ys_id % YANG_SEEN_BITS))))
+	    yangError(sdp, "statement '%s' is missing mandatory "
+		      "statement '%s'", ysp->ys_name, yrp->yr_name);
+    }
+}
+
 void
 yangStmtOpen (slax_data_t *sdp, const char *raw_name)
 {
@@ -246,18 +712,20 @@ yangStmtOpen (slax_data_t *sdp, const char *raw_name)
 	name = local_name + 1;
     }
 
-    slaxLog("yang: open: %s (%s:%s)", raw_name, ns ?: "--", name);
+    yangTrace(YTF_STMT, "yang: open: %s (%s:%s)",
+	      raw_name, ns ?: "--", name);
  
     slaxElementOpen(sdp, name);
 
     yang_stmt_t *ysp = yangStmtFind(ns, name);
     if (ysp) {
 	sdp->sd_ctxt->node->ns = yangStmtFindNs(ydp, ysp);
+	yangStmtMark(sdp->sd_ctxt->node, ysp);
 
 	flags |= yangCheckChildren(sdp, ysp, name);
 
 	if (ysp->ys_open) {
-	    slaxLog("yang: calling open for %s", name);
+	    yangTrace(YTF_STMT, "yang: calling open for %s", name);
 	    ysp->ys_open(sdp, ydp, ysp);
 	}
 
@@ -280,10 +748,14 @@ yangStmtOpen (slax_data_t *sdp, const char *raw_name)
     /* Allocate a frame on the parse stack */
     ydp->yd_stackp = ydp->yd_stackp ? ydp->yd_stackp + 1 : ydp->yd_stack;
 
+    if (ydp->yd_stack_high == NULL || ydp->yd_stackp > ydp->yd_stack_high)
+	ydp->yd_stack_high = ydp->yd_stackp;
+
     /* Fill in the parse stack frame with the info we know */
     bzero(ydp->yd_stackp, sizeof(*ydp->yd_stackp));
     ydp->yd_stackp->yps_stmt = ysp;
     ydp->yd_stackp->yps_flags = flags;
+    ydp->yd_stackp->yps_seen.yss_map = yangSeenMap(ydp, ydp->yd_stackp);
 }
 
 void
@@ -291,17 +763,19 @@ yangStmtClose (slax_data_t *sdp, const char *name)
 {
     yang_data_t *ydp = yangData(sdp);
 
-    slaxLog("yang: close: %s", name);
+    yangTrace(YTF_STMT, "yang: close: %s", name);
 
     yang_stmt_t *ysp = ydp->yd_stackp ? ydp->yd_stackp->yps_stmt : NULL;
     if (ysp && ysp->ys_close) {
-	slaxLog("yang: calling close for %s", name);
+	yangTrace(YTF_STMT, "yang: calling close for %s", name);
 	ysp->ys_close(sdp, ydp, ysp);
     }
 
     unsigned flags = 0;
 
     if (ydp->yd_stackp) {
+	yangCheckMandatory(sdp, ydp, ydp->yd_stackp);
+
 	flags = ydp->yd_stackp->yps_flags;
 	ydp->yd_stackp->yps_stmt = NULL;
 
@@ -315,7 +789,8 @@ yangStmtClose (slax_data_t *sdp, const char *name)
     slaxElementClose(sdp);
 
     if (nodep && (flags & YPSF_DISCARD)) {
-	slaxLog("yang: close: discarding '%s'", (const char *) nodep->name);
+	yangTrace(YTF_STMT, "yang: close: discarding '%s'",
+		  (const char *) nodep->name);
 	xmlUnlinkNode(nodep);
     }
 }
@@ -331,7 +806,7 @@ yangStmtSetArgument (slax_data_t *sdp, slax_string_t *value,
     const char *argument;
     int as_element;
 
-    slaxLog("yangStmtSetArgument: %x %x %d -> %x:%s",
+    yangTrace(YTF_STMT, "yangStmtSetArgument: %x %x %d -> %x:%s",
 	    sdp, value, is_xpath, nodep, name);
 
     ysp = ydp->yd_stackp ? ydp->yd_stackp->yps_stmt : NULL;
@@ -372,6 +847,39 @@ yangStmtSetArgument (slax_data_t *sdp, slax_string_t *value,
 	ysp->ys_setarg(sdp, ydp, ysp);
 }
 
+/*
+ * Build the name of the variable a "for" loop uses to hold ".".  The
+ * count belongs to the parse, so names don't depend on what other
+ * threads are parsing; the file's name keeps them distinct when
+ * submodules are merged into one script.  Characters that can't be
+ * in an XML name become '_'.
+ */
+void
+yangStmtForVariable (slax_data_t *sdp, const char *prefix,
+		     char *buf, size_t bufsiz)
+{
+    yang_data_t *ydp = yangData(sdp);
+    const char *name = NULL, *cp;
+    char *bp, *ep = buf + bufsiz;
+
+    if (ydp->yd_filep && ydp->yd_filep->yf_name) {
+	name = ydp->yd_filep->yf_name;
+	cp = strrchr(name, '/');
+	if (cp)
+	    name = cp + 1;
+    }
+
+    /* Leave room for the count, however long the name */
+    bp = buf + snprintf(buf, bufsiz, "%s", prefix);
+    for (cp = name; cp && *cp && bp < ep - 12; cp++)
+	*bp++ = (isalnum((int) *cp) || *cp == '-' || *cp == '_'
+		 || *cp == '.') ? *cp : '_';
+
+    if (bp < ep)
+	snprintf(bp, ep - bp, "%s%u", name ? "-" : "",
+		 ++ydp->yd_for_count);
+}
+
 void
 yangStmtCheckArgument (slax_data_t *sdp, slax_string_t *sp)
 {
@@ -446,7 +954,7 @@ yangConcatValues (slax_data_t *sdp, slax_string_t *one,
 	ssp->ss_next = ssp->ss_concat = NULL;
 	ssp->ss_ttype = T_QUOTED;
 	ssp->ss_flags = one->ss_flags;
-	slaxLog("yangConcatValues: built %p %d:'%s'",
+	yangTrace(YTF_PARSE, "yangConcatValues: built %p %d:'%s'",
 		ssp, ssp->ss_ttype,ssp->ss_token);
 
 	slaxStringFree(one);
@@ -481,9 +989,46 @@ yangConcatValues (slax_data_t *sdp, slax_string_t *one,
     return ssp;
 }
 
+/*
+ * Release the session's statement registry
+ */
+void
+yangStmtClean (void)
+{
+    yang_session_t *ysnp = yangSession();
+    yang_stmt_t *ysp;
+
+    for (;;) {
+	ysp = TAILQ_FIRST(&ysnp->ysn_stmts);
+	if (ysp == NULL)
+	    break;
+	TAILQ_REMOVE(&ysnp->ysn_stmts, ysp, ys_link);
+
+	if (ysp->ys_flags & YSF_CHILDREN_ALLOCED)
+	    xmlFree(ysp->ys_children);
+	xmlFreeAndEasy(ysp->ys_child_map);
+	xmlFreeAndEasy(ysp->ys_mandatory);
+	xmlFree(ysp);
+    }
+
+    if (ysnp->ysn_stmt_table) {
+	xmlHashFree(ysnp->ysn_stmt_table, NULL);
+	xmlHashFree(ysnp->ysn_stmt_names, NULL);
+	xmlDictFree(ysnp->ysn_stmt_dict);
+	ysnp->ysn_stmt_table = ysnp->ysn_stmt_names = NULL;
+	ysnp->ysn_stmt_dict = NULL;
+    }
+
+    xmlFreeAndEasy(ysnp->ysn_stmt_ids);
+    ysnp->ysn_stmt_ids = NULL;
+    ysnp->ysn_stmt_ids_size = 0;
+    ysnp->ysn_stmt_count = 0;
+    ysnp->ysn_stmt_unknown = 0;
+}
+
 void
 yangStmtInit (void)
 {
-    TAILQ_INIT(&yangStmtList);
+    yangStmtClean();
     yangStmtInitBuiltin();
 }
@@ -26,6 +26,7 @@ typedef struct yang_relative_s {
 /* Flags for yr_flags */
 #define YRF_MULTIPLE	(1<<0)	/* Allow multiple occurances (0..n)*/
 #define YRF_MANDATORY	(1<<1)	/* Mandatory (1..n or 1) */
+#define YRF_PERMITTED	(1<<7)	/* Child is allowed (ys_child_map only) */
 
 typedef struct yang_stmt_s {
     TAILQ_ENTRY(yang_stmt_s) ys_link; /* Next statement */
@@ -37,6 +38,11 @@ typedef struct yang_stmt_s {
     unsigned ys_type;		/* Type of argument (Y_*) */
     yang_relative_t *ys_parents; /* Array of acceptable parent statements */
     yang_relative_t *ys_children; /* Array of acceptable children statements */
+    unsigned ys_nchildren;	/* Entries in ys_children (once alloced) */
+    unsigned ys_children_max;	/* Allocated size of ys_children */
+    unsigned char *ys_child_map; /* YRF_* flags, indexed by child ys_id */
+    unsigned ys_child_map_size;	/* Number of entries in ys_child_map */
+    unsigned long *ys_mandatory; /* Seen-map mask of YRF_MANDATORY children */
     int (*ys_open)(YANG_STMT_OPEN_ARGS); /* Statement is opened */
     int (*ys_close)(YANG_STMT_CLOSE_ARGS); /* Statement is closed */
     int (*ys_setarg)(YANG_STMT_SETARG_ARGS); /* Argument is set */
@@ -46,6 +52,7 @@ typedef struct yang_stmt_s {
 #define YSF_YINELEMENT	(1<<0)	/* Encode as an element in YIN */
 #define YSF_STANDARD	(1<<1)	/* Statement is YANG state */
 #define YSF_CHILDREN_ALLOCED (1<<2) /* ys_children was malloced, needs freed */
+#define YSF_CHILD_UNKNOWN (1<<3) /* A child isn't registered (yet) */
 
 #define YS_MULTIPLE	"*"	/* Allow multiple instances */
 #define YS_MULTIPLE_CHAR '*'	/* Ditto (as character) */
@@ -55,12 +62,42 @@ typedef TAILQ_HEAD(yang_stmt_list_s, yang_stmt_s) yang_stmt_list_t;
 void
 yangStmtInit (void);
 
+void
+yangStmtClean (void);
+
 void
 yangStmtAdd (yang_stmt_t *ysp, const char *namespace, int count);
 
 yang_stmt_t *
 yangStmtFind (const char *namespace, const char *name);
 
+/*
+ * A small cache of statement lookups, keyed by the (interned) name
+ * and namespace pointers of the nodes being looked up.  It's only
+ * good for the life of the document it's used on, so callers keep
+ * one on the stack for the duration of a walk.
+ */
+#define YANG_STMT_CACHE_SIZE	64 /* Must be a power of two */
+
+typedef struct yang_stmt_cache_entry_s {
+    const xmlChar *ysce_name;	/* Node name (NULL if unused) */
+    const xmlChar *ysce_namespace; /* Node namespace href */
+    yang_stmt_t *ysce_stmt;	/* Statement (NULL if unknown) */
+} yang_stmt_cache_entry_t;
+
+typedef struct yang_stmt_cache_s {
+    yang_stmt_cache_entry_t ysc_entries[YANG_STMT_CACHE_SIZE];
+} yang_stmt_cache_t;
+
+void
+yangStmtCacheInit (yang_stmt_cache_t *yscp);
+
+void
+yangStmtMark (xmlNodePtr nodep, yang_stmt_t *ysp);
+
+yang_stmt_t *
+yangStmtFindNode (yang_stmt_cache_t *yscp, xmlNodePtr nodep);
+
 void
 yangStmtOpen (slax_data_t *sdp, const char *name);
 
@@ -162,5 +199,9 @@ yangStmtGetValueName (slax_data_t *sdp, xmlNodePtr nodep,
 char *
 yangStmtGetValue (slax_data_t *sdp, xmlNodePtr nodep, yang_stmt_t *ysp);
 
+void
+yangStmtForVariable (slax_data_t *sdp, const char *prefix,
+		     char *buf, size_t bufsiz);
+
 void
 yangStmtCheckArgument (slax_data_t *sdp, slax_string_t *sp);
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2014, Juniper Networks, Inc.
+ * All rights reserved.
+ * See ../Copyright for the status of this software
+ */
+
+/*
+ * Timing driver for yangStmtFind.  Registers a large set of made-up
+ * extension statements on top of the builtins, then times lookups of
+ * builtin and extension statements by (namespace, name) and by name
+ * alone.  Each lookup is timed twice: through yangStmtFind's hash
+ * tables, and through a walk of ysn_stmts the way yangStmtFind used to
+ * work, as the baseline.  The walk is slow, so it does fewer lookups
+ * (by default, a thousandth as many); compare the ns/lookup columns.
+ * Build it with "make bench" in libyang; it isn't installed.
+ *
+ *     yangstmtbench [statements [lookups [baseline-lookups]]]
+ */
+
+#include <sys/queue.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <libxml/hash.h>
+
+#include "yanginternals.h"
+#include <libslax/slax.h>
+#include <libslax/slaxdata.h>
+#include <libyang/yang.h>
+#include <libyang/yangparser.h>
+#include <libyang/yangloader.h>
+#include <libyang/yangstmt.h>
+
+#define BENCH_NAMESPACE "http://example.com/ns/yangstmtbench"
+#define BENCH_STATEMENTS 10000	/* Default number of extensions */
+#define BENCH_LOOKUPS 10000000	/* Default number of lookups */
+#define BENCH_BASELINE_DIV 1000	/* Baseline does this many times fewer */
+
+static const char *bench_builtins[] = {
+    YS_CONTAINER, YS_LEAF, YS_TYPE, YS_DESCRIPTION, YS_LIST,
+    YS_KEY, YS_USES, YS_GROUPING, YS_MUST, YS_WHEN, NULL
+};
+
+static double
+bench_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef yang_stmt_t *(*bench_find_t)(const char *, const char *);
+
+/*
+ * The baseline: yangStmtFind as it was before the hash tables, a walk
+ * of every registered statement
+ */
+static yang_stmt_t *
+bench_linear_find (const char *namespace, const char *name)
+{
+    yang_session_t *ysnp = yangSession();
+    yang_stmt_t *ysp;
+    int is_yin = namespace ? streq(namespace, YIN_URI) : FALSE;
+
+    TAILQ_FOREACH(ysp, &ysnp->ysn_stmts, ys_link) {
+	if (namespace) {
+	    if (ysp->ys_namespace) {
+		if (!streq(namespace, ysp->ys_namespace))
+		    continue;
+	    } else if (!is_yin)
+		continue;
+	}
+
+	if (streq(ysp->ys_name, name))
+	    return ysp;
+    }
+
+    return NULL;
+}
+
+/*
+ * Time "lookups" finds of the given names, cycling through them with
+ * the given stride, and report the time per lookup
+ */
+static double
+bench_run (const char *title, bench_find_t find, const char *namespace,
+	   const char **names, unsigned nnames, unsigned long stride,
+	   unsigned long lookups)
+{
+    unsigned long i, found = 0;
+    double start, secs;
+
+    start = bench_now();
+    for (i = 0; i < lookups; i++)
+	if (find(namespace, names[(i * stride) % nnames]))
+	    found += 1;
+    secs = bench_now() - start;
+
+    printf("%-24s %10lu lookups %10lu found %8.3f s %8.1f ns/lookup\n",
+	   title, lookups, found, secs, secs * 1e9 / lookups);
+
+    return secs * 1e9 / lookups;
+}
+
+/*
+ * Run one case through the hash tables and through the baseline walk
+ */
+static void
+bench_case (const char *title, const char *namespace, const char **names,
+	    unsigned nnames, unsigned long stride, unsigned long lookups,
+	    unsigned long baseline)
+{
+    double hashed, linear;
+
+    hashed = bench_run(title, yangStmtFind, namespace, names, nnames,
+		       stride, lookups);
+    linear = bench_run("  baseline (walk)", bench_linear_find, namespace,
+		       names, nnames, stride, baseline);
+
+    printf("%-24s %47.1fx\n", "  speedup", hashed > 0 ? linear / hashed : 0);
+}
+
+int
+main (int argc, char **argv)
+{
+    unsigned count = (argc > 1) ? strtoul(argv[1], NULL, 0) : 0;
+    unsigned long lookups = (argc > 2) ? strtoul(argv[2], NULL, 0) : 0;
+    unsigned long baseline = (argc > 3) ? strtoul(argv[3], NULL, 0) : 0;
+    yang_session_t *ysnp;
+    yang_stmt_t *stmts;
+    char **names;
+    unsigned long i;
+    unsigned nbuiltins;
+    double start;
+
+    if (count == 0)
+	count = BENCH_STATEMENTS;
+    if (lookups == 0)
+	lookups = BENCH_LOOKUPS;
+    if (baseline == 0)
+	baseline = lookups / BENCH_BASELINE_DIV ?: 1;
+
+    ysnp = yangSessionCreate();
+    stmts = calloc(count + 1, sizeof(*stmts));
+    names = calloc(count, sizeof(*names));
+    if (ysnp == NULL || stmts == NULL || names == NULL) {
+	fprintf(stderr, "yangstmtbench: out of memory\n");
+	return 1;
+    }
+
+    yangSessionSet(ysnp);
+
+    for (i = 0; i < count; i++) {
+	if (asprintf(&names[i], "bench-%lu", i) < 0) {
+	    fprintf(stderr, "yangstmtbench: out of memory\n");
+	    return 1;
+	}
+	stmts[i].ys_name = names[i];
+	stmts[i].ys_argument = YS_NAME;
+    }
+
+    start = bench_now();
+    yangStmtAdd(stmts, BENCH_NAMESPACE, count);
+    printf("%-24s %10u statements %27.3f s\n", "register",
+	   ysnp->ysn_stmt_count, bench_now() - start);
+
+    for (nbuiltins = 0; bench_builtins[nbuiltins]; nbuiltins++)
+	continue;
+
+    bench_case("builtin (yin)", YIN_URI, bench_builtins, nbuiltins, 1,
+	       lookups, baseline);
+    bench_case("builtin (any)", NULL, bench_builtins, nbuiltins, 1,
+	       lookups, baseline);
+    bench_case("extension", BENCH_NAMESPACE, (const char **) names, count,
+	       7919, lookups, baseline);
+    bench_case("miss", BENCH_NAMESPACE, bench_builtins, nbuiltins, 1,
+	       lookups, baseline);
+
+    yangSessionSet(NULL);
+    yangSessionFree(ysnp);
+
+    for (i = 0; i < count; i++)
+	free(names[i]);
+    free(names);
+    free(stmts);
+
+    return 0;
+}
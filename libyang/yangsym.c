@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2014, Juniper Networks, Inc.
+ * All rights reserved.
+ * See ../Copyright for the status of this software
+ */
+
+/*
+ * Symbol tables.  Each file keeps a table of its top-level groupings,
+ * typedefs, identities, features and extensions, keyed by (name,
+ * kind), where "kind" is the statement name (YS_GROUPING, etc).  The
+ * table is filled as the statements close during the parse, or by a
+ * scan of the document when the file comes from the on-disk cache.
+ * Each file also maps its import prefixes to the imported files, so
+ * a reference like "if:interface-ref" resolves with two hash lookups.
+ */
+
+#include <sys/queue.h>
+
+#include <libxml/hash.h>
+
+#include "yanginternals.h"
+#include <libslax/slax.h>
+#include <libslax/slaxdata.h>
+#include <libyang/yang.h>
+#include <libyang/yangparser.h>
+#include <libyang/yangloader.h>
+#include <libyang/yangstmt.h>
+#include <libyang/yangtrace.h>
+
+/*
+ * Is this statement name one we keep in the symbol table?
+ */
+int
+yangSymbolIsKind (const char *kind)
+{
+    static const char *kinds[] = {
+	YS_EXTENSION, YS_FEATURE, YS_GROUPING, YS_IDENTITY, YS_TYPEDEF, NULL
+    };
+    const char **cpp;
+
+    for (cpp = kinds; *cpp; cpp++)
+	if (streq(*cpp, kind))
+	    return TRUE;
+
+    return FALSE;
+}
+
+/*
+ * Record a definition.  The first definition of a name wins; later
+ * ones are duplicates, which the caller may want to report.
+ * Returns 0 on success, -1 for a duplicate (or no memory).
+ */
+int
+yangSymbolAdd (yang_file_t *yfp, const char *kind, const char *name,
+	       xmlNodePtr nodep)
+{
+    if (yfp->yf_symbols == NULL) {
+	yfp->yf_symbols = xmlHashCreate(0);
+	if (yfp->yf_symbols == NULL)
+	    return -1;
+    }
+
+    yangTrace(YTF_LOADER, "yang: symbol: %s: %s '%s'",
+	      yfp->yf_name, kind, name);
+
+    return xmlHashAddEntry2(yfp->yf_symbols, (const xmlChar *) name,
+			    (const xmlChar *) kind, nodep);
+}
+
+/*
+ * Find a definition in a file or in any of the submodules it includes.
+ * If filepp is given, it's set to the file that holds the definition.
+ */
+static xmlNodePtr
+yangSymbolFindFile (yang_file_t *yfp, const char *kind, const char *name,
+		    yang_file_t **filepp)
+{
+    yang_import_t *yip;
+    xmlNodePtr nodep;
+
+    if (yfp == NULL)
+	return NULL;
+
+    if (yfp->yf_symbols) {
+	nodep = xmlHashLookup2(yfp->yf_symbols, (const xmlChar *) name,
+			       (const xmlChar *) kind);
+	if (nodep) {
+	    if (filepp)
+		*filepp = yfp;
+	    return nodep;
+	}
+    }
+
+    TAILQ_FOREACH(yip, &yfp->yf_imports, yi_link) {
+	if (yip->yi_flags & YFF_IMPORT)
+	    continue;
+
+	nodep = yangSymbolFindFile(yip->yi_file, kind, name, filepp);
+	if (nodep)
+	    return nodep;
+    }
+
+    return NULL;
+}
+
+/*
+ * Record the file imported under the given prefix
+ */
+int
+yangPrefixAdd (yang_file_t *yfp, const char *prefix, yang_file_t *target)
+{
+    if (yfp->yf_prefixes == NULL) {
+	yfp->yf_prefixes = xmlHashCreate(0);
+	if (yfp->yf_prefixes == NULL)
+	    return -1;
+    }
+
+    return xmlHashAddEntry(yfp->yf_prefixes, (const xmlChar *) prefix,
+			   target);
+}
+
+/*
+ * Map a prefix to a file.  Our own prefix maps to ourselves.
+ */
+yang_file_t *
+yangPrefixFind (yang_file_t *yfp, const char *prefix)
+{
+    if (yfp == NULL || prefix == NULL)
+	return yfp;
+
+    if (yfp->yf_prefix && streq(prefix, yfp->yf_prefix))
+	return yfp;
+
+    if (yfp->yf_prefixes == NULL)
+	return NULL;
+
+    return xmlHashLookup(yfp->yf_prefixes, (const xmlChar *) prefix);
+}
+
+/*
+ * Resolve a possibly-prefixed reference, such as the argument of a
+ * "uses" statement.  If filepp is given, it's set to the file that
+ * holds the definition, which is the context for any references the
+ * definition itself makes.
+ */
+xmlNodePtr
+yangSymbolResolveFile (yang_file_t *yfp, const char *kind, const char *ref,
+		       yang_file_t **filepp)
+{
+    const char *cp = strchr(ref, ':');
+
+    if (cp == NULL)
+	return yangSymbolFindFile(yfp, kind, ref, filepp);
+
+    size_t len = cp - ref;
+    char prefix[len + 1];
+
+    memcpy(prefix, ref, len);
+    prefix[len] = '\0';
+
+    return yangSymbolFindFile(yangPrefixFind(yfp, prefix), kind, cp + 1,
+			      filepp);
+}
+
+/*
+ * Our own prefix comes from "prefix" for a module, or from the
+ * "prefix" under "belongs-to" for a submodule
+ */
+void
+yangSymbolSetPrefix (yang_file_t *yfp)
+{
+    xmlNodePtr nodep, childp;
+
+    if (yfp->yf_prefix || yfp->yf_main == NULL)
+	return;
+
+    for (nodep = yfp->yf_main->children; nodep; nodep = nodep->next) {
+	if (nodep->type != XML_ELEMENT_NODE)
+	    continue;
+
+	if (streq((const char *) nodep->name, YS_PREFIX)) {
+	    yfp->yf_prefix = slaxGetAttrib(nodep, YS_VALUE);
+	    return;
+	}
+
+	if (!streq((const char *) nodep->name, YS_BELONGS_TO))
+	    continue;
+
+	for (childp = nodep->children; childp; childp = childp->next) {
+	    if (childp->type == XML_ELEMENT_NODE
+		    && streq((const char *) childp->name, YS_PREFIX)) {
+		yfp->yf_prefix = slaxGetAttrib(childp, YS_VALUE);
+		return;
+	    }
+	}
+    }
+}
+
+/*
+ * Fill the symbol table from the document, for files that weren't
+ * parsed (cache hits)
+ */
+void
+yangSymbolScan (yang_file_t *yfp)
+{
+    xmlNodePtr nodep;
+
+    yangSymbolSetPrefix(yfp);
+
+    if (yfp->yf_main == NULL)
+	return;
+
+    for (nodep = yfp->yf_main->children; nodep; nodep = nodep->next) {
+	if (nodep->type != XML_ELEMENT_NODE
+		|| !yangSymbolIsKind((const char *) nodep->name))
+	    continue;
+
+	char *name = slaxGetAttrib(nodep, YS_NAME);
+	if (name) {
+	    yangSymbolAdd(yfp, (const char *) nodep->name, name, nodep);
+	    xmlFree(name);
+	}
+    }
+}
+
+/*
+ * Release a file's tables.  The entries belong to the documents and
+ * the module cache, so only the tables themselves are freed.
+ */
+void
+yangSymbolClean (yang_file_t *yfp)
+{
+    if (yfp->yf_symbols) {
+	xmlHashFree(yfp->yf_symbols, NULL);
+	yfp->yf_symbols = NULL;
+    }
+
+    if (yfp->yf_prefixes) {
+	xmlHashFree(yfp->yf_prefixes, NULL);
+	yfp->yf_prefixes = NULL;
+    }
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2014, Juniper Networks, Inc.
+ * All rights reserved.
+ * See ../Copyright for the status of this software
+ */
+
+#include "yanginternals.h"
+#include <libslax/slax.h>
+#include <libyang/yangtrace.h>
+
+unsigned yangTraceFlags;
+
+static struct {
+    const char *ytn_name;	/* Category name */
+    unsigned ytn_flag;		/* YTF_* flag */
+} yangTraceNames[] = {
+    { "parse", YTF_PARSE },
+    { "stmt", YTF_STMT },
+    { "loader", YTF_LOADER },
+    { "writer", YTF_WRITER },
+    { "eval", YTF_EVAL },
+    { "all", YTF_ALL },
+    { NULL, 0 }
+};
+
+void
+yangTraceEnable (unsigned flags)
+{
+    yangTraceFlags |= flags;
+}
+
+/*
+ * Enable trace categories from a comma-separated list of names.
+ * Returns -1 if any name is unknown.
+ */
+int
+yangTraceEnableNames (const char *names)
+{
+    const char *cp, *ep;
+    size_t len;
+    int i, rc = 0;
+
+    for (cp = names; cp && *cp; cp = ep) {
+	ep = strchr(cp, ',');
+	len = ep ? (size_t) (ep - cp) : strlen(cp);
+	if (ep)
+	    ep += 1;
+
+	for (i = 0; yangTraceNames[i].ytn_name; i++) {
+	    if (strlen(yangTraceNames[i].ytn_name) == len
+		    && strncmp(yangTraceNames[i].ytn_name, cp, len) == 0)
+		break;
+	}
+
+	if (yangTraceNames[i].ytn_name)
+	    yangTraceFlags |= yangTraceNames[i].ytn_flag;
+	else
+	    rc = -1;
+    }
+
+    return rc;
+}
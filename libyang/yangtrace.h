@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2014, Juniper Networks, Inc.
+ * All rights reserved.
+ * See ../Copyright for the status of this software
+ */
+
+#ifndef LIBYANG_YANGTRACE_H
+#define LIBYANG_YANGTRACE_H
+
+/*
+ * Trace categories for yangTrace().  Each category has its own enable
+ * bit, so "-v" can turn on everything while the parse hot path pays
+ * only a flag test when tracing is off.
+ */
+#define YTF_PARSE	(1<<0)	/* Lexer/parser values */
+#define YTF_STMT	(1<<1)	/* Statement open/close/argument */
+#define YTF_LOADER	(1<<2)	/* File loading, imports, includes */
+#define YTF_WRITER	(1<<3)	/* YANG output writer */
+#define YTF_EVAL	(1<<4)	/* Stylesheet evaluation (yangc) */
+
+#define YTF_ALL		(YTF_PARSE | YTF_STMT | YTF_LOADER \
+			 | YTF_WRITER | YTF_EVAL)
+
+/*
+ * The enabled categories are process-wide, not per session: the trace
+ * goes to slaxLog, whose destination is itself process-wide, and the
+ * test stays a plain load rather than a thread-specific lookup on
+ * every call in the parser.
+ */
+extern unsigned yangTraceFlags;	/* Enabled categories (YTF_*) */
+
+/*
+ * Trace a message under a category.  The test happens before any
+ * arguments are evaluated, so disabled calls do no work.  When built
+ * with --disable-trace, the calls are compiled out completely (the
+ * "if (0)" keeps the arguments type-checked and "used").
+ */
+#ifdef YANGC_NO_TRACE
+#define yangTrace(_cat, ...) \
+    do { if (0) slaxLog(__VA_ARGS__); } while (0)
+#define yangTraceIsEnabled(_cat) (0)
+#else /* YANGC_NO_TRACE */
+#define yangTrace(_cat, ...) \
+    do { if (yangTraceFlags & (_cat)) slaxLog(__VA_ARGS__); } while (0)
+#define yangTraceIsEnabled(_cat) (yangTraceFlags & (_cat))
+#endif /* YANGC_NO_TRACE */
+
+void
+yangTraceEnable (unsigned flags);
+
+int
+yangTraceEnableNames (const char *names);
+
+#endif /* LIBYANG_YANGTRACE_H */
@@ -0,0 +1,892 @@
+/*
+ * Copyright (c) 2014, Juniper Networks, Inc.
+ * All rights reserved.
+ * See ../Copyright for the status of this software
+ */
+
+/*
+ * Grouping expansion.  Each "uses" is replaced by the contents of its
+ * grouping.  Expansions are memoized: a grouping is expanded (with any
+ * nested "uses" resolved in the grouping's own module) once, and every
+ * unmodified "uses" of it gets a copy of that expansion.  A "uses"
+ * with "refine" or "augment" children starts from a copy of the shared
+ * expansion and applies just those changes.  A set of changes seen
+ * only once is moved into place rather than copied again; one that
+ * recurs is memoized under its text, so it's also done only once.
+ *
+ * The instances can't share nodes: a libxml2 node has only one
+ * parent, and the tree we write out must be a real tree.  So the memo
+ * saves the work of expanding, not the memory of the copies; what it
+ * costs over expanding in place is one copy of each grouping and of
+ * each recurring refinement, freed when the file is done.
+ *
+ * A grouping from another module is written with that module's
+ * prefixes, so its copies are rewritten into the using module's (see
+ * yangPrefixMapInit).  Only statement arguments are rewritten; XPath
+ * expressions are copied as written.
+ *
+ * The memo is keyed by the grouping node, so it only lives for one
+ * yangLoadFile call.  It's kept in the session.
+ */
+
+#include <sys/queue.h>
+
+#include <libxml/hash.h>
+
+#include "yanginternals.h"
+#include <libslax/slax.h>
+#include <libslax/slaxdata.h>
+#include <libyang/yang.h>
+#include <libyang/yangparser.h>
+#include <libyang/yangloader.h>
+#include <libyang/yangstmt.h>
+#include <libyang/yangtrace.h>
+
+#define YANG_EXPAND_HOLDER "expansion" /* Element that holds an expansion */
+
+/* Memo entry for changes seen once, whose expansion wasn't kept */
+static char yangExpandSeen;
+
+void
+yangLoaderSetExpandUses (int expand)
+{
+    yangSession()->ysn_expand_uses = expand;
+}
+
+/*
+ * Is this node the given YANG statement?
+ */
+static int
+yangIsStmt (xmlNodePtr nodep, const char *name)
+{
+    if (nodep == NULL || nodep->type != XML_ELEMENT_NODE)
+	return FALSE;
+
+    if (nodep->ns && nodep->ns->href
+	    && !streq((const char *) nodep->ns->href, YIN_URI))
+	return FALSE;
+
+    return streq((const char *) nodep->name, name);
+}
+
+/*
+ * Find a grouping for a "uses".  Groupings can be defined in any
+ * ancestor of the "uses", so we look there first, then in the
+ * module's symbol table.  A "uses" inside a memoized expansion has no
+ * ancestors past the holder, so we continue from "scope", the
+ * original grouping it came from.
+ */
+static xmlNodePtr
+yangGroupingFind (yang_file_t *yfp, xmlNodePtr usesp, xmlNodePtr scope,
+		  const char *ref, yang_file_t **filepp)
+{
+    const char *name = ref, *cp = strchr(ref, ':');
+    xmlNodePtr parent, nodep;
+
+    *filepp = yfp;
+
+    if (cp) {
+	size_t len = cp - ref;
+	char prefix[len + 1];
+
+	memcpy(prefix, ref, len);
+	prefix[len] = '\0';
+
+	if (yangPrefixFind(yfp, prefix) != yfp)
+	    return yangSymbolResolveFile(yfp, YS_GROUPING, ref, filepp);
+
+	name = cp + 1;
+    }
+
+    for (parent = usesp->parent; parent; ) {
+	for (nodep = parent->children; nodep; nodep = nodep->next) {
+	    if (!yangIsStmt(nodep, YS_GROUPING))
+		continue;
+
+	    char *gname = slaxGetAttrib(nodep, YS_NAME);
+	    int match = (gname && streq(gname, name));
+	    xmlFreeAndEasy(gname);
+	    if (match)
+		return nodep;
+	}
+
+	if (parent == yfp->yf_main)
+	    break;
+
+	if (parent->parent == NULL
+		|| parent->parent->type != XML_ELEMENT_NODE) {
+	    parent = scope;	/* Off the top of a holder */
+	    scope = NULL;
+	} else {
+	    parent = parent->parent;
+	}
+    }
+
+    return yangSymbolResolveFile(yfp, YS_GROUPING, name, filepp);
+}
+
+/*
+ * Statements in a grouping that describe the grouping itself, rather
+ * than being part of its contents
+ */
+static int
+yangGroupingIsMeta (xmlNodePtr nodep)
+{
+    return yangIsStmt(nodep, YS_DESCRIPTION) || yangIsStmt(nodep, YS_REFERENCE)
+	|| yangIsStmt(nodep, YS_STATUS) || yangIsStmt(nodep, YS_GROUPING)
+	|| yangIsStmt(nodep, YS_TYPEDEF);
+}
+
+static xmlNodePtr
+yangGroupingExpansion (yang_file_t *yfp, xmlNodePtr groupp);
+
+/*
+ * Prefix maps.  A grouping's contents are written in terms of its own
+ * file's prefixes, so when they're copied into another module their
+ * references must be rewritten into that module's terms.  The map
+ * takes each prefix the grouping's file knows (its own included) to
+ * the prefix the using file knows the same module by, or to "" for
+ * the using file's own module.  Unprefixed references to the
+ * grouping's own definitions get a prefix.
+ */
+typedef struct yang_prefix_map_s {
+    yang_file_t *ypm_from;	/* File the references are written in */
+    yang_file_t *ypm_to;	/* File they're being copied into */
+    xmlHashTablePtr ypm_table;	/* From prefix ("" for none) -> to prefix */
+} yang_prefix_map_t;
+
+/*
+ * Is "target" the file itself, or a submodule it includes?
+ */
+static int
+yangFileIncludes (yang_file_t *yfp, yang_file_t *target)
+{
+    yang_import_t *yip;
+
+    if (yfp == target)
+	return TRUE;
+
+    TAILQ_FOREACH(yip, &yfp->yf_imports, yi_link) {
+	if (!(yip->yi_flags & YFF_IMPORT)
+		&& yangFileIncludes(yip->yi_file, target))
+	    return TRUE;
+    }
+
+    return FALSE;
+}
+
+typedef struct yang_prefix_find_s {
+    yang_file_t *ypf_target;	/* File we want a prefix for */
+    const xmlChar *ypf_prefix;	/* Prefix that leads to it */
+} yang_prefix_find_t;
+
+static void
+yangPrefixFindScan (void *payload, void *data, const xmlChar *name)
+{
+    yang_prefix_find_t *ypfp = data;
+
+    if (ypfp->ypf_prefix == NULL && yangFileIncludes(payload,
+						      ypfp->ypf_target))
+	ypfp->ypf_prefix = name;
+}
+
+/*
+ * Find the prefix a file uses for a target file: "" for its own
+ * module, or NULL if it doesn't import it
+ */
+static const char *
+yangPrefixFor (yang_file_t *yfp, yang_file_t *target)
+{
+    yang_prefix_find_t pf = { target, NULL };
+
+    if (yangFileIncludes(yfp, target))
+	return "";
+
+    if (yfp->yf_prefixes)
+	xmlHashScan(yfp->yf_prefixes, yangPrefixFindScan, &pf);
+
+    return (const char *) pf.ypf_prefix;
+}
+
+static void
+yangPrefixMapAdd (yang_prefix_map_t *ypmp, const char *prefix,
+		  yang_file_t *target)
+{
+    const char *to = yangPrefixFor(ypmp->ypm_to, target);
+
+    if (to == NULL) {
+	yangTrace(YTF_LOADER, "yang: uses: '%s' has no prefix for '%s'",
+		  ypmp->ypm_to->yf_name, target->yf_name);
+	return;
+    }
+
+    xmlHashAddEntry(ypmp->ypm_table, (const xmlChar *) prefix,
+		    (void *) to);
+}
+
+static void
+yangPrefixMapScan (void *payload, void *data, const xmlChar *name)
+{
+    yangPrefixMapAdd(data, (const char *) name, payload);
+}
+
+/*
+ * Build the map for copying from one file into another.  Returns
+ * -1 if there's nothing to do (the same module) or no memory.
+ */
+static int
+yangPrefixMapInit (yang_prefix_map_t *ypmp, yang_file_t *from,
+		   yang_file_t *to)
+{
+    bzero(ypmp, sizeof(*ypmp));
+
+    if (from == NULL || to == NULL || yangFileIncludes(to, from))
+	return -1;
+
+    ypmp->ypm_from = from;
+    ypmp->ypm_to = to;
+    ypmp->ypm_table = xmlHashCreate(0);
+    if (ypmp->ypm_table == NULL)
+	return -1;
+
+    yangPrefixMapAdd(ypmp, "", from);
+    if (from->yf_prefix)
+	yangPrefixMapAdd(ypmp, from->yf_prefix, from);
+    if (from->yf_prefixes)
+	xmlHashScan(from->yf_prefixes, yangPrefixMapScan, ypmp);
+
+    return 0;
+}
+
+static void
+yangPrefixMapClean (yang_prefix_map_t *ypmp)
+{
+    if (ypmp->ypm_table)
+	xmlHashFree(ypmp->ypm_table, NULL);
+    ypmp->ypm_table = NULL;
+}
+
+/*
+ * Rewrite one reference.  "kind" is the statement the reference
+ * names; an unprefixed name is only the from file's if it defines it
+ * (otherwise it's a builtin type, or a local definition), and NULL
+ * means any prefix is rewritten but unprefixed names are left alone.
+ * Returns the new reference, or NULL to leave it alone.
+ */
+static char *
+yangPrefixMapRef (yang_prefix_map_t *ypmp, const char *kind,
+		  const char *ref, size_t len)
+{
+    const char *cp = memchr(ref, ':', len);
+    size_t plen = cp ? (size_t) (cp - ref) : 0;
+    const char *name = cp ? cp + 1 : ref;
+    size_t nlen = len - (name - ref);
+    char prefix[plen + 1], *res;
+    const char *to;
+
+    memcpy(prefix, ref, plen);
+    prefix[plen] = '\0';
+
+    if (cp == NULL) {
+	char nbuf[nlen + 1];
+
+	memcpy(nbuf, name, nlen);
+	nbuf[nlen] = '\0';
+	if (kind == NULL || yangSymbolResolveFile(ypmp->ypm_from, kind,
+						  nbuf, NULL) == NULL)
+	    return NULL;
+    }
+
+    to = xmlHashLookup(ypmp->ypm_table, (const xmlChar *) prefix);
+    if (to == NULL || streq(to, prefix))
+	return NULL;
+
+    res = xmlMalloc(strlen(to) + nlen + 2);
+    if (res == NULL)
+	return NULL;
+
+    if (*to)
+	sprintf(res, "%s:%.*s", to, (int) nlen, name);
+    else
+	sprintf(res, "%.*s", (int) nlen, name);
+
+    return res;
+}
+
+/*
+ * Rewrite an attribute holding a reference, or (for a schema node id)
+ * a path of them
+ */
+static void
+yangPrefixMapAttrib (yang_prefix_map_t *ypmp, xmlNodePtr nodep,
+		     const char *attrib, const char *kind, int is_path)
+{
+    char *value = slaxGetAttrib(nodep, attrib);
+    xmlBufferPtr buf;
+    const char *cp, *ep;
+    char *ref;
+    int changed = FALSE;
+
+    if (value == NULL)
+	return;
+
+    if (!is_path) {
+	ref = yangPrefixMapRef(ypmp, kind, value, strlen(value));
+	if (ref) {
+	    xmlSetProp(nodep, (const xmlChar *) attrib, (const xmlChar *) ref);
+	    xmlFree(ref);
+	}
+	xmlFree(value);
+	return;
+    }
+
+    buf = xmlBufferCreate();
+    if (buf == NULL) {
+	xmlFree(value);
+	return;
+    }
+
+    for (cp = value; *cp; cp = ep) {
+	if (*cp == '/') {
+	    xmlBufferAdd(buf, (const xmlChar *) "/", 1);
+	    ep = cp + 1;
+	    continue;
+	}
+
+	ep = strchr(cp, '/') ?: cp + strlen(cp);
+	ref = yangPrefixMapRef(ypmp, NULL, cp, ep - cp);
+	if (ref) {
+	    xmlBufferCCat(buf, ref);
+	    xmlFree(ref);
+	    changed = TRUE;
+	} else {
+	    xmlBufferAdd(buf, (const xmlChar *) cp, ep - cp);
+	}
+    }
+
+    if (changed)
+	xmlSetProp(nodep, (const xmlChar *) attrib, xmlBufferContent(buf));
+
+    xmlBufferFree(buf);
+    xmlFree(value);
+}
+
+/*
+ * Rewrite the references in a node and everything below it
+ */
+static void
+yangPrefixMapNode (yang_prefix_map_t *ypmp, xmlNodePtr nodep)
+{
+    xmlNodePtr childp;
+
+    if (nodep->type != XML_ELEMENT_NODE)
+	return;
+
+    if (yangIsStmt(nodep, YS_TYPE))
+	yangPrefixMapAttrib(ypmp, nodep, YS_NAME, YS_TYPEDEF, FALSE);
+    else if (yangIsStmt(nodep, YS_USES))
+	yangPrefixMapAttrib(ypmp, nodep, YS_NAME, YS_GROUPING, FALSE);
+    else if (yangIsStmt(nodep, YS_BASE))
+	yangPrefixMapAttrib(ypmp, nodep, YS_NAME, YS_IDENTITY, FALSE);
+    else if (yangIsStmt(nodep, YS_IF_FEATURE))
+	yangPrefixMapAttrib(ypmp, nodep, YS_NAME, YS_FEATURE, FALSE);
+    else if (yangIsStmt(nodep, YS_AUGMENT) || yangIsStmt(nodep, YS_REFINE))
+	yangPrefixMapAttrib(ypmp, nodep, YS_TARGET_NODE, NULL, TRUE);
+
+    for (childp = nodep->children; childp; childp = childp->next)
+	yangPrefixMapNode(ypmp, childp);
+}
+
+/*
+ * Replace one "uses" with an expansion, whose contents are written in
+ * terms of "hfp".  A memoized expansion is copied; one we own is moved
+ * into place, and the emptied holder freed.
+ */
+static void
+yangUsesReplace (yang_file_t *yfp, xmlNodePtr usesp, xmlNodePtr holder,
+		 yang_file_t *hfp, int owned)
+{
+    yang_prefix_map_t map;
+    int mapped = (yangPrefixMapInit(&map, hfp, yfp) == 0);
+    xmlNodePtr nodep, nextp, newp;
+
+    for (nodep = holder->children; nodep; nodep = nextp) {
+	nextp = nodep->next;
+
+	if (owned) {
+	    xmlUnlinkNode(nodep);
+	    newp = nodep;
+	} else {
+	    newp = xmlDocCopyNode(nodep, usesp->doc, 1);
+	    if (newp == NULL)
+		continue;
+	}
+
+	if (mapped)
+	    yangPrefixMapNode(&map, newp);
+	xmlAddPrevSibling(usesp, newp);
+    }
+
+    if (owned)
+	xmlFreeNode(holder);
+
+    yangPrefixMapClean(&map);
+    xmlUnlinkNode(usesp);
+    xmlFreeNode(usesp);
+}
+
+/*
+ * A "uses" with "when" or "if-feature" is conditional; we leave those
+ * in place rather than losing the condition
+ */
+static int
+yangUsesIsConditional (xmlNodePtr usesp)
+{
+    xmlNodePtr nodep;
+
+    for (nodep = usesp->children; nodep; nodep = nodep->next)
+	if (yangIsStmt(nodep, YS_WHEN) || yangIsStmt(nodep, YS_IF_FEATURE))
+	    return TRUE;
+
+    return FALSE;
+}
+
+/*
+ * Is this node a schema node, which is all a schema node id can name?
+ * Input and output have no argument, so they go by their keyword.
+ */
+static const char *
+yangSchemaNodeName (xmlNodePtr nodep, char **freep)
+{
+    static const char *kinds[] = {
+	YS_ANYXML, YS_CASE, YS_CHOICE, YS_CONTAINER, YS_INPUT,
+	YS_LEAF, YS_LEAF_LIST, YS_LIST, YS_NOTIFICATION, YS_OUTPUT,
+	YS_RPC, NULL
+    };
+    const char **cpp;
+
+    *freep = NULL;
+
+    for (cpp = kinds; *cpp; cpp++)
+	if (yangIsStmt(nodep, *cpp))
+	    break;
+
+    if (*cpp == NULL)
+	return NULL;
+
+    if (streq(*cpp, YS_INPUT) || streq(*cpp, YS_OUTPUT))
+	return *cpp;
+
+    *freep = slaxGetAttrib(nodep, YS_NAME);
+    return *freep;
+}
+
+/*
+ * Find the target of a "refine" or "augment" inside an expansion.
+ * The path is a descendant schema node id ("a/b/c"), with optional
+ * prefixes that we don't need (it can't leave the grouping).  Only
+ * schema nodes can be named, so a typedef or grouping that happens
+ * to share a name is never the target.
+ */
+static xmlNodePtr
+yangExpansionFindPath (xmlNodePtr holder, const char *path)
+{
+    xmlNodePtr parent = holder, nodep = NULL;
+    const char *cp, *ep;
+
+    for (cp = path; cp && *cp; cp = ep) {
+	ep = strchr(cp, '/');
+	size_t len = ep ? (size_t) (ep - cp) : strlen(cp);
+	char comp[len + 1];
+
+	memcpy(comp, cp, len);
+	comp[len] = '\0';
+
+	const char *name = strchr(comp, ':');
+	name = name ? name + 1 : comp;
+
+	for (nodep = parent->children; nodep; nodep = nodep->next) {
+	    char *freep;
+	    const char *nname = yangSchemaNodeName(nodep, &freep);
+	    int match = (nname && streq(nname, name));
+
+	    xmlFreeAndEasy(freep);
+	    if (match)
+		break;
+	}
+
+	if (nodep == NULL)
+	    return NULL;
+
+	parent = nodep;
+	if (ep)
+	    ep += 1;
+    }
+
+    return nodep;
+}
+
+/*
+ * Can the target statement have more than one of this child?  We ask
+ * the statement's child map, so extensions get this right too.
+ */
+static int
+yangStmtAllowsMultiple (xmlNodePtr targetp, xmlNodePtr childp)
+{
+    yang_stmt_t *ysp = yangStmtFind(NULL, (const char *) targetp->name);
+    yang_stmt_t *csp = yangStmtFind(NULL, (const char *) childp->name);
+
+    if (ysp == NULL || csp == NULL || ysp->ys_child_map == NULL
+	    || csp->ys_id >= ysp->ys_child_map_size)
+	return FALSE;
+
+    return (ysp->ys_child_map[csp->ys_id] & YRF_MULTIPLE) ? TRUE : FALSE;
+}
+
+/*
+ * Apply a "refine": single-instance statements replace the target's,
+ * others are added
+ */
+static int
+yangExpansionRefine (yang_file_t *yfp, xmlNodePtr holder, xmlNodePtr refp)
+{
+    xmlNodePtr targetp, nodep, oldp, nextp, newp;
+    char *path = slaxGetAttrib(refp, YS_TARGET_NODE);
+
+    targetp = path ? yangExpansionFindPath(holder, path) : NULL;
+    if (targetp == NULL) {
+	slaxError("%s:%ld: refine target '%s' not found", yfp->yf_path,
+		  xmlGetLineNo(refp), path ?: "");
+	xmlFreeAndEasy(path);
+	return -1;
+    }
+
+    for (nodep = refp->children; nodep; nodep = nodep->next) {
+	if (nodep->type != XML_ELEMENT_NODE)
+	    continue;
+
+	if (!yangStmtAllowsMultiple(targetp, nodep)) {
+	    for (oldp = targetp->children; oldp; oldp = nextp) {
+		nextp = oldp->next;
+		if (oldp->type == XML_ELEMENT_NODE
+			&& streq((const char *) oldp->name,
+				 (const char *) nodep->name)) {
+		    xmlUnlinkNode(oldp);
+		    xmlFreeNode(oldp);
+		}
+	    }
+	}
+
+	newp = xmlDocCopyNode(nodep, targetp->doc, 1);
+	if (newp)
+	    xmlAddChild(targetp, newp);
+    }
+
+    xmlFreeAndEasy(path);
+    return 0;
+}
+
+/*
+ * Apply an "augment": its data definitions are added to the target.
+ * Any "uses" among them are expanded later, in the context of the
+ * "uses" being replaced.
+ */
+static int
+yangExpansionAugment (yang_file_t *yfp, xmlNodePtr holder, xmlNodePtr augp)
+{
+    xmlNodePtr targetp, nodep, newp;
+    char *path = slaxGetAttrib(augp, YS_TARGET_NODE);
+
+    targetp = path ? yangExpansionFindPath(holder, path) : NULL;
+    if (targetp == NULL) {
+	slaxError("%s:%ld: augment target '%s' not found", yfp->yf_path,
+		  xmlGetLineNo(augp), path ?: "");
+	xmlFreeAndEasy(path);
+	return -1;
+    }
+
+    for (nodep = augp->children; nodep; nodep = nodep->next) {
+	if (nodep->type != XML_ELEMENT_NODE || yangGroupingIsMeta(nodep)
+		|| yangIsStmt(nodep, YS_WHEN)
+		|| yangIsStmt(nodep, YS_IF_FEATURE))
+	    continue;
+
+	newp = xmlDocCopyNode(nodep, targetp->doc, 1);
+	if (newp)
+	    xmlAddChild(targetp, newp);
+    }
+
+    xmlFreeAndEasy(path);
+    return 0;
+}
+
+/*
+ * The memo key for a grouping's changes is the serialized text of
+ * its "uses"' "refine" and "augment" children ("" for none)
+ */
+static xmlChar *
+yangUsesChanges (xmlNodePtr usesp)
+{
+    xmlBufferPtr buf = NULL;
+    xmlNodePtr nodep;
+    xmlChar *res;
+
+    for (nodep = usesp->children; nodep; nodep = nodep->next) {
+	if (!yangIsStmt(nodep, YS_REFINE) && !yangIsStmt(nodep, YS_AUGMENT))
+	    continue;
+
+	if (buf == NULL) {
+	    buf = xmlBufferCreate();
+	    if (buf == NULL)
+		return NULL;
+	}
+
+	xmlNodeDump(buf, usesp->doc, nodep, 0, 0);
+    }
+
+    if (buf == NULL)
+	return xmlStrdup((const xmlChar *) "");
+
+    res = xmlStrdup(xmlBufferContent(buf));
+    xmlBufferFree(buf);
+    return res;
+}
+
+/*
+ * A shared expansion is keyed by its grouping; a changed one also by
+ * the file whose prefixes it's written in
+ */
+static void
+yangExpandKey (xmlNodePtr groupp, yang_file_t *yfp, char *buf, size_t bufsiz)
+{
+    if (yfp)
+	snprintf(buf, bufsiz, "%p/%p", (void *) groupp, (void *) yfp);
+    else
+	snprintf(buf, bufsiz, "%p", (void *) groupp);
+}
+
+/*
+ * Get the expansion for a "uses", building and memoizing it if needed.
+ * The file whose prefixes the expansion is written in is returned in
+ * *hfpp: the grouping's for a shared expansion, ours for a changed one.
+ * Changes are only memoized the second time we see them; the first
+ * time, *ownp is set and the caller gets the expansion to use up.
+ */
+static xmlNodePtr
+yangUsesExpansion (yang_file_t *yfp, xmlNodePtr usesp, xmlNodePtr scope,
+		   yang_file_t **hfpp, int *ownp)
+{
+    yang_file_t *gfp;
+    yang_prefix_map_t map;
+    xmlNodePtr groupp, base, holder, nodep;
+    char key[48];
+    char *ref = slaxGetAttrib(usesp, YS_NAME);
+    yang_session_t *ysnp = yangSession();
+    int seen;
+
+    *ownp = FALSE;
+
+    if (ref == NULL)
+	return NULL;
+
+    groupp = yangGroupingFind(yfp, usesp, scope, ref, &gfp);
+    if (groupp == NULL) {
+	slaxError("%s:%ld: unknown grouping '%s'", yfp->yf_path,
+		  xmlGetLineNo(usesp), ref);
+	xmlFree(ref);
+	return NULL;
+    }
+
+    xmlFree(ref);
+
+    base = yangGroupingExpansion(gfp, groupp);
+    if (base == NULL)
+	return NULL;
+
+    xmlChar *changes = yangUsesChanges(usesp);
+    if (changes == NULL)
+	return NULL;
+
+    if (*changes == '\0') {
+	xmlFree(changes);
+	*hfpp = gfp;
+	return base;
+    }
+
+    *hfpp = yfp;
+    yangExpandKey(groupp, yfp, key, sizeof(key));
+    holder = xmlHashLookup2(ysnp->ysn_expand_memo,
+			    (const xmlChar *) key, changes);
+    if (holder && holder != (xmlNodePtr) &yangExpandSeen) {
+	xmlFree(changes);
+	return holder;
+    }
+
+    seen = (holder != NULL);
+
+    /* Only the changed parts differ from the shared expansion */
+    holder = xmlDocCopyNode(base, ysnp->ysn_expand_doc, 1);
+    if (holder == NULL) {
+	xmlFree(changes);
+	return NULL;
+    }
+
+    /* The changes are in our terms, so the copy must be too */
+    if (yangPrefixMapInit(&map, gfp, yfp) == 0) {
+	for (nodep = holder->children; nodep; nodep = nodep->next)
+	    yangPrefixMapNode(&map, nodep);
+	yangPrefixMapClean(&map);
+    }
+
+    for (nodep = usesp->children; nodep; nodep = nodep->next) {
+	if (yangIsStmt(nodep, YS_REFINE))
+	    yangExpansionRefine(yfp, holder, nodep);
+	else if (yangIsStmt(nodep, YS_AUGMENT))
+	    yangExpansionAugment(yfp, holder, nodep);
+    }
+
+    if (seen) {
+	xmlHashUpdateEntry2(ysnp->ysn_expand_memo, (const xmlChar *) key,
+			    changes, holder, NULL);
+    } else {
+	xmlHashAddEntry2(ysnp->ysn_expand_memo, (const xmlChar *) key,
+			 changes, &yangExpandSeen);
+	*ownp = TRUE;
+    }
+    xmlFree(changes);
+
+    yangTrace(YTF_LOADER, "yang: uses: refined expansion of '%s' at %s:%ld",
+	      (const char *) usesp->name, yfp->yf_path, xmlGetLineNo(usesp));
+
+    return holder;
+}
+
+/*
+ * Expand every "uses" below a node.  Grouping definitions are skipped;
+ * they're expanded when (and if) they're used.
+ */
+static void
+yangUsesExpandTree (yang_file_t *yfp, xmlNodePtr parent, xmlNodePtr scope)
+{
+    xmlNodePtr nodep, nextp, holder;
+    yang_file_t *hfp;
+    int owned;
+
+    for (nodep = parent->children; nodep; nodep = nextp) {
+	nextp = nodep->next;
+
+	if (nodep->type != XML_ELEMENT_NODE || yangIsStmt(nodep, YS_GROUPING))
+	    continue;
+
+	if (!yangIsStmt(nodep, YS_USES)) {
+	    yangUsesExpandTree(yfp, nodep, scope);
+	    continue;
+	}
+
+	if (yangUsesIsConditional(nodep))
+	    continue;
+
+	holder = yangUsesExpansion(yfp, nodep, scope, &hfp, &owned);
+	if (holder == NULL)
+	    continue;
+
+	/* Expand what an augment brought in, in our own context */
+	xmlNodePtr prevp = nodep->prev;
+	yangUsesReplace(yfp, nodep, holder, hfp, owned);
+
+	xmlNodePtr firstp = prevp ? prevp->next : parent->children;
+	for (nodep = firstp; nodep && nodep != nextp; nodep = nodep->next)
+	    if (nodep->type == XML_ELEMENT_NODE)
+		yangUsesExpandTree(yfp, nodep, scope);
+    }
+}
+
+/*
+ * Get the shared expansion of a grouping, building it on first use
+ */
+static xmlNodePtr
+yangGroupingExpansion (yang_file_t *yfp, xmlNodePtr groupp)
+{
+    yang_session_t *ysnp = yangSession();
+    xmlNodePtr holder, nodep, newp;
+    char key[48];
+
+    yangExpandKey(groupp, NULL, key, sizeof(key));
+    holder = xmlHashLookup2(ysnp->ysn_expand_memo, (const xmlChar *) key,
+			    (const xmlChar *) "");
+    if (holder)
+	return holder;
+
+    if (xmlHashLookup(ysnp->ysn_expand_active, (const xmlChar *) key)) {
+	char *name = slaxGetAttrib(groupp, YS_NAME);
+	slaxError("%s:%ld: grouping '%s' uses itself", yfp->yf_path,
+		  xmlGetLineNo(groupp), name ?: "");
+	xmlFreeAndEasy(name);
+	return NULL;
+    }
+
+    holder = xmlNewDocNode(ysnp->ysn_expand_doc, NULL,
+			   (const xmlChar *) YANG_EXPAND_HOLDER, NULL);
+    if (holder == NULL)
+	return NULL;
+
+    for (nodep = groupp->children; nodep; nodep = nodep->next) {
+	if (nodep->type != XML_ELEMENT_NODE || yangGroupingIsMeta(nodep))
+	    continue;
+
+	newp = xmlDocCopyNode(nodep, ysnp->ysn_expand_doc, 1);
+	if (newp)
+	    xmlAddChild(holder, newp);
+    }
+
+    xmlHashAddEntry(ysnp->ysn_expand_active, (const xmlChar *) key, holder);
+    yangUsesExpandTree(yfp, holder, groupp);
+    xmlHashRemoveEntry(ysnp->ysn_expand_active, (const xmlChar *) key, NULL);
+
+    xmlHashAddEntry2(ysnp->ysn_expand_memo, (const xmlChar *) key,
+		     (const xmlChar *) "", holder);
+
+    return holder;
+}
+
+static void
+yangExpandFreeHolder (void *payload, const xmlChar *name UNUSED)
+{
+    if (payload != &yangExpandSeen)
+	xmlFreeNode(payload);
+}
+
+/*
+ * Expand all the "uses" in a file, if we've been asked to
+ */
+void
+yangUsesExpandFile (yang_file_t *yfp)
+{
+    yang_session_t *ysnp = yangSession();
+
+    if (!ysnp->ysn_expand_uses || yfp->yf_main == NULL)
+	return;
+
+    ysnp->ysn_expand_doc = xmlNewDoc((const xmlChar *) XML_DEFAULT_VERSION);
+    ysnp->ysn_expand_memo = xmlHashCreate(0);
+    ysnp->ysn_expand_active = xmlHashCreate(0);
+
+    if (ysnp->ysn_expand_doc && ysnp->ysn_expand_memo
+	    && ysnp->ysn_expand_active) {
+	ysnp->ysn_expand_doc->dict = yangDictGet();
+	if (ysnp->ysn_expand_doc->dict)
+	    xmlDictReference(ysnp->ysn_expand_doc->dict);
+
+	yangUsesExpandTree(yfp, yfp->yf_main, NULL);
+    }
+
+    if (ysnp->ysn_expand_memo)
+	xmlHashFree(ysnp->ysn_expand_memo, yangExpandFreeHolder);
+    if (ysnp->ysn_expand_active)
+	xmlHashFree(ysnp->ysn_expand_active, NULL);
+    if (ysnp->ysn_expand_doc)
+	xmlFreeDoc(ysnp->ysn_expand_doc);
+
+    ysnp->ysn_expand_memo = ysnp->ysn_expand_active = NULL;
+    ysnp->ysn_expand_doc = NULL;
+}
@@ -18,22 +18,55 @@
 #include <errno.h>
 
 #include <libxml/xmlmemory.h>
+#include <libxml/dict.h>
 #include <libxml/parser.h>
 #include <libxml/xmlsave.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* __SSE2__ */
+
+#include "yanginternals.h"
 #include <libslax/slax.h>
-#include "slaxinternals.h"
+#include <libslax/slaxdata.h>
 
 #include "yang.h"
+#include "yangloader.h"
 #include "yangstmt.h"
 
 /* Forward declarations */
 static int
-yangWriteChildren (slax_writer_t *swp, xmlNodePtr parent,
-		   const char *except, unsigned flags);
+yangWriteChildren (yang_buf_t *ybp, xmlNodePtr parent,
+		   const char *except, const xmlChar *iexcept, unsigned flags);
+
+/*
+ * Element names in a document with a dictionary are interned in it,
+ * so they can be matched by pointer.  yangWriteIntern finds the
+ * interned form of a name (NULL if no node in the document can have
+ * it) and yangWriteNameIs compares against it, falling back to
+ * strings for documents built without a dictionary.
+ */
+static const xmlChar *
+yangWriteIntern (xmlNodePtr nodep, const char *name)
+{
+    if (name == NULL || nodep == NULL || nodep->doc == NULL
+	    || nodep->doc->dict == NULL)
+	return NULL;
+
+    return xmlDictExists(nodep->doc->dict, (const xmlChar *) name, -1);
+}
+
+static inline int
+yangWriteNameIs (xmlNodePtr nodep, const char *name, const xmlChar *iname)
+{
+    if (nodep->doc && nodep->doc->dict)
+	return (nodep->name == iname);
+
+    return streq(name, (const char *) nodep->name);
+}
 
 static int
-yangWriteHasChildNodes (slax_writer_t *swp UNUSED, xmlNodePtr nodep)
+yangWriteHasChildNodes (xmlNodePtr nodep)
 {
     if (nodep == NULL)
 	return FALSE;
@@ -45,40 +78,197 @@ yangWriteHasChildNodes (slax_writer_t *swp UNUSED, xmlNodePtr nodep)
     return FALSE;
 }
 
-static const char *
-yangWriteNeedsQuotes (slax_writer_t *swp UNUSED, const char *data)
+/*
+ * Classification of an argument string.  An unquoted string can't
+ * hold whitespace, quotes, semicolons, braces or comment sequences
+ * (RFC 7950 section 6.1.3).  Inside double quotes, backslash and the
+ * double quote itself must be escaped; single quotes allow nothing
+ * to be escaped, but can't hold a single quote.
+ */
+#define YWC_QUOTE	(1<<0)	/* Must be quoted */
+#define YWC_SQUOTE	(1<<1)	/* Holds a single quote */
+#define YWC_DQUOTE	(1<<2)	/* Holds a double quote */
+#define YWC_BACKSLASH	(1<<3)	/* Holds a backslash */
+
+static unsigned char yangWriteClass[256] = {
+    [ ' ' ] = YWC_QUOTE,
+    [ '\t' ] = YWC_QUOTE,
+    [ '\n' ] = YWC_QUOTE,
+    [ '\r' ] = YWC_QUOTE,
+    [ ';' ] = YWC_QUOTE,
+    [ '{' ] = YWC_QUOTE,
+    [ '}' ] = YWC_QUOTE,
+    [ '\'' ] = YWC_QUOTE | YWC_SQUOTE,
+    [ '"' ] = YWC_QUOTE | YWC_DQUOTE,
+    [ '\\' ] = YWC_BACKSLASH,
+};
+
+/*
+ * Classify one interesting byte.  '/' and '*' only matter as part of
+ * a comment sequence, so they look at the byte after them.
+ */
+static inline unsigned
+yangWriteClassifyByte (const char *cp)
 {
-    if (data == NULL)
-	return "";
+    unsigned ch = (unsigned char) *cp;
 
-    if (strchr(data, (int) '\'') != NULL)
-	return "\"";
+    if (ch == '/')
+	return (cp[1] == '/' || cp[1] == '*') ? YWC_QUOTE : 0;
+    if (ch == '*')
+	return (cp[1] == '/') ? YWC_QUOTE : 0;
 
-    if (strchr(data, (int) '\"') != NULL)
-	return "\'";
+    return yangWriteClass[ch];
+}
 
-    size_t len = strlen(data);
-    if (strcspn(data, "\"' \t\n\r") != len)
-	return "\"";
+/*
+ * Decide, in one pass over the string, whether it needs quoting and
+ * what it holds that affects the quote style and escaping.  The
+ * string's length is returned through lenp.  With SSE2, we look at
+ * sixteen bytes at a time and only examine the interesting ones; the
+ * loads are aligned, so they never cross into a page the string
+ * doesn't touch.
+ */
+static unsigned
+yangWriteNeedsQuotes (const char *data, size_t *lenp)
+{
+    unsigned res = 0;
 
-    if (strstr(data, "//") || strstr(data, "/*"))
-	return "\"";
+    if (*data == '\0') {
+	*lenp = 0;
+	return YWC_QUOTE;	/* Empty strings need quotes */
+    }
+
+#ifdef __SSE2__
+    const char *base = (const char *) ((uintptr_t) data & ~(uintptr_t) 15);
+    unsigned skip = data - base;
+    const __m128i nul = _mm_setzero_si128();
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i semi = _mm_set1_epi8(';');
+    const __m128i squote = _mm_set1_epi8('\'');
+    const __m128i dquote = _mm_set1_epi8('"');
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i star = _mm_set1_epi8('*');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i lbrace = _mm_set1_epi8('{');
+    const __m128i rbrace = _mm_set1_epi8('}');
+    const __m128i ctrl = _mm_set1_epi8('\r' + 1);
+
+    for (;; base += 16, skip = 0) {
+	__m128i v = _mm_load_si128((const __m128i *) base);
+
+	/*
+	 * Tab, newline and carriage return (and the NUL) are the
+	 * only bytes below '\r' + 1 that we care about, so an
+	 * unsigned "less than" catches them all in one compare.
+	 * Anything else it catches is classified as nothing.
+	 */
+	__m128i low = _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v);
+	__m128i hit = _mm_or_si128(low, _mm_cmpeq_epi8(v, space));
+	hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, semi));
+	hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, squote));
+	hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, dquote));
+	hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, slash));
+	hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, star));
+	hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, backslash));
+	hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, lbrace));
+	hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, rbrace));
+
+	unsigned mask = _mm_movemask_epi8(hit) & (0xffffu << skip);
+	unsigned nulmask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nul))
+	    & (0xffffu << skip);
+
+	if (nulmask)		/* Ignore anything past the end */
+	    mask &= (nulmask & -nulmask) - 1;
+
+	while (mask) {
+	    unsigned bit = __builtin_ctz(mask);
+	    res |= yangWriteClassifyByte(base + bit);
+	    mask &= mask - 1;
+	}
+
+	if (nulmask) {
+	    *lenp = base + __builtin_ctz(nulmask) - data;
+	    return res;
+	}
+    }
+#else /* __SSE2__ */
+    const char *cp;
+
+    for (cp = data; *cp; cp++)
+	res |= yangWriteClassifyByte(cp);
 
-    return "";
+    *lenp = cp - data;
+    return res;
+#endif /* __SSE2__ */
 }
 
-static int
-yangWriteNode (slax_writer_t *swp, xmlNodePtr nodep, unsigned flags)
+/*
+ * Write an argument, choosing the quotes from its classification.
+ * Double quotes are preferred, but a string holding a double quote or
+ * backslash (and no single quote) goes in single quotes, where it
+ * needs no escaping.  Otherwise we escape straight into the buffer.
+ */
+static void
+yangWriteString (yang_buf_t *ybp, const char *data)
+{
+    size_t len;
+    unsigned cls = yangWriteNeedsQuotes(data, &len);
+
+    if (cls == 0) {
+	yangBufAdd(ybp, data, len);
+	return;
+    }
+
+    if (!(cls & (YWC_DQUOTE | YWC_BACKSLASH))
+	    || !(cls & YWC_SQUOTE)) {
+	char quote = (cls & (YWC_DQUOTE | YWC_BACKSLASH)) ? '\'' : '"';
+
+	yangBufAddChar(ybp, quote);
+	yangBufAdd(ybp, data, len);
+	yangBufAddChar(ybp, quote);
+	return;
+    }
+
+    yangBufAddChar(ybp, '"');
+
+    char *start = yangBufGrow(ybp, len * 2 + 1);
+    if (start == NULL)
+	return;
+
+    char *bp = start;
+    const char *cp, *ep = data + len;
+
+    for (cp = data; cp < ep; cp++) {
+	if (*cp == '"' || *cp == '\\')
+	    *bp++ = '\\';
+	*bp++ = *cp;
+    }
+    *bp++ = '"';
+
+    ybp->yb_len += bp - start;
+}
+
+/*
+ * Find a statement's argument, which is either an attribute or, for
+ * yin-element statements, the text of a child element.  The name of
+ * the argument (and its interned form) are returned, since that child
+ * isn't a substatement.  *onlyp is set when the argument element is
+ * the only child.  If *freep is set, the caller must xmlFree it.
+ */
+const char *
+yangWriteArgument (yang_stmt_cache_t *yscp, xmlNodePtr nodep,
+		   const char **argumentp, const xmlChar **iargumentp,
+		   int *onlyp, char **freep)
 {
-    const char *name = (const char *) nodep->name;
-    const char *namespace = nodep->ns ? (const char *) nodep->ns->href : NULL;
     yang_stmt_t *ysp;
     const char *argument;
-    int as_element;
     const char *data = NULL;
-    int ignore_children = FALSE;
+    int as_element;
 
-    ysp = yangStmtFind(namespace, name);
+    *onlyp = FALSE;
+    *freep = NULL;
+
+    ysp = yangStmtFindNode(yscp, nodep);
     if (ysp == NULL) {
 	as_element = FALSE;
 	argument = "argument";
@@ -87,86 +277,908 @@ yangWriteNode (slax_writer_t *swp, xmlNodePtr nodep, unsigned flags)
 	argument = ysp->ys_argument ?: "argument";
     }
 
+    const xmlChar *iargument = yangWriteIntern(nodep, argument);
+
+    *argumentp = argument;
+    *iargumentp = iargument;
+
     if (as_element) {
-	ignore_children = TRUE;
-	if (nodep) {
-	    xmlNodePtr childp;
-	    for (childp = nodep->children; childp; childp = childp->next) {
-		if (childp->type != XML_ELEMENT_NODE
-		    	|| childp->children == NULL)
-		    continue;
-		if (!streq(argument, (const char *) childp->name)) {
-		    ignore_children = FALSE;
-		    continue;
-		}
-		if (childp->children->type == XML_TEXT_NODE)
-		    data = (const char *) childp->children->content;
-		break;
+	xmlNodePtr childp;
+
+	*onlyp = TRUE;
+	for (childp = nodep->children; childp; childp = childp->next) {
+	    if (childp->type != XML_ELEMENT_NODE
+		    || childp->children == NULL)
+		continue;
+	    if (!yangWriteNameIs(childp, argument, iargument)) {
+		*onlyp = FALSE;
+		continue;
 	    }
-	    if (childp && childp->next)
-		ignore_children = FALSE;
+	    if (childp->children->type == XML_TEXT_NODE)
+		data = (const char *) childp->children->content;
+	    break;
 	}
+	if (childp && childp->next)
+	    *onlyp = FALSE;
     } else {
-	data = slaxGetAttrib(nodep, argument);
+	*freep = slaxGetAttrib(nodep, argument);
+	data = *freep;
     }
 
-    const char *quote = yangWriteNeedsQuotes(swp, data);
+    return data;
+}
+
+static int
+yangWriteNode (yang_buf_t *ybp, xmlNodePtr nodep, unsigned flags)
+{
+    const char *name = (const char *) nodep->name;
+    const char *argument;
+    const xmlChar *iargument;
+    const char *data;
+    char *alloc;
+    int ignore_children;
+
+    data = yangWriteArgument(ybp->yb_stmts, nodep, &argument, &iargument,
+			     &ignore_children, &alloc);
 
-    /* XXX need to escape this data */
-    slaxWrite(swp, "%s%s%s%s%s", name, data ? " " : "",
-	      quote, data ?: "", quote);
+    yangBufAddString(ybp, name);
 
-    if (!ignore_children && yangWriteHasChildNodes(swp, nodep)) {
-	slaxWrite(swp, " {");
-	slaxWriteNewline(swp, NEWL_INDENT);
+    if (data) {
+	yangBufAddChar(ybp, ' ');
+	yangWriteString(ybp, data);
+    }
 
-	yangWriteChildren(swp, nodep, argument, flags);
+    if (!ignore_children && yangWriteHasChildNodes(nodep)) {
+	yangBufAdd(ybp, " {", 2);
+	yangBufNewline(ybp);
 
-	slaxWrite(swp, "}");
-	slaxWriteNewline(swp, NEWL_OUTDENT);
+	ybp->yb_indent += 1;
+	yangWriteChildren(ybp, nodep, argument, iargument, flags);
+	ybp->yb_indent -= 1;
+
+	yangBufAddChar(ybp, '}');
     } else {
-	slaxWrite(swp, ";");
-	slaxWriteNewline(swp, 0);
+	yangBufAddChar(ybp, ';');
     }
 
+    yangBufNewline(ybp);
+
+    xmlFreeAndEasy(alloc);
     return 0;
 }
 
 static int
-yangWriteChildren (slax_writer_t *swp, xmlNodePtr parent,
-		   const char *except, unsigned flags)
+yangWriteChildren (yang_buf_t *ybp, xmlNodePtr parent,
+		   const char *except, const xmlChar *iexcept, unsigned flags)
 {
     xmlNodePtr nodep;
     int rc = 0;
 
     for (nodep = parent->children; nodep; nodep = nodep->next) {
 	if (nodep->type == XML_ELEMENT_NODE) {
-	    if (except && streq(except, (const char *) nodep->name))
+	    if (except && yangWriteNameIs(nodep, except, iexcept))
 		continue;
-	    yangWriteNode(swp, nodep, flags);
+	    yangWriteNode(ybp, nodep, flags);
 	}
     }
 
     return rc;
 }
 
-int
-yangWriteDocNode (slaxWriterFunc_t func, void *data, xmlNodePtr nodep,
-		       unsigned flags)
+/*
+ * Write a string as a JSON string literal, escaping straight into
+ * the buffer
+ */
+static void
+yangJsonWriteString (yang_buf_t *ybp, const char *str)
+{
+    const unsigned char *cp;
+    char *start, *bp;
+
+    yangBufAdd(ybp, "", 0);	/* Indent, if we're starting a line */
+
+    start = bp = yangBufGrow(ybp, strlen(str) * 6 + 2);
+    if (start == NULL)
+	return;
+
+    *bp++ = '"';
+    for (cp = (const unsigned char *) str; *cp; cp++) {
+	switch (*cp) {
+	case '"':
+	case '\\':
+	    *bp++ = '\\';
+	    *bp++ = *cp;
+	    break;
+	case '\n':
+	    *bp++ = '\\';
+	    *bp++ = 'n';
+	    break;
+	case '\r':
+	    *bp++ = '\\';
+	    *bp++ = 'r';
+	    break;
+	case '\t':
+	    *bp++ = '\\';
+	    *bp++ = 't';
+	    break;
+	default:
+	    if (*cp < 0x20) {
+		static const char hex[] = "0123456789abcdef";
+		memcpy(bp, "\\u00", 4);
+		bp[4] = hex[*cp >> 4];
+		bp[5] = hex[*cp & 0xf];
+		bp += 6;
+	    } else
+		*bp++ = *cp;
+	}
+    }
+    *bp++ = '"';
+
+    ybp->yb_len += bp - start;
+}
+
+/*
+ * Write a statement as a JSON object, with its keyword, its argument
+ * and an array of its substatements.  If more siblings follow, a
+ * comma follows the closing brace.
+ */
+static void
+yangJsonWriteNode (yang_buf_t *ybp, xmlNodePtr nodep, int more)
+{
+    const char *argument;
+    const xmlChar *iargument;
+    const char *data;
+    char *alloc;
+    int only;
+    xmlNodePtr childp, nextp;
+
+    data = yangWriteArgument(ybp->yb_stmts, nodep, &argument, &iargument,
+			     &only, &alloc);
+
+    /* Find the first substatement, skipping our argument */
+    for (childp = nodep->children; childp; childp = childp->next)
+	if (childp->type == XML_ELEMENT_NODE
+		&& !(only || yangWriteNameIs(childp, argument, iargument)))
+	    break;
+
+    yangBufAddChar(ybp, '{');
+    yangBufNewline(ybp);
+    ybp->yb_indent += 1;
+
+    yangBufAddString(ybp, "\"keyword\": ");
+    yangJsonWriteString(ybp, (const char *) nodep->name);
+    if (data || childp)
+	yangBufAddChar(ybp, ',');
+    yangBufNewline(ybp);
+
+    if (data) {
+	yangBufAddString(ybp, "\"argument\": ");
+	yangJsonWriteString(ybp, data);
+	if (childp)
+	    yangBufAddChar(ybp, ',');
+	yangBufNewline(ybp);
+    }
+
+    if (childp) {
+	yangBufAddString(ybp, "\"substatements\": [");
+	yangBufNewline(ybp);
+	ybp->yb_indent += 1;
+
+	for ( ; childp; childp = nextp) {
+	    for (nextp = childp->next; nextp; nextp = nextp->next)
+		if (nextp->type == XML_ELEMENT_NODE
+			&& !yangWriteNameIs(nextp, argument, iargument))
+		    break;
+
+	    yangJsonWriteNode(ybp, childp, nextp != NULL);
+	}
+
+	ybp->yb_indent -= 1;
+	yangBufAddChar(ybp, ']');
+	yangBufNewline(ybp);
+    }
+
+    ybp->yb_indent -= 1;
+    yangBufAdd(ybp, "},", more ? 2 : 1);
+    yangBufNewline(ybp);
+
+    xmlFreeAndEasy(alloc);
+}
+
+/*
+ * Tree diagrams, in the style of RFC 8340, showing the data nodes of
+ * a module with their access, cardinality, keys and types:
+ *
+ *     module: example
+ *       +--rw system
+ *          +--rw name?      string
+ *          +--rw server* [address]
+ *             +--rw address    string
+ */
+
+/* Kinds of line in a tree diagram */
+#define YTK_NONE	0	/* Not shown */
+#define YTK_DATA	1	/* Data node (rw or ro) */
+#define YTK_CASE	2	/* Case of a choice */
+#define YTK_RPC		3	/* RPC */
+#define YTK_NOTIF	4	/* Notification */
+#define YTK_INPUT	5	/* RPC input */
+#define YTK_OUTPUT	6	/* RPC output */
+
+static int
+yangTreeKind (xmlNodePtr nodep)
+{
+    static const struct {
+	const char *name;
+	int kind;
+    } kinds[] = {
+	{ YS_ANYXML, YTK_DATA },
+	{ YS_CASE, YTK_CASE },
+	{ YS_CHOICE, YTK_DATA },
+	{ YS_CONTAINER, YTK_DATA },
+	{ YS_INPUT, YTK_INPUT },
+	{ YS_LEAF, YTK_DATA },
+	{ YS_LEAF_LIST, YTK_DATA },
+	{ YS_LIST, YTK_DATA },
+	{ YS_NOTIFICATION, YTK_NOTIF },
+	{ YS_OUTPUT, YTK_OUTPUT },
+	{ YS_RPC, YTK_RPC },
+	{ NULL, YTK_NONE }
+    };
+    int i;
+
+    if (nodep->type != XML_ELEMENT_NODE || (nodep->ns
+	    && !streq((const char *) nodep->ns->href, YIN_URI)))
+	return YTK_NONE;
+
+    for (i = 0; kinds[i].name; i++)
+	if (streq(kinds[i].name, (const char *) nodep->name))
+	    return kinds[i].kind;
+
+    return YTK_NONE;
+}
+
+/*
+ * Return the argument of a node's substatement (an attribute, since
+ * none of those we care about are yin-elements), to be xmlFree'd
+ */
+static char *
+yangTreeSubArg (xmlNodePtr nodep, const char *name, const char *attrib)
+{
+    xmlNodePtr childp;
+
+    for (childp = nodep->children; childp; childp = childp->next)
+	if (childp->type == XML_ELEMENT_NODE
+		&& streq((const char *) childp->name, name))
+	    return slaxGetAttrib(childp, attrib);
+
+    return NULL;
+}
+
+static int
+yangTreeSubIs (xmlNodePtr nodep, const char *name, const char *value)
 {
-    slax_writer_t *swp = slaxGetWriter(func, data);
-    int rc = yangWriteNode(swp, nodep, flags);
+    char *arg = yangTreeSubArg(nodep, name, YS_VALUE);
+    int rc = (arg && streq(arg, value));
 
-    slaxWriteNewline(swp, 0);
+    xmlFreeAndEasy(arg);
+    return rc;
+}
 
-    slaxFreeWriter(swp);
+/*
+ * Is the leaf one of its list's keys?
+ */
+static int
+yangTreeIsKey (xmlNodePtr nodep, const char *name)
+{
+    xmlNodePtr parent = nodep->parent;
+    char *keys, *cp;
+    size_t len = strlen(name);
+    int rc = FALSE;
+
+    if (parent == NULL || !streq((const char *) parent->name, YS_LIST))
+	return FALSE;
+
+    keys = yangTreeSubArg(parent, YS_KEY, YS_VALUE);
+    if (keys == NULL)
+	return FALSE;
+
+    for (cp = keys; *cp; cp += strcspn(cp, " \t\n")) {
+	cp += strspn(cp, " \t\n");
+	if (strncmp(cp, name, len) == 0 && strchr(" \t\n", cp[len])) {
+	    rc = TRUE;
+	    break;
+	}
+    }
+
+    xmlFree(keys);
     return rc;
 }
 
-int
-yangWriteDoc (slaxWriterFunc_t func, void *data, xmlDocPtr docp,
+/*
+ * The name column of a line: the node's name, decorated to show
+ * choices, cases, presence containers and cardinality
+ */
+static void
+yangTreeLabel (xmlNodePtr nodep, int kind, char *buf, size_t bufsiz)
+{
+    const char *stmt = (const char *) nodep->name;
+    char *name = slaxGetAttrib(nodep, YS_NAME);
+    const char *suffix = "";
+
+    if (streq(stmt, YS_LIST) || streq(stmt, YS_LEAF_LIST))
+	suffix = "*";
+    else if (streq(stmt, YS_CONTAINER)) {
+	char *presence = yangTreeSubArg(nodep, YS_PRESENCE, YS_VALUE);
+	if (presence)
+	    suffix = "!";
+	xmlFreeAndEasy(presence);
+    } else if ((streq(stmt, YS_LEAF) && !yangTreeIsKey(nodep, name ?: ""))
+	       || streq(stmt, YS_CHOICE) || streq(stmt, YS_ANYXML)) {
+	if (!yangTreeSubIs(nodep, YS_MANDATORY, "true"))
+	    suffix = "?";
+    }
+
+    if (kind == YTK_CASE)
+	snprintf(buf, bufsiz, ":(%s)", name ?: "");
+    else if (streq(stmt, YS_CHOICE))
+	snprintf(buf, bufsiz, "(%s)%s", name ?: "", suffix);
+    else
+	snprintf(buf, bufsiz, "%s%s", name ?: stmt, suffix);
+
+    xmlFreeAndEasy(name);
+}
+
+static void
+yangTreeWriteChildren (yang_buf_t *ybp, xmlNodePtr parent,
+		       const char *prefix, const char *access);
+
+static void
+yangTreeWriteNode (yang_buf_t *ybp, xmlNodePtr nodep, int kind,
+		   const char *prefix, int more, const char *access,
+		   size_t width)
+{
+    const char *stmt = (const char *) nodep->name;
+    char label[BUFSIZ];
+    const char *flags;
+
+    switch (kind) {
+    case YTK_RPC:
+	flags = "-x ";
+	break;
+    case YTK_NOTIF:
+	flags = "-n ";
+	break;
+    case YTK_INPUT:
+	flags = "-w ";
+	access = "-w";
+	break;
+    case YTK_OUTPUT:
+	flags = "ro ";
+	access = "ro";
+	break;
+    case YTK_CASE:
+	flags = "";
+	break;
+    default:
+	if (yangTreeSubIs(nodep, YS_CONFIG, "false"))
+	    access = "ro";
+	flags = access;
+    }
+
+    yangTreeLabel(nodep, kind, label, sizeof(label));
+
+    yangBufAddString(ybp, prefix);
+    yangBufAdd(ybp, "+--", 3);
+    yangBufAddString(ybp, flags);
+    if (kind == YTK_DATA)
+	yangBufAddChar(ybp, ' ');
+    yangBufAddString(ybp, label);
+
+    if (streq(stmt, YS_LEAF) || streq(stmt, YS_LEAF_LIST)) {
+	char *type = yangTreeSubArg(nodep, YS_TYPE, YS_NAME);
+	if (type) {
+	    size_t len = strlen(label);
+	    int pad = (width > len) ? width - len : 0;
+
+	    yangBufPad(ybp, pad + 3);
+	    yangBufAddString(ybp, type);
+	    xmlFree(type);
+	}
+
+    } else if (streq(stmt, YS_LIST)) {
+	char *keys = yangTreeSubArg(nodep, YS_KEY, YS_VALUE);
+	if (keys) {
+	    yangBufAdd(ybp, " [", 2);
+	    yangBufAddString(ybp, keys);
+	    yangBufAddChar(ybp, ']');
+	    xmlFree(keys);
+	}
+    }
+
+    yangBufNewline(ybp);
+
+    size_t len = strlen(prefix);
+    char child_prefix[len + 4];
+
+    snprintf(child_prefix, sizeof(child_prefix), "%s%s",
+	     prefix, more ? "|  " : "   ");
+    yangTreeWriteChildren(ybp, nodep, child_prefix, access);
+}
+
+/*
+ * Sibling leaves' types line up, so find the widest leaf label
+ */
+static size_t
+yangTreeWidth (xmlNodePtr parent)
+{
+    xmlNodePtr nodep;
+    char label[BUFSIZ];
+    size_t width = 0, len;
+
+    for (nodep = parent->children; nodep; nodep = nodep->next) {
+	if (yangTreeKind(nodep) != YTK_DATA
+		|| !(streq((const char *) nodep->name, YS_LEAF)
+		     || streq((const char *) nodep->name, YS_LEAF_LIST)))
+	    continue;
+
+	yangTreeLabel(nodep, YTK_DATA, label, sizeof(label));
+	len = strlen(label);
+	if (width < len)
+	    width = len;
+    }
+
+    return width;
+}
+
+static void
+yangTreeWriteChildren (yang_buf_t *ybp, xmlNodePtr parent,
+		       const char *prefix, const char *access)
+{
+    xmlNodePtr nodep, nextp;
+    size_t width = yangTreeWidth(parent);
+    int kind;
+
+    for (nodep = parent->children; nodep; nodep = nextp) {
+	for (nextp = nodep->next; nextp; nextp = nextp->next)
+	    if (yangTreeKind(nextp) != YTK_NONE)
+		break;
+
+	kind = yangTreeKind(nodep);
+	if (kind != YTK_NONE)
+	    yangTreeWriteNode(ybp, nodep, kind, prefix, nextp != NULL,
+			      access, width);
+    }
+}
+
+/*
+ * Write the tree diagram for a module: its data nodes, then its
+ * RPCs and notifications, each in their own section
+ */
+static void
+yangTreeWriteModule (yang_buf_t *ybp, xmlNodePtr modp)
+{
+    static const struct {
+	int kind;
+	const char *title;
+    } sections[] = {
+	{ YTK_DATA, NULL },
+	{ YTK_RPC, "rpcs" },
+	{ YTK_NOTIF, "notifications" },
+	{ YTK_NONE, NULL },
+    };
+    xmlNodePtr nodep, nextp;
+    char *name = slaxGetAttrib(modp, YS_NAME);
+    const char *prefix;
+    size_t width = yangTreeWidth(modp);
+    int i, kind;
+
+    yangBufAddString(ybp, (const char *) modp->name);
+    yangBufAdd(ybp, ": ", 2);
+    yangBufAddString(ybp, name ?: "");
+    yangBufNewline(ybp);
+    xmlFreeAndEasy(name);
+
+    for (i = 0; sections[i].kind != YTK_NONE; i++) {
+	for (nodep = modp->children; nodep; nodep = nodep->next)
+	    if (yangTreeKind(nodep) == sections[i].kind)
+		break;
+
+	if (nodep == NULL)
+	    continue;
+
+	prefix = "  ";
+	if (sections[i].title) {
+	    yangBufNewline(ybp);
+	    yangBufAdd(ybp, "  ", 2);
+	    yangBufAddString(ybp, sections[i].title);
+	    yangBufAddChar(ybp, ':');
+	    yangBufNewline(ybp);
+	    prefix = "    ";
+	}
+
+	for ( ; nodep; nodep = nextp) {
+	    for (nextp = nodep->next; nextp; nextp = nextp->next)
+		if (yangTreeKind(nextp) == sections[i].kind)
+		    break;
+
+	    kind = yangTreeKind(nodep);
+	    if (kind == sections[i].kind)
+		yangTreeWriteNode(ybp, nodep, kind, prefix, nextp != NULL,
+				  "rw", width);
+	}
+    }
+}
+
+/*
+ * Parallel serialization.  A large document is cut into parts: runs
+ * of sibling subtrees ("jobs"), and the text between them (the
+ * headers and closing braces of their ancestors).  The main thread
+ * writes the text parts while planning; workers write the jobs, each
+ * into its own buffer at the right indent; and the parts are then
+ * sent out in order.  Since every part is written by the same code
+ * as the serial writer, the output is byte-identical.
+ *
+ * We split at the children of the root, or one level further down
+ * when there are too few of them to keep the workers busy.
+ */
+#ifdef YANG_HAVE_THREADS
+#define YANG_WRITE_SPLIT_DEPTH	2 /* Deepest level we split at */
+#define YANG_WRITE_JOBS_PER_THREAD 4 /* Jobs per thread, for balance */
+#define YANG_WRITE_MIN_JOBS	2 /* Fewer jobs aren't worth threads */
+
+typedef struct yang_write_part_s {
+    yang_buf_t ywp_buf;		/* Text of this part */
+    xmlNodePtr ywp_first;	/* First sibling to write (NULL for text) */
+    xmlNodePtr ywp_end;		/* Sibling after the last one (or NULL) */
+    const char *ywp_except;	/* Argument element to skip */
+    const xmlChar *ywp_iexcept;	/* Interned form of ywp_except */
+} yang_write_part_t;
+
+typedef struct yang_write_batch_s {
+    yang_write_part_t *ywb_parts; /* Parts, in output order */
+    unsigned ywb_count;		/* Number of parts */
+    unsigned ywb_max;		/* Allocated size of ywb_parts */
+    unsigned ywb_jobs;		/* Number of parts that are jobs */
+    unsigned ywb_nthreads;	/* Threads we'll write with */
+    unsigned ywb_next;		/* Next part to hand out */
+    unsigned ywb_flags;		/* Flags from the caller (YWF_*) */
+    yang_stmt_cache_t *ywb_stmts; /* Main thread's statement cache */
+    yang_session_t *ywb_session; /* Caller's session */
+    pthread_mutex_t ywb_mutex;	/* Protects ywb_next */
+} yang_write_batch_t;
+
+static yang_write_part_t *
+yangWritePartAdd (yang_write_batch_t *ywbp, unsigned indent)
+{
+    yang_write_part_t *ywpp;
+
+    if (ywbp->ywb_count >= ywbp->ywb_max) {
+	unsigned max = ywbp->ywb_max ? ywbp->ywb_max * 2 : 32;
+
+	ywpp = xmlRealloc(ywbp->ywb_parts, max * sizeof(*ywpp));
+	if (ywpp == NULL)
+	    return NULL;
+
+	ywbp->ywb_parts = ywpp;
+	ywbp->ywb_max = max;
+    }
+
+    ywpp = &ywbp->ywb_parts[ywbp->ywb_count++];
+    bzero(ywpp, sizeof(*ywpp));
+    yangBufInit(&ywpp->ywp_buf, -1);
+    ywpp->ywp_buf.yb_indent = indent;
+
+    return ywpp;
+}
+
+/*
+ * Return a buffer for text at the given indent, continuing the last
+ * part if it's text.  The pointer is only good until the next part
+ * is added.
+ */
+static yang_buf_t *
+yangWriteText (yang_write_batch_t *ywbp, unsigned indent)
+{
+    yang_write_part_t *ywpp = NULL;
+
+    if (ywbp->ywb_count)
+	ywpp = &ywbp->ywb_parts[ywbp->ywb_count - 1];
+
+    if (ywpp == NULL || ywpp->ywp_first)
+	ywpp = yangWritePartAdd(ywbp, indent);
+    if (ywpp == NULL)
+	return NULL;
+
+    ywpp->ywp_buf.yb_indent = indent;
+    ywpp->ywp_buf.yb_stmts = ywbp->ywb_stmts;
+    return &ywpp->ywp_buf;
+}
+
+/*
+ * Cut a node's children into runs of roughly equal length, each one
+ * a job
+ */
+static int
+yangWriteSplitJobs (yang_write_batch_t *ywbp, xmlNodePtr parent,
+		    unsigned count, const char *except,
+		    const xmlChar *iexcept, unsigned indent)
+{
+    unsigned njobs = ywbp->ywb_nthreads * YANG_WRITE_JOBS_PER_THREAD;
+    unsigned per, seen = 0;
+    yang_write_part_t *ywpp = NULL;
+    xmlNodePtr nodep;
+
+    if (njobs > count)
+	njobs = count;
+    per = (count + njobs - 1) / njobs;
+
+    for (nodep = parent->children; nodep; nodep = nodep->next) {
+	if (nodep->type != XML_ELEMENT_NODE
+		|| (except && yangWriteNameIs(nodep, except, iexcept)))
+	    continue;
+
+	if (seen++ % per == 0) {
+	    if (ywpp)
+		ywpp->ywp_end = nodep;
+
+	    ywpp = yangWritePartAdd(ywbp, indent);
+	    if (ywpp == NULL)
+		return -1;
+
+	    ywpp->ywp_first = nodep;
+	    ywpp->ywp_except = except;
+	    ywpp->ywp_iexcept = iexcept;
+	    ywbp->ywb_jobs += 1;
+	}
+    }
+
+    return 0;
+}
+
+/*
+ * Plan the writing of a node, as yangWriteNode would write it: its
+ * own text goes in a text part, and its children become jobs or are
+ * planned in turn.
+ */
+static int
+yangWriteSplit (yang_write_batch_t *ywbp, xmlNodePtr nodep, unsigned depth)
+{
+    yang_buf_t *ybp = yangWriteText(ywbp, depth);
+    const char *argument;
+    const xmlChar *iargument;
+    const char *data;
+    char *alloc;
+    int ignore_children, rc = 0;
+
+    if (ybp == NULL)
+	return -1;
+
+    data = yangWriteArgument(ybp->yb_stmts, nodep, &argument, &iargument,
+			     &ignore_children, &alloc);
+
+    yangBufAddString(ybp, (const char *) nodep->name);
+
+    if (data) {
+	yangBufAddChar(ybp, ' ');
+	yangWriteString(ybp, data);
+    }
+
+    if (!ignore_children && yangWriteHasChildNodes(nodep)) {
+	xmlNodePtr childp;
+	unsigned count = 0;
+
+	yangBufAdd(ybp, " {", 2);
+	yangBufNewline(ybp);
+
+	for (childp = nodep->children; childp; childp = childp->next)
+	    if (childp->type == XML_ELEMENT_NODE
+		    && !yangWriteNameIs(childp, argument, iargument))
+		count += 1;
+
+	if (depth + 1 < YANG_WRITE_SPLIT_DEPTH
+		&& count < ywbp->ywb_nthreads) {
+	    for (childp = nodep->children; childp && rc == 0;
+		 childp = childp->next) {
+		if (childp->type == XML_ELEMENT_NODE
+			&& !yangWriteNameIs(childp, argument, iargument))
+		    rc = yangWriteSplit(ywbp, childp, depth + 1);
+	    }
+	} else if (count) {
+	    rc = yangWriteSplitJobs(ywbp, nodep, count, argument, iargument,
+				    depth + 1);
+	}
+
+	ybp = yangWriteText(ywbp, depth);
+	if (ybp == NULL)
+	    rc = -1;
+	else
+	    yangBufAddChar(ybp, '}');
+    } else {
+	yangBufAddChar(ybp, ';');
+    }
+
+    if (ybp)
+	yangBufNewline(ybp);
+
+    xmlFreeAndEasy(alloc);
+    return rc;
+}
+
+static void *
+yangWriteWorker (void *arg)
+{
+    yang_write_batch_t *ywbp = arg;
+    yang_session_t *old = yangSessionSet(ywbp->ywb_session);
+    yang_write_part_t *ywpp;
+    yang_stmt_cache_t ysc;
+    xmlNodePtr nodep;
+    unsigned idx;
+
+    yangStmtCacheInit(&ysc);
+
+    for (;;) {
+	pthread_mutex_lock(&ywbp->ywb_mutex);
+	idx = ywbp->ywb_next++;
+	pthread_mutex_unlock(&ywbp->ywb_mutex);
+
+	if (idx >= ywbp->ywb_count)
+	    break;
+
+	ywpp = &ywbp->ywb_parts[idx];
+	if (ywpp->ywp_first == NULL)
+	    continue;
+
+	ywpp->ywp_buf.yb_stmts = &ysc;
+	for (nodep = ywpp->ywp_first; nodep != ywpp->ywp_end;
+	     nodep = nodep->next) {
+	    if (nodep->type != XML_ELEMENT_NODE
+		    || (ywpp->ywp_except
+			&& yangWriteNameIs(nodep, ywpp->ywp_except,
+					   ywpp->ywp_iexcept)))
+		continue;
+	    yangWriteNode(&ywpp->ywp_buf, nodep, ywbp->ywb_flags);
+	}
+	ywpp->ywp_buf.yb_stmts = NULL;
+    }
+
+    yangSessionSet(old);
+    return NULL;
+}
+
+/*
+ * Write a node using the session's worker threads.  Returns 1 if the
+ * node is too small to be worth it, or couldn't be split, leaving the
+ * caller to write it.
+ */
+static int
+yangWriteParallel (yang_buf_t *ybp, xmlNodePtr nodep, unsigned flags)
+{
+    yang_write_batch_t batch;
+    unsigned i, nthreads = yangSession()->ysn_jobs;
+    int rc;
+
+    if (nthreads <= 1 || (flags & YWF_SERIAL))
+	return 1;
+
+    bzero(&batch, sizeof(batch));
+    batch.ywb_nthreads = nthreads;
+    batch.ywb_flags = flags;
+    batch.ywb_stmts = ybp->yb_stmts;
+    batch.ywb_session = yangSession();
+
+    /*
+     * The split only fills the batch's buffers, so if it can't be
+     * planned (no memory), the serial writer can still have a go
+     */
+    rc = yangWriteSplit(&batch, nodep, 0);
+    if (rc < 0 || batch.ywb_jobs < YANG_WRITE_MIN_JOBS)
+	rc = 1;
+
+    if (rc == 0) {
+	pthread_t threads[nthreads];
+	unsigned started = 0;
+
+	if (nthreads > batch.ywb_jobs)
+	    nthreads = batch.ywb_jobs;
+
+	pthread_mutex_init(&batch.ywb_mutex, NULL);
+
+	for (i = 1; i < nthreads; i++) {
+	    if (pthread_create(&threads[started], NULL,
+			       yangWriteWorker, &batch) != 0)
+		break;
+	    started += 1;
+	}
+
+	/* The caller's thread works too, and picks up any slack */
+	yangWriteWorker(&batch);
+
+	for (i = 0; i < started; i++)
+	    pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&batch.ywb_mutex);
+
+	/* The serial writer ends with a newline, so we do too */
+	yangBufNewline(&batch.ywb_parts[batch.ywb_count - 1].ywp_buf);
+
+	if (yangBufConcat(ybp, &batch.ywb_parts[0].ywp_buf, batch.ywb_count,
+			  sizeof(batch.ywb_parts[0])))
+	    rc = -1;
+    }
+
+    for (i = 0; i < batch.ywb_count; i++)
+	yangBufClean(&batch.ywb_parts[i].ywp_buf);
+    xmlFreeAndEasy(batch.ywb_parts);
+
+    return rc;
+}
+
+#else /* YANG_HAVE_THREADS */
+
+static inline int
+yangWriteParallel (yang_buf_t *ybp UNUSED, xmlNodePtr nodep UNUSED,
+		   unsigned flags UNUSED)
+{
+    return 1;			/* Always write serially */
+}
+
+#endif /* YANG_HAVE_THREADS */
+
+/*
+ * Write a node in the format the flags select.  Returns -1 if the
+ * output couldn't be written.
+ */
+static int
+yangWriteBuf (yang_session_t *ysnp, yang_buf_t *ybp, xmlNodePtr nodep,
 	      unsigned flags)
+{
+    yang_session_t *old = yangSessionEnter(ysnp);
+    yang_stmt_cache_t ysc;
+
+    yangStmtCacheInit(&ysc);
+    ybp->yb_stmts = &ysc;
+
+    if (flags & YWF_JSON) {
+	yangJsonWriteNode(ybp, nodep, FALSE);
+    } else if (flags & YWF_TREE) {
+	yangTreeWriteModule(ybp, nodep);
+    } else if (yangWriteParallel(ybp, nodep, flags) > 0) {
+	yangWriteNode(ybp, nodep, flags);
+	yangBufNewline(ybp);
+    }
+
+    ybp->yb_stmts = NULL;
+    yangSessionLeave(old);
+    return yangBufClean(ybp);
+}
+
+int
+yangWriteDocNode (yang_session_t *ysnp, slaxWriterFunc_t func, void *data,
+		  xmlNodePtr nodep, unsigned flags)
+{
+    yang_buf_t yb;
+
+    yangBufInitFunc(&yb, func, data);
+    return yangWriteBuf(ysnp, &yb, nodep, flags);
+}
+
+int
+yangWriteDoc (yang_session_t *ysnp, slaxWriterFunc_t func, void *data,
+	      xmlDocPtr docp, unsigned flags)
 {
     xmlNodePtr nodep = xmlDocGetRootElement(docp);
-    return yangWriteDocNode(func, data, nodep, flags);
+    return yangWriteDocNode(ysnp, func, data, nodep, flags);
+}
+
+/*
+ * Write straight to a file descriptor, in large writes
+ */
+int
+yangWriteDocFd (yang_session_t *ysnp, int fd, xmlDocPtr docp, unsigned flags)
+{
+    yang_buf_t yb;
+
+    yangBufInit(&yb, fd);
+    return yangWriteBuf(ysnp, &yb, xmlDocGetRootElement(docp), flags);
 }
@@ -0,0 +1,40 @@
+#!/bin/sh
+#
+# Copyright (c) 2014, Juniper Networks, Inc.
+# All rights reserved.
+# This SOFTWARE is licensed under the LICENSE provided in the
+# ../Copyright file. By downloading, installing, copying, or otherwise
+# using the SOFTWARE, you agree to be bound by the terms of that
+# LICENSE.
+#
+# Check the schema path index: evaluate schema.yang, list the nodes
+# the index finds, and resolve each line of schema.paths as a data
+# path and as a schema-node-id:
+#
+#     sh run.sh [yangc [yangschemapath]]
+#
+# yangschemapath is built by "make schema-path" in libyang.
+#
+
+DIR=`dirname $0`
+YANGC=${1:-yangc}
+SCHEMAPATH=${2:-$DIR/../../libyang/yangschemapath}
+TMP=${TMPDIR:-/tmp}/yangc-schema.$$
+
+trap 'rm -f $TMP.yin $TMP.out' 0
+
+if ! $YANGC -e $DIR/schema.yang $TMP.yin; then
+    echo "schema: yangc failed"
+    exit 1
+fi
+
+( $SCHEMAPATH $TMP.yin && $SCHEMAPATH $TMP.yin `cat $DIR/schema.paths` ) \
+    > $TMP.out
+
+if ! diff -u $DIR/schema.out $TMP.out; then
+    echo "schema: output differs"
+    exit 1
+fi
+
+echo "schema: ok"
+exit 0
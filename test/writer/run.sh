@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# Copyright (c) 2014, Juniper Networks, Inc.
+# All rights reserved.
+# This SOFTWARE is licensed under the LICENSE provided in the
+# ../Copyright file. By downloading, installing, copying, or otherwise
+# using the SOFTWARE, you agree to be bound by the terms of that
+# LICENSE.
+#
+# Check the YANG writer against the expected output for each module
+# here, writing serially and with threads:
+#
+#     sh run.sh [yangc]
+#
+# "-j 8" must give the same bytes as "-j 1"; parallel.yang is big
+# enough to be split, a level down from its three containers.
+#
+# The writer scans arguments with SSE2 where the compiler offers it;
+# to check the scalar scan, run this again against a yangc configured
+# with CFLAGS=-mno-sse2.  Both must give the same output.
+#
+
+YANGC=${1:-yangc}
+DIR=`dirname $0`
+TMP=${TMPDIR:-/tmp}/yangc-writer.$$
+STATUS=0
+
+trap 'rm -f $TMP' 0
+
+for file in $DIR/*.yang; do
+    base=`basename $file .yang`
+    for jobs in 1 8; do
+	if ! $YANGC -e --format yang -j $jobs -I $DIR $file $TMP; then
+	    echo "$base (-j $jobs): yangc failed"
+	    STATUS=1
+	elif ! diff -u $DIR/$base.out $TMP; then
+	    echo "$base (-j $jobs): output differs"
+	    STATUS=1
+	else
+	    echo "$base (-j $jobs): ok"
+	fi
+    done
+done
+
+exit $STATUS
@@ -0,0 +1,479 @@
+/*
+ * Copyright (c) 2014, Juniper Networks, Inc.
+ * All rights reserved.
+ * This SOFTWARE is licensed under the LICENSE provided in the
+ * ../Copyright file. By downloading, installing, copying, or otherwise
+ * using the SOFTWARE, you agree to be bound by the terms of that
+ * LICENSE.
+ */
+
+/*
+ * Batch evaluation.  "yangc --batch FILE source" compiles the source
+ * once and evaluates it for each variant listed in FILE, each with
+ * its own features, parameters and parameter files, writing each
+ * variant's result to its own output file.  The batch file holds one
+ * statement per line; each "variant" starts a new variant and the
+ * lines after it add to it:
+ *
+ *     # Comments and blank lines are ignored
+ *     variant out/platform-a.yang
+ *     feature foo
+ *     feature max-slot=8
+ *     param MAX_SLOT 8
+ *     param-file platform-a.params
+ *
+ * The command line's features, parameters and parameter files apply
+ * to every variant; a variant's own parameter wins over a command
+ * line parameter of the same name.
+ *
+ * The stylesheet is parsed once, and each variant's parameters are
+ * resolved into an overlay (see yangparams.c) in the main thread,
+ * before any evaluation starts.  The variants are then evaluated by a
+ * pool of --jobs threads, each transform with its own context against
+ * the shared, read-only stylesheet.  Every output is
+ * written by way of a temporary file, and errors are reported after
+ * all the variants are done, in batch file order, so the results
+ * don't depend on how the work was scheduled.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/queue.h>
+
+#include <libxml/tree.h>
+#include <libxml/hash.h>
+#include <libxml/parser.h>
+#include <libxslt/transform.h>
+#include <libxslt/xsltutils.h>
+
+#include <libslax/slaxconfig.h>
+#include <libslax/slax.h>
+#include <libslax/slaxdata.h>
+
+#include "yanginternals.h"
+#include <libyang/yang.h>
+#include <libyang/yangloader.h>
+#include <libyang/yangtrace.h>
+
+#include "yangc.h"
+
+#define BATCH_VARIANT	"variant"
+#define BATCH_FEATURE	"feature"
+#define BATCH_PARAM	"param"
+#define BATCH_PARAM_FILE "param-file"
+
+typedef struct batch_variant_s {
+    char *bv_output;		/* Output file */
+    unsigned bv_line;		/* Line number in the batch file */
+    slax_data_list_t bv_features; /* Features */
+    slax_data_list_t bv_params;	/* Name, quoted value pairs */
+    slax_data_list_t bv_param_files; /* Parameter files */
+    yang_overlay_t *bv_overlay;	/* Resolved parameters */
+    const char **bv_xparams;	/* Parameters for xsltApplyStylesheet */
+    const char *bv_error;	/* Failure (or NULL) */
+    int bv_errno;		/* errno for bv_error (or zero) */
+} batch_variant_t;
+
+typedef struct batch_s {
+    batch_variant_t **bt_variants; /* Array of variants */
+    unsigned bt_count;		/* Number of variants */
+    unsigned bt_next;		/* Next variant to hand out */
+    xsltStylesheetPtr bt_style;	/* The stylesheet */
+    int bt_format;		/* Output format (FORMAT_*) */
+    xmlDocPtr bt_input;		/* Common input document (or NULL) */
+    yang_session_t *bt_session;	/* Caller's session */
+#ifdef YANG_HAVE_THREADS
+    pthread_mutex_t bt_mutex;	/* Protects bt_next */
+#endif /* YANG_HAVE_THREADS */
+} batch_t;
+
+static void
+batch_free (batch_t *btp)
+{
+    batch_variant_t *bvp;
+    unsigned i;
+
+    for (i = 0; i < btp->bt_count; i++) {
+	bvp = btp->bt_variants[i];
+	xmlFreeAndEasy(bvp->bv_output);
+	slaxDataListClean(&bvp->bv_features);
+	slaxDataListClean(&bvp->bv_params);
+	slaxDataListClean(&bvp->bv_param_files);
+	xmlFreeAndEasy(bvp->bv_xparams);
+	yangOverlayFree(bvp->bv_overlay);
+	xmlFree(bvp);
+    }
+
+    if (btp->bt_style)
+	xsltFreeStylesheet(btp->bt_style);
+
+    xmlFreeAndEasy(btp->bt_variants);
+}
+
+static batch_variant_t *
+batch_add_variant (batch_t *btp, const char *output, unsigned line)
+{
+    batch_variant_t *bvp, **newp;
+
+    newp = xmlRealloc(btp->bt_variants,
+		      (btp->bt_count + 1) * sizeof(*btp->bt_variants));
+    if (newp == NULL)
+	return NULL;
+
+    btp->bt_variants = newp;
+
+    bvp = xmlMalloc(sizeof(*bvp));
+    if (bvp == NULL)
+	return NULL;
+
+    bzero(bvp, sizeof(*bvp));
+    slaxDataListInit(&bvp->bv_features);
+    slaxDataListInit(&bvp->bv_params);
+    slaxDataListInit(&bvp->bv_param_files);
+    bvp->bv_line = line;
+    bvp->bv_output = (char *) xmlStrdup((const xmlChar *) output);
+
+    btp->bt_variants[btp->bt_count++] = bvp;
+    return bvp->bv_output ? bvp : NULL;
+}
+
+/*
+ * Read the batch file.  Returns -1 (after complaining) on failure.
+ */
+static int
+batch_parse (batch_t *btp, const char *filename)
+{
+    char buf[BUFSIZ], *cp, *arg, *value;
+    batch_variant_t *bvp = NULL;
+    unsigned line = 0;
+    int rc = -1;
+    FILE *fp;
+
+    fp = fopen(filename, "r");
+    if (fp == NULL) {
+	warn("cannot open batch file '%s'", filename);
+	return -1;
+    }
+
+    yangDependAdd(filename);
+
+    while (fgets(buf, sizeof(buf), fp)) {
+	line += 1;
+
+	buf[strcspn(buf, "\r\n")] = '\0';
+	cp = buf + strspn(buf, " \t");
+	if (*cp == '\0' || *cp == '#')
+	    continue;
+
+	arg = cp + strcspn(cp, " \t");
+	if (*arg)
+	    *arg++ = '\0';
+	arg += strspn(arg, " \t");
+
+	if (*arg == '\0') {
+	    warnx("%s:%u: missing argument for '%s'", filename, line, cp);
+	    goto done;
+	}
+
+	if (streq(cp, BATCH_VARIANT)) {
+	    bvp = batch_add_variant(btp, arg, line);
+	    if (bvp == NULL) {
+		warnx("%s:%u: out of memory", filename, line);
+		goto done;
+	    }
+	    continue;
+	}
+
+	if (bvp == NULL) {
+	    warnx("%s:%u: '%s' outside of a variant", filename, line, cp);
+	    goto done;
+	}
+
+	if (streq(cp, BATCH_FEATURE)) {
+	    slaxDataListAddNul(&bvp->bv_features, arg);
+
+	} else if (streq(cp, BATCH_PARAM_FILE)) {
+	    slaxDataListAddNul(&bvp->bv_param_files, arg);
+
+	} else if (streq(cp, BATCH_PARAM)) {
+	    value = arg + strcspn(arg, " \t");
+	    if (*value)
+		*value++ = '\0';
+	    value += strspn(value, " \t");
+
+	    char *tvalue = quote_param(value);
+	    if (tvalue == NULL) {
+		warnx("%s:%u: out of memory", filename, line);
+		goto done;
+	    }
+
+	    slaxDataListAddNul(&bvp->bv_params, arg);
+	    slaxDataListAddNul(&bvp->bv_params, tvalue);
+	    xmlFree(tvalue);
+
+	} else {
+	    warnx("%s:%u: unknown statement '%s'", filename, line, cp);
+	    goto done;
+	}
+    }
+
+    if (btp->bt_count == 0)
+	warnx("%s: no variants", filename);
+    else
+	rc = 0;
+
+ done:
+    fclose(fp);
+    return rc;
+}
+
+/*
+ * Parse the stylesheet and resolve each variant's parameters: the
+ * command line's parameter files, the variant's, the command line's
+ * parameters and then the variant's, each layer over the last
+ */
+static int
+batch_prepare (batch_t *btp, xmlDocPtr sourcedoc, const char *sourcename,
+	       slax_data_list_t *params, slax_data_list_t *param_files,
+	       int indent)
+{
+    batch_variant_t *bvp;
+    xsltStylesheetPtr style;
+    unsigned i;
+    int rc = 0;
+
+    style = xsltParseStylesheetDoc(sourcedoc);
+    if (style == NULL || style->errors != 0) {
+	warnx("%d errors parsing source: '%s'",
+	      style ? style->errors : 1, sourcename);
+	if (style)
+	    xsltFreeStylesheet(style);
+	else
+	    xmlFreeDoc(sourcedoc);
+	return -1;
+    }
+
+    if (indent)
+	style->indent = 1;
+
+    btp->bt_style = style;
+
+    for (i = 0; i < btp->bt_count; i++) {
+	bvp = btp->bt_variants[i];
+
+	bvp->bv_overlay = yangOverlayCreate();
+	if (bvp->bv_overlay == NULL
+		|| add_overlay(bvp->bv_overlay, param_files, NULL)
+		|| add_overlay(bvp->bv_overlay, &bvp->bv_param_files, params)
+		|| add_overlay(bvp->bv_overlay, NULL, &bvp->bv_params)
+		|| (bvp->bv_xparams
+		    = yangOverlayParams(bvp->bv_overlay)) == NULL) {
+	    warnx("%s: cannot load parameters", bvp->bv_output);
+	    rc = -1;
+	}
+    }
+
+    return rc;
+}
+
+static void
+batch_fail (batch_variant_t *bvp, const char *error, int errnum)
+{
+    bvp->bv_error = error;
+    bvp->bv_errno = errnum;
+}
+
+/*
+ * Evaluate one variant.  This runs on a worker thread, so it must not
+ * touch anything the other workers can change, and it records any
+ * failure instead of reporting it.
+ */
+static void
+batch_evaluate (batch_t *btp, batch_variant_t *bvp)
+{
+    xsltStylesheetPtr style = btp->bt_style;
+    slax_data_node_t *dnp;
+    slax_data_list_t features;
+    xmlDocPtr indoc, res;
+    char tmp[MAXPATHLEN];
+    FILE *fp;
+    int fd, rc;
+
+    if (btp->bt_input) {
+	indoc = xmlCopyDoc(btp->bt_input, 1);
+    } else {
+	/* The command line's features, then the variant's */
+	slaxDataListInit(&features);
+	SLAXDATALIST_FOREACH(dnp, &btp->bt_session->ysn_features) {
+	    slaxDataListAddNul(&features, dnp->dn_data);
+	}
+	SLAXDATALIST_FOREACH(dnp, &bvp->bv_features) {
+	    slaxDataListAddNul(&features, dnp->dn_data);
+	}
+
+	indoc = yangFeaturesBuildDoc(&features, NULL);
+	slaxDataListClean(&features);
+    }
+
+    if (indoc == NULL) {
+	batch_fail(bvp, "cannot build input document", 0);
+	return;
+    }
+
+    res = xsltApplyStylesheet(style, indoc, bvp->bv_xparams);
+    xmlFreeDoc(indoc);
+
+    if (res == NULL) {
+	batch_fail(bvp, "evaluation failed", 0);
+	return;
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", bvp->bv_output);
+    fd = mkstemp(tmp);
+    if (fd < 0 || (fp = fdopen(fd, "w")) == NULL) {
+	batch_fail(bvp, "could not open output file", errno);
+	if (fd >= 0) {
+	    close(fd);
+	    unlink(tmp);
+	}
+	xmlFreeDoc(res);
+	return;
+    }
+
+    fchmod(fd, 0644);		/* mkstemp makes it private */
+
+    /* Variants are already spread over the threads */
+    rc = write_result(fp, res, style, btp->bt_format, YWF_SERIAL);
+    if (fclose(fp) != 0)
+	rc = -1;
+    xmlFreeDoc(res);
+
+    if (rc < 0) {
+	batch_fail(bvp, "could not write output file", errno);
+	unlink(tmp);
+    } else if (replace_output(tmp, bvp->bv_output) < 0) {
+	batch_fail(bvp, "could not write output file", errno);
+    }
+}
+
+static void *
+batch_worker (void *arg)
+{
+    batch_t *btp = arg;
+    unsigned idx;
+    yang_session_t *old = yangSessionSet(btp->bt_session);
+
+    for (;;) {
+#ifdef YANG_HAVE_THREADS
+	pthread_mutex_lock(&btp->bt_mutex);
+#endif /* YANG_HAVE_THREADS */
+	idx = btp->bt_next++;
+#ifdef YANG_HAVE_THREADS
+	pthread_mutex_unlock(&btp->bt_mutex);
+#endif /* YANG_HAVE_THREADS */
+
+	if (idx >= btp->bt_count)
+	    break;
+
+	batch_evaluate(btp, btp->bt_variants[idx]);
+    }
+
+    yangSessionSet(old);
+    return NULL;
+}
+
+static void
+batch_run (batch_t *btp)
+{
+    unsigned nthreads = yangSession()->ysn_jobs;
+
+    if (nthreads > btp->bt_count)
+	nthreads = btp->bt_count;
+
+    btp->bt_session = yangSession();
+
+    yangTrace(YTF_EVAL, "batch: %u variants, %u jobs",
+	      btp->bt_count, nthreads);
+
+#ifdef YANG_HAVE_THREADS
+    if (nthreads > 1) {
+	pthread_t threads[nthreads - 1];
+	unsigned i, started = 0;
+
+	pthread_mutex_init(&btp->bt_mutex, NULL);
+
+	for (i = 0; i < nthreads - 1; i++) {
+	    if (pthread_create(&threads[i], NULL, batch_worker, btp) != 0)
+		break;
+	    started += 1;
+	}
+
+	/* The caller's thread works too, and picks up any slack */
+	batch_worker(btp);
+
+	for (i = 0; i < started; i++)
+	    pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&btp->bt_mutex);
+	return;
+    }
+#endif /* YANG_HAVE_THREADS */
+
+    batch_worker(btp);
+}
+
+/*
+ * Evaluate the compiled source (which we consume) for every variant
+ * in the batch file.  Returns -1 if any variant failed.
+ */
+int
+batch_main (const char *batchfile, xmlDocPtr sourcedoc,
+	    const char *sourcename, xmlDocPtr indoc,
+	    slax_data_list_t *params, slax_data_list_t *param_files,
+	    int indent, int format)
+{
+    batch_variant_t *bvp;
+    batch_t batch;
+    unsigned i;
+    int rc = 0;
+
+    bzero(&batch, sizeof(batch));
+    batch.bt_input = indoc;
+    batch.bt_format = format;
+
+    if (batch_parse(&batch, batchfile) < 0) {
+	xmlFreeDoc(sourcedoc);
+	rc = -1;
+	goto done;
+    }
+
+    /* The stylesheet owns sourcedoc from here on */
+    if (batch_prepare(&batch, sourcedoc, sourcename, params,
+		      param_files, indent) < 0) {
+	rc = -1;
+	goto done;
+    }
+
+    batch_run(&batch);
+
+    for (i = 0; i < batch.bt_count; i++) {
+	bvp = batch.bt_variants[i];
+	if (bvp->bv_error == NULL)
+	    continue;
+
+	rc = -1;
+	if (bvp->bv_errno)
+	    warnx("%s:%u: %s: '%s': %s", batchfile, bvp->bv_line,
+		  bvp->bv_error, bvp->bv_output, strerror(bvp->bv_errno));
+	else
+	    warnx("%s:%u: %s: '%s'", batchfile, bvp->bv_line,
+		  bvp->bv_error, bvp->bv_output);
+    }
+
+ done:
+    batch_free(&batch);
+
+    return rc;
+}
@@ -8,12 +8,14 @@
  */
 
 #include <err.h>
+#include <errno.h>
 #include <time.h>
 #include <sys/time.h>
 #include <string.h>
 #include <time.h>
 #include <fcntl.h>
 #include <sys/param.h>
+#include <sys/stat.h>
 #include <sys/queue.h>
 #include <pwd.h>
 #include <sys/socket.h>
@@ -41,9 +43,11 @@
 #include <libyang/yangversion.h>
 #include <libyang/yangloader.h>
 #include <libyang/yangstmt.h>
+#include <libyang/yangtrace.h>
+
+#include "yangc.h"
 
 static slax_data_list_t plist;
-static int nbparams;
 static slax_data_list_t param_files;
 
 static int options = XSLT_PARSE_OPTIONS;
@@ -51,8 +55,13 @@ static int options = XSLT_PARSE_OPTIONS;
 static char *encoding;		/* Desired document encoding */
 
 static int opt_indent = TRUE;	/* Indent the output (pretty print) */
+static int opt_format = FORMAT_YIN; /* Format for evaluation results */
 static int opt_partial;		/* Parse partial contents */
 static int opt_debugger;	/* Invoke the debugger */
+static const char *opt_depend;	/* Write make dependencies here */
+static const char *opt_manifest; /* Build manifest, for skipping work */
+static const char *opt_batch;	/* Batch file of variants to evaluate */
+static const char *opt_blob;	/* Write a schema blob of the result here */
 
 /*
  * Shamelessly lifted from slaxproc.c
@@ -72,59 +81,222 @@ get_filename (const char *filename, char ***pargv, int outp)
     return filename;
 }
 
-static void
-mergeParamFile (xmlDocPtr docp UNUSED, xmlDocPtr sourcedoc UNUSED)
+/*
+ * Layer parameter files, then name/value pairs, onto an overlay.
+ * Either list may be NULL.  Returns -1 on failure.
+ */
+int
+add_overlay (yang_overlay_t *yovp, slax_data_list_t *files,
+	     slax_data_list_t *params)
+{
+    slax_data_node_t *dnp, *vdp;
+    int rc = 0;
+
+    if (files) {
+	SLAXDATALIST_FOREACH(dnp, files) {
+	    if (yangOverlayAddFile(yovp, dnp->dn_data))
+		rc = -1;
+	}
+    }
+
+    if (params) {
+	for (dnp = TAILQ_FIRST(params);
+	     dnp && (vdp = TAILQ_NEXT(dnp, dn_link));
+	     dnp = TAILQ_NEXT(vdp, dn_link)) {
+	    if (yangOverlaySet(yovp, dnp->dn_data, vdp->dn_data, NULL))
+		rc = -1;
+	}
+    }
+
+    return rc;
+}
+
+/*
+ * Quote a parameter value for XSLT, using whichever quote it doesn't
+ * contain.  Returns an xmlMalloc'd string.
+ */
+char *
+quote_param (const char *pvalue)
+{
+    int plen = strlen(pvalue);
+    char *tvalue = xmlMalloc(plen + 3);
+    char quote;
+
+    if (tvalue == NULL)
+	return NULL;
+
+    quote = strrchr(pvalue, '\"') ? '\'' : '\"';
+    tvalue[0] = quote;
+    memcpy(tvalue + 1, pvalue, plen);
+    tvalue[plen + 1] = quote;
+    tvalue[plen + 2] = '\0';
+
+    return tvalue;
+}
+
+/*
+ * Map a --format name to its FORMAT_* value, or -1
+ */
+int
+parse_format (const char *name)
 {
-    slaxLog("handleParams: %p %p", docp, sourcedoc);
+    static const char *names[] = { "yin", "yang", "json", "tree", NULL };
+    int i;
 
-    xmlNodePtr insp = sourcedoc->children->children;
-    xmlNodePtr nodep, newp;
+    for (i = 0; name && names[i]; i++)
+	if (streq(name, names[i]))
+	    return i;
 
-    for (nodep = docp->children->children; nodep; nodep = nodep->next) {
-	newp = xmlDocCopyNode(nodep, sourcedoc, 1);
-	xmlAddPrevSibling(insp, newp);
+    return -1;
+}
+
+/*
+ * Write an evaluation result, in one format.  The YANG writers go
+ * straight to the file descriptor when there is one.  The flags
+ * (YWF_*) are added to those for the format.  Returns -1 if the
+ * result couldn't be written; the caller reports it.
+ */
+int
+write_result (FILE *outfile, xmlDocPtr res, xsltStylesheetPtr source,
+	      int format, unsigned flags)
+{
+    static const unsigned format_flags[] = {
+	[ FORMAT_YANG ] = 0,
+	[ FORMAT_JSON ] = YWF_JSON,
+	[ FORMAT_TREE ] = YWF_TREE,
+    };
+    int rc, fd;
+
+    if (format == FORMAT_YIN) {
+	rc = (xsltSaveResultToFile(outfile, res, source) < 0) ? -1 : 0;
+    } else if ((fd = fileno(outfile)) < 0) {
+	rc = yangWriteDoc(NULL, (slaxWriterFunc_t) fprintf, outfile, res,
+			  flags | format_flags[format]);
+    } else {
+	fflush(outfile);
+	rc = yangWriteDocFd(NULL, fd, res, flags | format_flags[format]);
     }
+
+    if (fflush(outfile) != 0 || ferror(outfile))
+	rc = -1;
+
+    return rc ? -1 : 0;
 }
 
+/*
+ * Write an evaluation result as a schema blob.  Readers may have the
+ * old blob mapped, so it's replaced by renaming, never rewritten in
+ * place.  Returns -1 on failure.
+ */
 static int
-do_eval (xmlDocPtr sourcedoc, const char *sourcename, const char *input)
+write_blob (const char *output, xmlDocPtr res)
+{
+    char tmp[MAXPATHLEN];
+    int fd, rc;
+
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", output);
+    fd = mkstemp(tmp);
+    if (fd < 0) {
+	warn("could not open schema blob: '%s'", output);
+	return -1;
+    }
+
+    fchmod(fd, 0644);		/* mkstemp makes it private */
+    rc = yangBlobWrite(NULL, fd, res);
+    if (close(fd) < 0)
+	rc = -1;
+
+    if (rc < 0) {
+	warn("could not write schema blob: '%s'", output);
+	unlink(tmp);
+	return -1;
+    }
+
+    if (replace_output(tmp, output) < 0) {
+	warn("could not write schema blob: '%s'", output);
+	return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Write an evaluation result to the output file, by way of a
+ * temporary file, as write_output does for a compiled one.  With no
+ * output file, it goes to stdout.  A failed write leaves the old
+ * output alone.  Returns -1 on failure.
+ */
+int
+write_eval_output (const char *output, xmlDocPtr res,
+		   xsltStylesheetPtr source, int format)
+{
+    char tmp[MAXPATHLEN];
+    FILE *fp;
+    int fd, rc;
+
+    if (output == NULL || slaxFilenameIsStd(output)) {
+	if (write_result(stdout, res, source, format, 0) < 0) {
+	    warn("could not write output");
+	    return -1;
+	}
+	return 0;
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", output);
+    fd = mkstemp(tmp);
+    if (fd < 0 || (fp = fdopen(fd, "w")) == NULL) {
+	warn("could not open output file: '%s'", output);
+	if (fd >= 0) {
+	    close(fd);
+	    unlink(tmp);
+	}
+	return -1;
+    }
+
+    fchmod(fd, 0644);		/* mkstemp makes it private */
+    rc = write_result(fp, res, source, format, 0);
+
+    if (fclose(fp) != 0 || rc < 0) {
+	warn("could not write output file: '%s'", output);
+	unlink(tmp);
+	return -1;
+    }
+
+    if (replace_output(tmp, output) < 0) {
+	warn("could not write output file: '%s'", output);
+	return -1;
+    }
+
+    return 0;
+}
+
+static int
+do_eval (xmlDocPtr sourcedoc, const char *sourcename, const char *input,
+	 const char *output)
 {
     xmlDocPtr indoc;
     xmlDocPtr res = NULL;
     xsltStylesheetPtr source;
-    const char **params = alloca(nbparams * 2 * sizeof(*params) + 1);
-    slax_data_node_t *dnp;
-    int i = 0;
+    yang_overlay_t *overlay;
+    const char **params;
 
-    SLAXDATALIST_FOREACH(dnp, &plist) {
-	params[i++] = dnp->dn_data;
-    }
+    overlay = yangOverlayCreate();
+    if (overlay == NULL || add_overlay(overlay, &param_files, &plist) < 0)
+	errx(1, "cannot load parameters");
 
-    params[i] = NULL;
+    params = yangOverlayParams(overlay);
+    if (params == NULL)
+	errx(1, "out of memory");
 
     source = xsltParseStylesheetDoc(sourcedoc);
     if (source == NULL || source->errors != 0)
 	errx(1, "%d errors parsing source: '%s'",
 	     source ? source->errors : 1, sourcename);
 
-    SLAXDATALIST_FOREACH(dnp, &param_files) {
-	const char *name = dnp->dn_data;
-	FILE *fp = fopen(name, "r");
-	if (fp == NULL)
-	    err(1, "cannot open parameter file '%s'", name);
-
-	xmlDocPtr docp = yangLoadParams(name, fp, NULL);
-	if (docp) {
-	    mergeParamFile(docp, sourcedoc);
-	    xmlFreeDoc(docp);
-	}
-
-	fclose(fp);
-    }
-
-    if (input)
-	indoc = xmlReadFile(input, encoding, options);
-    else
+    if (input) {
+	yangDependAdd(input);
+	indoc = yangReadFile(input, encoding, options);
+    } else
 	indoc = yangFeaturesBuildInputDoc();
 
     if (indoc == NULL)
@@ -144,33 +316,192 @@ do_eval (xmlDocPtr sourcedoc, const char *sourcename, const char *input)
     }
 
     if (res) {
-	FILE *outfile = stdout;
+	if (write_eval_output(output, res, source, opt_format) < 0)
+	    exit(1);
 
-	xsltSaveResultToFile(outfile, res, source);
-	yangWriteDoc((slaxWriterFunc_t) fprintf, outfile, res, 0);
+	if (opt_blob && write_blob(opt_blob, res) < 0)
+	    exit(1);
 
 	xmlFreeDoc(res);
     }
 
     xmlFreeDoc(indoc);
     xsltFreeStylesheet(source);
+    xmlFree(params);
+    yangOverlayFree(overlay);
 
     return 0;
 }
 
 static int
-do_post (const char *name, const char *output UNUSED,
+do_post (const char *name, const char *output,
 	 const char *input, char **argv)
 {
     name = get_filename(name, &argv, -1);
+    output = get_filename(output, &argv, -1);
     
-    xmlDocPtr docp = xmlReadFile(name, NULL, XSLT_PARSE_OPTIONS);
+    xmlDocPtr docp = yangReadFile(name, NULL, XSLT_PARSE_OPTIONS);
     if (docp == NULL) {
 	errx(1, "cannot parse file: '%s'", name);
         return -1;
     }
 
-    return do_eval(docp, name, input);
+    return do_eval(docp, name, input, output);
+}
+
+/*
+ * Do two files have the same contents?
+ */
+static int
+same_contents (const char *one, const char *two)
+{
+    char buf1[BUFSIZ], buf2[BUFSIZ];
+    size_t len1, len2;
+    FILE *fp1, *fp2;
+    int same = FALSE;
+
+    fp1 = fopen(one, "r");
+    if (fp1 == NULL)
+	return FALSE;
+
+    fp2 = fopen(two, "r");
+    if (fp2 == NULL) {
+	fclose(fp1);
+	return FALSE;
+    }
+
+    for (;;) {
+	len1 = fread(buf1, 1, sizeof(buf1), fp1);
+	len2 = fread(buf2, 1, sizeof(buf2), fp2);
+	if (len1 != len2 || memcmp(buf1, buf2, len1) != 0)
+	    break;
+	if (len1 == 0) {
+	    same = TRUE;
+	    break;
+	}
+    }
+
+    fclose(fp1);
+    fclose(fp2);
+    return same;
+}
+
+/*
+ * Move a temporary file into place as the output, unless the output
+ * already has the same contents, so its timestamp doesn't trigger
+ * needless rebuilds of anything that depends on it.  The temporary
+ * file is removed either way.  Returns -1 (with errno) on failure.
+ */
+int
+replace_output (const char *tmp, const char *output)
+{
+    if (same_contents(tmp, output)) {
+	unlink(tmp);
+    } else if (rename(tmp, output) < 0) {
+	int save = errno;
+	unlink(tmp);
+	errno = save;
+	return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Dump a compiled document, formatted as slaxDumpToFd would, but
+ * through stdio so a failed write shows up.  Returns -1 on failure.
+ */
+static int
+dump_doc (FILE *fp, xmlDocPtr docp)
+{
+    int rc = (xmlDocFormatDump(fp, docp, 1) < 0) ? -1 : 0;
+
+    if (fflush(fp) != 0 || ferror(fp))
+	rc = -1;
+
+    return rc;
+}
+
+/*
+ * Write the compiled document to the output file, by way of a
+ * temporary file.  A failed write leaves the old output alone.
+ * Returns -1 on failure.
+ */
+int
+write_output (const char *output, xmlDocPtr docp)
+{
+    char tmp[MAXPATHLEN];
+    FILE *fp;
+    int fd, rc;
+
+    if (output == NULL || slaxFilenameIsStd(output)) {
+	if (dump_doc(stdout, docp) < 0) {
+	    warn("could not write output");
+	    return -1;
+	}
+	return 0;
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", output);
+    fd = mkstemp(tmp);
+    if (fd < 0) {
+	warn("could not open output file: '%s'", output);
+	return -1;
+    }
+
+    fchmod(fd, 0644);		/* mkstemp makes it private */
+    fp = fdopen(fd, "w");
+    if (fp == NULL) {
+	close(fd);
+	rc = -1;
+    } else {
+	rc = dump_doc(fp, docp);
+	if (fclose(fp) != 0)
+	    rc = -1;
+    }
+
+    if (rc < 0) {
+	warn("could not write output file: '%s'", output);
+	unlink(tmp);
+	return -1;
+    }
+
+    if (replace_output(tmp, output) < 0) {
+	warn("could not write output file: '%s'", output);
+	return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Hash the options that change what we write, for the manifest.  The
+ * library adds its own (features, include path and the like).  The
+ * manifest is keyed on the output alone, so the source and input
+ * names go in too; otherwise building the same output from another
+ * file would look current.
+ */
+static uint64_t
+manifest_options (const char *sourcename, const char *input, int full_eval)
+{
+    int flags[] = { full_eval, opt_format, opt_indent };
+    uint64_t hash = yangHash(YANG_HASH_INIT, flags, sizeof(flags));
+    slax_data_node_t *dnp;
+
+    hash = yangHashString(hash, sourcename);
+    hash = yangHashString(hash, input);
+
+    SLAXDATALIST_FOREACH(dnp, &plist) {
+	hash = yangHashString(hash, dnp->dn_data);
+    }
+
+    hash = yangHashString(hash, NULL);	/* Between the two lists */
+
+    SLAXDATALIST_FOREACH(dnp, &param_files) {
+	hash = yangHashString(hash, dnp->dn_data);
+    }
+
+    return hash;
 }
 
 static int
@@ -179,8 +510,10 @@ do_work (const char *name, const char *output, const char *input,
 {
     xmlDocPtr sourcedoc;
     const char *sourcename;
-    FILE *sourcefile, *outfile;
+    FILE *sourcefile;
     char buf[BUFSIZ];
+    int rc = 0, tracked;
+    uint64_t opthash = 0;
 
     sourcename = get_filename(name, &argv, -1);
     output = get_filename(output, &argv, -1);
@@ -188,31 +521,70 @@ do_work (const char *name, const char *output, const char *input,
     if (slaxFilenameIsStd(sourcename))
 	errx(1, "source file cannot be stdin");
 
+    /* Each variant names its own output */
+    if (opt_batch && !slaxFilenameIsStd(output))
+	errx(1, "--batch writes to each variant's output; no output allowed");
+
+    if (opt_blob && (!full_eval || opt_batch))
+	errx(1, "--emit-schema-blob needs a single evaluation (--evaluate)");
+
+    /*
+     * An output file, compiled or evaluated, can be tracked in the
+     * manifest.  A schema blob is a second output the manifest
+     * doesn't record, so it always means doing the work.
+     */
+    tracked = (output && !slaxFilenameIsStd(output) && opt_blob == NULL);
+    if (tracked && opt_manifest)
+	opthash = manifest_options(sourcename, input, full_eval);
+
+    if (tracked && opt_manifest
+	    && yangManifestIsCurrent(opt_manifest, output, opthash)) {
+	/* The manifest gave us the dependencies, so they're still right */
+	if (opt_depend)
+	    yangDependWrite(opt_depend, output);
+	return 0;
+    }
+
     sourcefile = slaxFindIncludeFile(sourcename, buf, sizeof(buf));
     if (sourcefile == NULL)
 	err(1, "file open failed for '%s'", sourcename);
 
-    sourcedoc = yangLoadFile(NULL, sourcename, sourcefile, NULL, 0);
+    sourcedoc = yangLoadFile(NULL, NULL, sourcename, sourcefile, 0);
     if (sourcedoc == NULL)
 	errx(1, "cannot parse: '%s'", sourcename);
     if (sourcefile != stdin)
 	fclose(sourcefile);
 
-    if (output == NULL || slaxFilenameIsStd(output))
-	outfile = stdout;
-    else {
-	outfile = fopen(output, "w");
-	if (outfile == NULL)
-	    err(1, "could not open output file: '%s'", output);
-    }
+    if (opt_batch) {
+	xmlDocPtr indoc = NULL;
 
-    if (full_eval) {
-	return do_eval(sourcedoc, sourcename, input);
-    } else {
-	slaxDumpToFd(fileno(outfile), sourcedoc, FALSE);
+	if (input) {
+	    yangDependAdd(input);
+	    indoc = yangReadFile(input, encoding, options);
+	    if (indoc == NULL)
+		errx(1, "unable to parse: '%s'", input);
+	}
+
+	rc = batch_main(opt_batch, sourcedoc, sourcename, indoc, &plist,
+			&param_files, opt_indent, opt_format);
+	if (indoc)
+	    xmlFreeDoc(indoc);
+	if (rc < 0)
+	    exit(1);
+
+    } else if (full_eval) {
+	rc = do_eval(sourcedoc, sourcename, input, output);
+    } else if (write_output(output, sourcedoc) < 0) {
+	exit(1);
     }
 
-    return 0;
+    if (opt_depend)
+	yangDependWrite(opt_depend, tracked ? output : sourcename);
+
+    if (tracked && opt_manifest)
+	yangManifestUpdate(opt_manifest, output, opthash);
+
+    return rc;
 }
 
 static int
@@ -229,6 +601,13 @@ do_evaluate (const char *name, const char *output,
     return do_work(name, output, input, argv, TRUE);
 }
 
+static int
+do_batch (const char *name, const char *output,
+	  const char *input, char **argv)
+{
+    return do_work(name, output, input, argv, TRUE);
+}
+
 static void
 print_version (void)
 {
@@ -249,7 +628,47 @@ print_version (void)
 static void
 print_help (void)
 {
-    fprintf(stderr, "Usage: yangc [options] [files]\n\n");
+    fprintf(stderr,
+"Usage: yangc [mode] [options] [files]\n"
+"  Modes:\n"
+"\t--compile OR -c: compile a YANG module into an XSLT script (default)\n"
+"\t--evaluate OR -e: compile and evaluate a module, giving YIN\n"
+"\t--post OR -p: evaluate a previously compiled script\n"
+"\t--batch <file>: compile once, then evaluate each variant in <file>\n"
+"\n"
+"  Options:\n"
+"\t--cache-dir <dir>: keep parsed modules in <dir> for reuse\n"
+"\t--client <socket> [options] <file> [<output>]: send a request\n"
+"\t    to a server\n"
+"\t--debug OR -d: use the libslax debugger\n"
+"\t--depend <file>: write a make rule for the output's dependencies\n"
+"\t--emit-schema-blob <file>: also write the evaluation result as a\n"
+"\t    schema blob to <file>\n"
+"\t--expand-uses: replace each uses with its grouping's contents\n"
+"\t--feature <name> OR -f <name>: enable a YANG feature\n"
+"\t--format <name>: write evaluation results as yin (default), yang,\n"
+"\t    json or tree\n"
+"\t--help OR -h: display this help message\n"
+"\t--include <dir> OR -I <dir>: search directory for modules\n"
+"\t--input <file> OR -i <file>: take input from the given file\n"
+"\t--jobs <n> OR -j <n>: use up to <n> threads to load modules and\n"
+"\t    write YANG output\n"
+"\t--log <file> OR -l <file>: write log messages to the given file\n"
+"\t--manifest <file>: skip the work if nothing changed since the last run\n"
+"\t--name <file> OR -n <file>: read the module from the given file\n"
+"\t--no-randomize: do not seed the random number generator\n"
+"\t--output <file> OR -o <file>: write output to the given file\n"
+"\t--param <name> <value> OR -a <name> <value>: pass a parameter\n"
+"\t--param-file <file> OR -P <file>: read parameters from a file\n"
+"\t--partial: parse partial contents\n"
+"\t--prune-features: drop content for features not given by --feature\n"
+"\t--serve <socket>: serve compile and evaluate requests on <socket>\n"
+"\t--trace <file> OR -t <file>: write trace data to a file\n"
+"\t--verbose OR -v: enable all debugging output (slaxLog)\n"
+"\t--verbose-only <list>: enable only the named trace categories\n"
+"\t    (comma-separated: parse, stmt, loader, writer, eval, all)\n"
+"\t--version OR -V: show version information (and exit)\n"
+"\t--yydebug OR -y: enable yacc-level debugging\n");
 }
 
 int
@@ -257,6 +676,7 @@ main (int argc UNUSED, char **argv)
 {
     char *cp;
     const char *input = NULL, *output = NULL, *name = NULL, *trace_file = NULL;
+    const char *serve_path = NULL;
     int (*func)(const char *, const char *, const char *, char **) = NULL;
     FILE *trace_fp = NULL;
     int randomize = 1;
@@ -275,33 +695,84 @@ main (int argc UNUSED, char **argv)
 	if (*cp != '-')
 	    break;
 
-	if (streq(cp, "--compile") || streq(cp, "-c")) {
+	if (streq(cp, "--batch")) {
+	    if (func)
+		errx(1, "only one action allowed");
+	    opt_batch = *++argv;
+	    if (opt_batch == NULL)
+		errx(1, "missing batch file name");
+	    func = do_batch;
+
+	} else if (streq(cp, "--cache-dir")) {
+	    cp = *++argv;
+	    if (cp == NULL)
+		errx(1, "missing cache directory");
+	    yangLoaderSetCacheDir(cp);
+
+	} else if (streq(cp, "--client")) {
+	    cp = *++argv;
+	    if (cp == NULL)
+		errx(1, "missing socket name");
+	    return client_main(cp, argv + 1);
+
+	} else if (streq(cp, "--compile") || streq(cp, "-c")) {
 	    if (func)
-		errx(1, "open one action allowed");
+		errx(1, "only one action allowed");
 	    func = do_compile;
 
 	} else if (streq(cp, "--debug") || streq(cp, "-d")) {
 	    opt_debugger = TRUE;
 
+	} else if (streq(cp, "--depend")) {
+	    opt_depend = *++argv;
+	    if (opt_depend == NULL)
+		errx(1, "missing dependency file name");
+
+	} else if (streq(cp, "--emit-schema-blob")) {
+	    opt_blob = *++argv;
+	    if (opt_blob == NULL)
+		errx(1, "missing schema blob file name");
+
 	} else if (streq(cp, "--evaluate") || streq(cp, "-e")) {
+	    if (func)
+		errx(1, "only one action allowed");
 	    func = do_evaluate;
 
+	} else if (streq(cp, "--expand-uses")) {
+	    yangLoaderSetExpandUses(TRUE);
+
 	} else if (streq(cp, "--feature") || streq(cp, "-f")) {
 	    yangFeatureAdd(*++argv);
 
+	} else if (streq(cp, "--format")) {
+	    opt_format = parse_format(*++argv);
+	    if (opt_format < 0)
+		errx(1, "missing or invalid format (yin, yang, json or tree)");
+
 	} else if (streq(cp, "--help") || streq(cp, "-h")) {
 	    print_help();
 	    return -1;
 
 	} else if (streq(cp, "--include") || streq(cp, "-I")) {
-	    slaxIncludeAdd(*++argv);
+	    yangIncludeAdd(*++argv);
 
 	} else if (streq(cp, "--input") || streq(cp, "-i")) {
 	    input = *++argv;
 
+	} else if (streq(cp, "--jobs") || streq(cp, "-j")) {
+	    cp = *++argv;
+	    if (cp == NULL || atoi(cp) <= 0)
+		errx(1, "missing or invalid job count");
+	    yangLoaderSetJobs(atoi(cp));
+
 	} else if (streq(cp, "--log") || streq(cp, "-l")) {
 	    opt_log_file = *++argv;
 
+	} else if (streq(cp, "--manifest")) {
+	    opt_manifest = *++argv;
+	    if (opt_manifest == NULL)
+		errx(1, "missing manifest file name");
+
 	} else if (streq(cp, "--name") || streq(cp, "-n")) {
 	    name = *++argv;
 
@@ -315,24 +786,14 @@ main (int argc UNUSED, char **argv)
 	    char *pname = *++argv;
 	    char *pvalue = *++argv;
 	    char *tvalue;
-	    char quote;
-	    int plen;
 
 	    if (pname == NULL || pvalue == NULL)
 		errx(1, "missing parameter value");
 
-	    plen = strlen(pvalue);
-	    tvalue = xmlMalloc(plen + 3);
+	    tvalue = quote_param(pvalue);
 	    if (tvalue == NULL)
 		errx(1, "out of memory");
 
-	    quote = strrchr(pvalue, '\"') ? '\'' : '\"';
-	    tvalue[0] = quote;
-	    memcpy(tvalue + 1, pvalue, plen);
-	    tvalue[plen + 1] = quote;
-	    tvalue[plen + 2] = '\0';
-
-	    nbparams += 1;
 	    slaxDataListAddNul(&plist, pname);
 	    slaxDataListAddNul(&plist, tvalue);
 
@@ -343,13 +804,29 @@ main (int argc UNUSED, char **argv)
 	    slaxDataListAddNul(&param_files, *++argv);
 
 	} else if (streq(cp, "--post") || streq(cp, "-p")) {
+	    if (func)
+		errx(1, "only one action allowed");
 	    func = do_post;
 
+	} else if (streq(cp, "--prune-features")) {
+	    yangFeaturesSetComplete(TRUE);
+
+	} else if (streq(cp, "--serve")) {
+	    serve_path = *++argv;
+	    if (serve_path == NULL)
+		errx(1, "missing socket name");
+
 	} else if (streq(cp, "--trace") || streq(cp, "-t")) {
 	    trace_file = *++argv;
 
 	} else if (streq(cp, "--verbose") || streq(cp, "-v")) {
 	    logger = TRUE;
+	    yangTraceEnable(YTF_ALL);
+
+	} else if (streq(cp, "--verbose-only")) {
+	    if (yangTraceEnableNames(*++argv))
+		errx(1, "invalid trace category: '%s'", *argv ?: "");
+	    logger = TRUE;
 
 	} else if (streq(cp, "--version") || streq(cp, "-V")) {
 	    print_version();
@@ -367,7 +844,7 @@ main (int argc UNUSED, char **argv)
 
     cp = getenv("SLAXPATH");
     if (cp)
-	slaxIncludeAddPath(cp);
+	yangIncludeAddPath(cp);
 
     /*
      * Seed the random number generator.  This is optional to allow
@@ -393,6 +870,8 @@ main (int argc UNUSED, char **argv)
 
 	slaxLogEnable(TRUE);
 	slaxLogToFile(fp);
+	if (!logger)
+	    yangTraceEnable(YTF_ALL);
 
     } else if (logger) {
 	slaxLogEnable(TRUE);
@@ -412,14 +891,19 @@ main (int argc UNUSED, char **argv)
 	slaxTraceToFile(trace_fp);
     }
 
-    if (func == NULL)
-	func = do_compile;
+    if (serve_path)
+	serve_main(serve_path);
+    else {
+	if (func == NULL)
+	    func = do_compile;
 
-    func(name, output, input, argv);
+	func(name, output, input, argv);
+    }
     
     if (trace_fp && trace_fp != stderr)
 	fclose(trace_fp);
 
+    yangSessionClean();
     slaxDynClean();
     xsltCleanupGlobals();
     xmlCleanupParser();
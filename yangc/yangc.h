@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2014, Juniper Networks, Inc.
+ * All rights reserved.
+ * This SOFTWARE is licensed under the LICENSE provided in the
+ * ../Copyright file. By downloading, installing, copying, or otherwise
+ * using the SOFTWARE, you agree to be bound by the terms of that
+ * LICENSE.
+ */
+
+/*
+ * Shared between yangc.c, yangbatch.c and yangserve.c
+ */
+
+int
+add_overlay (yang_overlay_t *yovp, slax_data_list_t *files,
+	     slax_data_list_t *params);
+
+char *
+quote_param (const char *pvalue);
+
+/* Formats for evaluation results (--format) */
+#define FORMAT_YIN	0	/* XML, as the transform produced it */
+#define FORMAT_YANG	1	/* YANG text */
+#define FORMAT_JSON	2	/* Statements as JSON objects */
+#define FORMAT_TREE	3	/* Tree diagram */
+
+int
+parse_format (const char *name);
+
+int
+write_result (FILE *outfile, xmlDocPtr res, xsltStylesheetPtr source,
+	      int format, unsigned flags);
+
+int
+write_eval_output (const char *output, xmlDocPtr res,
+		   xsltStylesheetPtr source, int format);
+
+int
+replace_output (const char *tmp, const char *output);
+
+int
+write_output (const char *output, xmlDocPtr docp);
+
+int
+batch_main (const char *batchfile, xmlDocPtr sourcedoc,
+	    const char *sourcename, xmlDocPtr indoc,
+	    slax_data_list_t *params, slax_data_list_t *param_files,
+	    int indent, int format);
+
+int
+serve_main (const char *path);
+
+int
+client_main (const char *path, char **argv);
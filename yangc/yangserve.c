@@ -0,0 +1,1050 @@
+/*
+ * Copyright (c) 2014, Juniper Networks, Inc.
+ * All rights reserved.
+ * This SOFTWARE is licensed under the LICENSE provided in the
+ * ../Copyright file. By downloading, installing, copying, or otherwise
+ * using the SOFTWARE, you agree to be bound by the terms of that
+ * LICENSE.
+ */
+
+/*
+ * The resident server.  "yangc --serve SOCKET" listens on a Unix
+ * domain socket for compile and evaluate requests, which are sent by
+ * "yangc --client SOCKET [options] source [output]".  Start-up costs
+ * (libxml2, libxslt and exslt initialization, the statement registry)
+ * are paid once, and the session's module cache keeps the parsed
+ * imports and includes from one request to the next.
+ *
+ * We also keep each source's compiled document, and the stylesheet
+ * built from it, with the size, mtime and inode of every file they
+ * were built from.  A request whose files are all unchanged reuses
+ * them.  A change to a file in the module cache or to an include
+ * directory flushes everything.  Files are known by absolute path, so
+ * clients in different directories share the caches; when the working
+ * directory changes, we only check that each cached module is still
+ * the one a search from the new directory would find.
+ *
+ * The features given at start-up apply to every request, with any the
+ * request adds.
+ *
+ * The client sends its working directory and its arguments as
+ * NUL-terminated strings, and shuts down its side of the socket.  We
+ * answer "status N [reason]\n", then "errors LEN\n" and LEN bytes of
+ * whatever the request wrote to stderr (parse errors and the like),
+ * followed by the output if no output file was given.  Requests are
+ * handled one at a time.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <libxml/tree.h>
+#include <libxml/hash.h>
+#include <libxml/parser.h>
+#include <libxslt/transform.h>
+#include <libxslt/xsltutils.h>
+
+#include <libslax/slaxconfig.h>
+#include <libslax/slax.h>
+#include <libslax/slaxdata.h>
+
+#include "yanginternals.h"
+#include <libyang/yang.h>
+#include <libyang/yangloader.h>
+#include <libyang/yangtrace.h>
+
+#include "yangc.h"
+
+#define SERVE_REQUEST_MAX (1024 * 1024) /* Largest request we'll read */
+
+typedef struct serve_stat_s {
+    struct timespec ss_mtime;	/* Modification time */
+    off_t ss_size;		/* Size */
+    ino_t ss_ino;		/* Inode (editors often replace files) */
+} serve_stat_t;
+
+typedef struct serve_dep_s {
+    char *svd_path;		/* File we read */
+    serve_stat_t svd_stat;	/* What it looked like */
+} serve_dep_t;
+
+typedef struct serve_entry_s {
+    xmlDocPtr se_doc;		/* Compiled source */
+    xsltStylesheetPtr se_style;	/* Stylesheet from se_doc (or NULL) */
+    serve_dep_t *se_deps;	/* Files se_doc was built from */
+    unsigned se_ndeps;		/* Number of se_deps */
+} serve_entry_t;
+
+typedef struct serve_request_s {
+    int sr_evaluate;		/* Evaluate (vs compile) */
+    const char *sr_source;	/* Source file */
+    const char *sr_output;	/* Output file (NULL means reply) */
+    const char *sr_input;	/* Input document (evaluate only) */
+    int sr_format;		/* Output format (evaluate only) */
+    slax_data_list_t sr_params;	/* Name, quoted value pairs */
+    slax_data_list_t sr_param_files; /* Parameter files */
+} serve_request_t;
+
+static xmlHashTablePtr serve_entries; /* Key -> serve_entry_t */
+static xmlHashTablePtr serve_watched; /* Absolute path -> serve_stat_t */
+static xmlHashTablePtr serve_modules; /* Cached module -> absolute path */
+static slax_data_list_t serve_features; /* Features given at start-up */
+static char serve_cwd[MAXPATHLEN]; /* Working directory of the cache */
+static volatile sig_atomic_t serve_done;
+
+static int
+serve_stat (const char *path, serve_stat_t *ssp)
+{
+    struct stat st;
+
+    if (stat(path, &st) < 0) {
+	bzero(ssp, sizeof(*ssp));
+	return -1;
+    }
+
+    ssp->ss_mtime = st.st_mtim;
+    ssp->ss_size = st.st_size;
+    ssp->ss_ino = st.st_ino;
+    return 0;
+}
+
+/*
+ * Has a file changed since we took its serve_stat_t?
+ */
+static int
+serve_changed (const char *path, serve_stat_t *ssp)
+{
+    serve_stat_t now;
+
+    serve_stat(path, &now);
+    return (now.ss_mtime.tv_sec != ssp->ss_mtime.tv_sec
+	    || now.ss_mtime.tv_nsec != ssp->ss_mtime.tv_nsec
+	    || now.ss_size != ssp->ss_size || now.ss_ino != ssp->ss_ino);
+}
+
+/*
+ * Make a path absolute, as seen from the current directory, so it
+ * means the same thing after the next client's chdir.  A path that
+ * can't be resolved is returned as is.
+ */
+static const char *
+serve_abspath (const char *path, char *buf)
+{
+    return realpath(path, buf) ?: path;
+}
+
+static void
+serve_entry_free (void *payload, const xmlChar *name UNUSED)
+{
+    serve_entry_t *sep = payload;
+    unsigned i;
+
+    if (sep->se_style)
+	xsltFreeStylesheet(sep->se_style);
+    if (sep->se_doc)
+	xmlFreeDoc(sep->se_doc);
+
+    for (i = 0; i < sep->se_ndeps; i++)
+	xmlFree(sep->se_deps[i].svd_path);
+    xmlFreeAndEasy(sep->se_deps);
+    xmlFree(sep);
+}
+
+static void
+serve_watched_free (void *payload, const xmlChar *name UNUSED)
+{
+    xmlFree(payload);
+}
+
+/*
+ * Drop everything we've cached
+ */
+static void
+serve_flush (const char *why)
+{
+    yangTrace(YTF_EVAL, "serve: flushing caches: %s", why);
+
+    if (serve_entries) {
+	xmlHashFree(serve_entries, serve_entry_free);
+	serve_entries = NULL;
+    }
+
+    if (serve_watched) {
+	xmlHashFree(serve_watched, serve_watched_free);
+	serve_watched = NULL;
+    }
+
+    if (serve_modules) {
+	xmlHashFree(serve_modules, serve_watched_free);
+	serve_modules = NULL;
+    }
+
+    yangModuleCacheClean();
+    yangIncludeIndexClean();
+}
+
+/*
+ * Start watching a path, if we aren't already
+ */
+static void
+serve_watch (const char *path)
+{
+    serve_stat_t *ssp;
+
+    if (serve_watched == NULL) {
+	serve_watched = xmlHashCreate(0);
+	if (serve_watched == NULL)
+	    return;
+    }
+
+    if (xmlHashLookup(serve_watched, (const xmlChar *) path))
+	return;
+
+    ssp = xmlMalloc(sizeof(*ssp));
+    if (ssp == NULL)
+	return;
+
+    serve_stat(path, ssp);
+    if (xmlHashAddEntry(serve_watched, (const xmlChar *) path, ssp))
+	xmlFree(ssp);
+}
+
+static void
+serve_module_key (yang_file_t *yfp, char *buf, size_t bufsiz)
+{
+    snprintf(buf, bufsiz, "%p", (void *) yfp);
+}
+
+/*
+ * Note the files the module cache holds and the include directories
+ * (whose mtime changes when a file is added or removed), as they are
+ * now.  Anything already watched keeps its original state.
+ */
+static void
+serve_record (void)
+{
+    yang_session_t *ysnp = yangSession();
+    slax_data_node_t *dnp;
+    yang_file_t *yfp;
+    char buf[PATH_MAX], key[32];
+    const char *path;
+
+    if (serve_modules == NULL) {
+	serve_modules = xmlHashCreate(0);
+	if (serve_modules == NULL)
+	    return;
+    }
+
+    TAILQ_FOREACH(yfp, &ysnp->ysn_modules, yf_link) {
+	serve_module_key(yfp, key, sizeof(key));
+	if (yfp->yf_path == NULL
+		|| xmlHashLookup(serve_modules, (const xmlChar *) key))
+	    continue;
+
+	/* Relative paths are relative to the directory it was loaded in */
+	path = serve_abspath(yfp->yf_path, buf);
+	serve_watch(path);
+
+	char *copy = (char *) xmlStrdup((const xmlChar *) path);
+	if (copy && xmlHashAddEntry(serve_modules, (const xmlChar *) key, copy))
+	    xmlFree(copy);
+    }
+
+    SLAXDATALIST_FOREACH(dnp, &ysnp->ysn_includes) {
+	serve_watch(serve_abspath(dnp->dn_data, buf));
+    }
+}
+
+static void
+serve_check_one (void *payload, void *data, const xmlChar *name)
+{
+    const char **changedp = data;
+
+    if (*changedp == NULL && serve_changed((const char *) name, payload))
+	*changedp = (const char *) name;
+}
+
+/*
+ * Look for changes in the watched files.  Any change flushes
+ * everything, since every compiled source may have merged or imported
+ * the file.
+ */
+static void
+serve_check (void)
+{
+    const char *changed = NULL;
+
+    if (serve_watched == NULL)
+	return;
+
+    xmlHashScan(serve_watched, serve_check_one, &changed);
+    if (changed) {
+	char why[PATH_MAX];
+
+	snprintf(why, sizeof(why), "%s", changed); /* Flush frees it */
+	serve_flush(why);
+    }
+}
+
+/*
+ * A new working directory can change what a module name finds, since
+ * "." is searched first and relative include directories move with
+ * it.  The cached modules are still good if a search from here finds
+ * the same file for each.
+ */
+static void
+serve_chdir (void)
+{
+    yang_session_t *ysnp = yangSession();
+    yang_file_t *yfp;
+    char buf[MAXPATHLEN], abs[PATH_MAX], key[32];
+    const char *was;
+    FILE *fp;
+
+    yangIncludeIndexClean();	/* It indexes "." */
+
+    TAILQ_FOREACH(yfp, &ysnp->ysn_modules, yf_link) {
+	serve_module_key(yfp, key, sizeof(key));
+	was = serve_modules ? xmlHashLookup(serve_modules,
+					    (const xmlChar *) key) : NULL;
+
+	fp = yangIncludeFind(yfp->yf_name, buf, sizeof(buf));
+	if (fp)
+	    fclose(fp);
+
+	if (was == NULL || fp == NULL
+		|| !streq(serve_abspath(buf, abs), was)) {
+	    serve_flush("working directory changed");
+	    return;
+	}
+    }
+}
+
+static int
+serve_entry_is_current (serve_entry_t *sep)
+{
+    unsigned i;
+
+    for (i = 0; i < sep->se_ndeps; i++) {
+	if (serve_changed(sep->se_deps[i].svd_path,
+			  &sep->se_deps[i].svd_stat)) {
+	    yangTrace(YTF_EVAL, "serve: '%s' changed",
+		      sep->se_deps[i].svd_path);
+	    return FALSE;
+	}
+    }
+
+    return TRUE;
+}
+
+/*
+ * Compile a source, recording the files it was built from
+ */
+static serve_entry_t *
+serve_entry_build (const char *source, FILE *fp)
+{
+    serve_entry_t *sep;
+    slax_data_node_t *dnp;
+    char buf[PATH_MAX];
+    unsigned count = 0;
+
+    sep = xmlMalloc(sizeof(*sep));
+    if (sep == NULL) {
+	fclose(fp);
+	return NULL;
+    }
+
+    bzero(sep, sizeof(*sep));
+
+    yangDependClean();
+    sep->se_doc = yangLoadFile(NULL, NULL, source, fp, 0);
+    fclose(fp);
+
+    if (sep->se_doc == NULL) {
+	serve_entry_free(sep, NULL);
+	return NULL;
+    }
+
+    SLAXDATALIST_FOREACH(dnp, &yangSession()->ysn_depends) {
+	count += 1;
+    }
+
+    sep->se_deps = xmlMalloc((count ?: 1) * sizeof(*sep->se_deps));
+    if (sep->se_deps) {
+	SLAXDATALIST_FOREACH(dnp, &yangSession()->ysn_depends) {
+	    serve_dep_t *sdp = &sep->se_deps[sep->se_ndeps];
+	    const char *path = serve_abspath(dnp->dn_data, buf);
+
+	    sdp->svd_path = (char *) xmlStrdup((const xmlChar *) path);
+	    if (sdp->svd_path == NULL)
+		break;
+	    serve_stat(sdp->svd_path, &sdp->svd_stat);
+	    sep->se_ndeps += 1;
+	}
+    }
+
+    return sep;
+}
+
+/*
+ * Find the entry for a source, building it if there's no current one.
+ * Entries are keyed by the source's absolute path.
+ */
+static serve_entry_t *
+serve_entry_get (const char *source)
+{
+    yang_session_t *ysnp = yangSession();
+    serve_entry_t *sep;
+    slax_data_node_t *dnp;
+    char buf[MAXPATHLEN], abs[PATH_MAX];
+    FILE *fp;
+
+    fp = slaxFindIncludeFile(source, buf, sizeof(buf));
+    if (fp == NULL)
+	return NULL;
+
+    const char *path = serve_abspath(buf, abs);
+    size_t len = strlen(path) + 1;
+
+    /* When features prune the compiled source, they're part of the key */
+    if (ysnp->ysn_features_complete) {
+	SLAXDATALIST_FOREACH(dnp, &ysnp->ysn_features) {
+	    len += strlen(dnp->dn_data) + 1;
+	}
+    }
+
+    char key[len];
+    char *cp = key;
+
+    cp += snprintf(cp, len, "%s", path);
+    if (ysnp->ysn_features_complete) {
+	SLAXDATALIST_FOREACH(dnp, &ysnp->ysn_features) {
+	    cp += snprintf(cp, len - (cp - key), "\n%s", dnp->dn_data);
+	}
+    }
+
+    if (serve_entries == NULL) {
+	serve_entries = xmlHashCreate(0);
+	if (serve_entries == NULL) {
+	    fclose(fp);
+	    return NULL;
+	}
+    }
+
+    sep = xmlHashLookup(serve_entries, (const xmlChar *) key);
+    if (sep) {
+	if (serve_entry_is_current(sep)) {
+	    yangTrace(YTF_EVAL, "serve: reusing '%s'", path);
+	    fclose(fp);
+	    return sep;
+	}
+
+	xmlHashRemoveEntry(serve_entries, (const xmlChar *) key,
+			   serve_entry_free);
+    }
+
+    yangTrace(YTF_EVAL, "serve: compiling '%s'", path);
+
+    sep = serve_entry_build(source, fp);
+    if (sep == NULL)
+	return NULL;
+
+    if (xmlHashAddEntry(serve_entries, (const xmlChar *) key, sep)) {
+	serve_entry_free(sep, NULL);
+	return NULL;
+    }
+
+    serve_record();		/* Note any newly loaded modules */
+    return sep;
+}
+
+/*
+ * Parse the arguments of a request, as yangc would
+ */
+static int
+serve_parse (serve_request_t *srp, char **argv, char *errbuf, size_t errsize)
+{
+    const char *name = NULL;
+    char *cp, *arg;
+
+    for ( ; *argv; argv++) {
+	cp = *argv;
+
+	if (*cp != '-')
+	    break;
+
+	if (streq(cp, "--compile") || streq(cp, "-c")) {
+	    srp->sr_evaluate = FALSE;
+	    continue;
+
+	} else if (streq(cp, "--evaluate") || streq(cp, "-e")) {
+	    srp->sr_evaluate = TRUE;
+	    continue;
+	}
+
+	arg = *++argv;
+	if (arg == NULL) {
+	    snprintf(errbuf, errsize, "missing argument for %s", cp);
+	    return -1;
+	}
+
+	if (streq(cp, "--feature") || streq(cp, "-f")) {
+	    yangFeatureAdd(arg);
+
+	} else if (streq(cp, "--format")) {
+	    srp->sr_format = parse_format(arg);
+	    if (srp->sr_format < 0) {
+		snprintf(errbuf, errsize, "invalid format: %s", arg);
+		return -1;
+	    }
+
+	} else if (streq(cp, "--input") || streq(cp, "-i")) {
+	    srp->sr_input = arg;
+
+	} else if (streq(cp, "--name") || streq(cp, "-n")) {
+	    name = arg;
+
+	} else if (streq(cp, "--output") || streq(cp, "-o")) {
+	    srp->sr_output = arg;
+
+	} else if (streq(cp, "--param") || streq(cp, "-a")) {
+	    char *pvalue = *++argv;
+	    if (pvalue == NULL) {
+		snprintf(errbuf, errsize, "missing parameter value");
+		return -1;
+	    }
+
+	    char *tvalue = quote_param(pvalue);
+	    if (tvalue == NULL) {
+		snprintf(errbuf, errsize, "out of memory");
+		return -1;
+	    }
+
+	    slaxDataListAddNul(&srp->sr_params, arg);
+	    slaxDataListAddNul(&srp->sr_params, tvalue);
+	    xmlFree(tvalue);
+
+	} else if (streq(cp, "--param-file") || streq(cp, "-P")) {
+	    slaxDataListAddNul(&srp->sr_param_files, arg);
+
+	} else {
+	    snprintf(errbuf, errsize, "option not supported by server: %s", cp);
+	    return -1;
+	}
+    }
+
+    if (name == NULL)
+	name = *argv ? *argv++ : NULL;
+    if (srp->sr_output == NULL && *argv)
+	srp->sr_output = *argv++;
+
+    if (name == NULL || slaxFilenameIsStd(name)) {
+	snprintf(errbuf, errsize, "missing source file");
+	return -1;
+    }
+
+    srp->sr_source = name;
+    if (srp->sr_output && slaxFilenameIsStd(srp->sr_output))
+	srp->sr_output = NULL;
+
+    return 0;
+}
+
+static int
+serve_compile (serve_request_t *srp, serve_entry_t *sep, FILE *payload)
+{
+    if (srp->sr_output)
+	return write_output(srp->sr_output, sep->se_doc);
+
+    fflush(payload);
+    slaxDumpToFd(fileno(payload), sep->se_doc, FALSE);
+    return 0;
+}
+
+/*
+ * Evaluate a compiled source, with the stylesheet kept with the entry
+ */
+static int
+serve_evaluate (serve_request_t *srp, serve_entry_t *sep, FILE *payload,
+		char *errbuf, size_t errsize)
+{
+    xsltStylesheetPtr style = sep->se_style;
+    yang_overlay_t *overlay;
+    const char **params = NULL;
+    xmlDocPtr indoc, res;
+    int rc = 0;
+
+    if (style == NULL) {
+	xmlDocPtr docp = xmlCopyDoc(sep->se_doc, 1);
+	if (docp == NULL) {
+	    snprintf(errbuf, errsize, "out of memory");
+	    return -1;
+	}
+
+	style = xsltParseStylesheetDoc(docp);
+	if (style == NULL || style->errors != 0) {
+	    snprintf(errbuf, errsize, "%d errors parsing source: '%s'",
+		     style ? style->errors : 1, srp->sr_source);
+	    if (style)
+		xsltFreeStylesheet(style);
+	    else
+		xmlFreeDoc(docp);
+	    return -1;
+	}
+
+	style->indent = 1;
+	sep->se_style = style;
+    }
+
+    overlay = yangOverlayCreate();
+    if (overlay == NULL
+	    || add_overlay(overlay, &srp->sr_param_files, &srp->sr_params)
+	    || (params = yangOverlayParams(overlay)) == NULL) {
+	snprintf(errbuf, errsize, "cannot load parameters");
+	rc = -1;
+	goto done;
+    }
+
+    if (srp->sr_input)
+	indoc = yangReadFile(srp->sr_input, NULL, XSLT_PARSE_OPTIONS);
+    else
+	indoc = yangFeaturesBuildInputDoc();
+
+    if (indoc == NULL) {
+	snprintf(errbuf, errsize, "unable to parse: '%s'",
+		 srp->sr_input ?: "features");
+	rc = -1;
+	goto done;
+    }
+
+    res = xsltApplyStylesheet(style, indoc, params);
+    if (res) {
+	/* An output file is replaced whole, or not at all */
+	if (srp->sr_output) {
+	    if (write_eval_output(srp->sr_output, res, style,
+				  srp->sr_format) < 0) {
+		snprintf(errbuf, errsize, "could not write output file: '%s'",
+			 srp->sr_output);
+		rc = -1;
+	    }
+	} else if (write_result(payload, res, style, srp->sr_format, 0) < 0) {
+	    snprintf(errbuf, errsize, "could not write output");
+	    rc = -1;
+	}
+
+	xmlFreeDoc(res);
+    }
+
+    xmlFreeDoc(indoc);
+
+ done:
+    xmlFreeAndEasy(params);
+    yangOverlayFree(overlay);
+
+    return rc;
+}
+
+static int
+serve_write (int fd, const char *buf, size_t len)
+{
+    ssize_t rc;
+
+    while (len > 0) {
+	rc = write(fd, buf, len);
+	if (rc < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+
+	buf += rc;
+	len -= rc;
+    }
+
+    return 0;
+}
+
+/*
+ * Send a temporary file's contents
+ */
+static int
+serve_copy (int fd, FILE *fp)
+{
+    char buf[BUFSIZ];
+    size_t len;
+
+    fflush(fp);
+    rewind(fp);
+
+    while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+	if (serve_write(fd, buf, len) < 0)
+	    return -1;
+
+    return 0;
+}
+
+static void
+serve_reply (int fd, int status, const char *reason, FILE *errors,
+	     FILE *payload)
+{
+    char buf[BUFSIZ];
+    size_t len;
+    long elen = 0;
+
+    if (errors) {
+	fflush(errors);
+	elen = ftell(errors);
+	if (elen < 0)
+	    elen = 0;
+    }
+
+    len = snprintf(buf, sizeof(buf), "status %d%s%s\n", status,
+		   (reason && *reason) ? " " : "", reason ?: "");
+    if (len >= sizeof(buf))
+	len = sizeof(buf) - 1;
+
+    if (serve_write(fd, buf, len) < 0)
+	return;
+
+    len = snprintf(buf, sizeof(buf), "errors %ld\n", elen);
+    if (serve_write(fd, buf, len) < 0
+	    || (elen && serve_copy(fd, errors) < 0))
+	return;
+
+    if (payload)
+	serve_copy(fd, payload);
+}
+
+/*
+ * Send what the request writes to stderr (slaxError and the libxml2
+ * and libxslt error handlers all end up there) to a temporary file,
+ * for the reply.  Returns the fd to restore stderr from, or -1.
+ */
+static int
+serve_errors_start (FILE *errors)
+{
+    int saved;
+
+    if (errors == NULL)
+	return -1;
+
+    fflush(stderr);
+    saved = dup(STDERR_FILENO);
+    if (saved < 0)
+	return -1;
+
+    if (dup2(fileno(errors), STDERR_FILENO) < 0) {
+	close(saved);
+	return -1;
+    }
+
+    return saved;
+}
+
+static void
+serve_errors_stop (int saved)
+{
+    if (saved < 0)
+	return;
+
+    fflush(stderr);
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+}
+
+/*
+ * Start a request with the start-up features, plus any it adds
+ */
+static void
+serve_features_reset (void)
+{
+    slax_data_node_t *dnp;
+
+    yangFeaturesClean();
+    SLAXDATALIST_FOREACH(dnp, &serve_features) {
+	yangFeatureAdd(dnp->dn_data);
+    }
+}
+
+/*
+ * Read a whole request, which the client ends by shutting down its
+ * side of the connection
+ */
+static char *
+serve_read (int fd, size_t *lenp)
+{
+    size_t len = 0, size = BUFSIZ;
+    char *buf = xmlMalloc(size + 1), *newp;
+    ssize_t rc;
+
+    while (buf) {
+	if (len == size) {
+	    if (size >= SERVE_REQUEST_MAX)
+		break;
+	    size *= 2;
+	    newp = xmlRealloc(buf, size + 1);
+	    if (newp == NULL)
+		break;
+	    buf = newp;
+	}
+
+	rc = read(fd, buf + len, size - len);
+	if (rc < 0 && errno == EINTR)
+	    continue;
+	if (rc <= 0) {
+	    if (rc == 0) {
+		buf[len] = '\0';
+		*lenp = len;
+		return buf;
+	    }
+	    break;
+	}
+
+	len += rc;
+    }
+
+    xmlFreeAndEasy(buf);
+    return NULL;
+}
+
+static void
+serve_request (int fd)
+{
+    serve_request_t sr;
+    serve_entry_t *sep;
+    char errbuf[BUFSIZ];
+    char *buf, *cp, *ep;
+    size_t len;
+    unsigned argc = 0, i;
+    FILE *payload = NULL, *errors;
+    int rc = -1, saved;
+
+    buf = serve_read(fd, &len);
+    if (buf == NULL) {
+	serve_reply(fd, 1, "cannot read request", NULL, NULL);
+	return;
+    }
+
+    for (cp = buf, ep = buf + len; cp < ep; cp += strlen(cp) + 1)
+	argc += 1;
+
+    char *argv[argc + 1];
+    for (cp = buf, i = 0; i < argc; cp += strlen(cp) + 1)
+	argv[i++] = cp;
+    argv[argc] = NULL;
+
+    bzero(&sr, sizeof(sr));
+    slaxDataListInit(&sr.sr_params);
+    slaxDataListInit(&sr.sr_param_files);
+    errbuf[0] = '\0';
+
+    errors = tmpfile();
+    saved = serve_errors_start(errors);
+
+    if (argc == 0 || chdir(argv[0]) < 0) {
+	snprintf(errbuf, sizeof(errbuf), "cannot change directory to '%s'",
+		 argc ? argv[0] : "");
+	goto done;
+    }
+
+    if (!streq(argv[0], serve_cwd)) {
+	serve_chdir();
+	snprintf(serve_cwd, sizeof(serve_cwd), "%s", argv[0]);
+    }
+
+    serve_features_reset();
+    yangParamsClean();		/* Parameter files may have changed */
+    if (serve_parse(&sr, argv + 1, errbuf, sizeof(errbuf)) < 0)
+	goto done;
+
+    serve_check();
+    serve_record();		/* Include directories may be new here */
+
+    sep = serve_entry_get(sr.sr_source);
+    if (sep == NULL) {
+	snprintf(errbuf, sizeof(errbuf), "cannot parse: '%s'", sr.sr_source);
+	goto done;
+    }
+
+    payload = tmpfile();
+    if (payload == NULL) {
+	snprintf(errbuf, sizeof(errbuf), "cannot create temporary file");
+	goto done;
+    }
+
+    if (sr.sr_evaluate)
+	rc = serve_evaluate(&sr, sep, payload, errbuf, sizeof(errbuf));
+    else
+	rc = serve_compile(&sr, sep, payload);
+
+ done:
+    serve_errors_stop(saved);
+    serve_reply(fd, (rc < 0) ? 1 : 0, errbuf, errors,
+		(rc < 0) ? NULL : payload);
+
+    if (errors)
+	fclose(errors);
+    if (payload)
+	fclose(payload);
+    slaxDataListClean(&sr.sr_params);
+    slaxDataListClean(&sr.sr_param_files);
+    xmlFree(buf);
+}
+
+static void
+serve_signal (int sig UNUSED)
+{
+    serve_done = TRUE;
+}
+
+static int
+serve_address (struct sockaddr_un *sunp, const char *path)
+{
+    if (strlen(path) >= sizeof(sunp->sun_path)) {
+	warnx("socket name too long: '%s'", path);
+	return -1;
+    }
+
+    bzero(sunp, sizeof(*sunp));
+    sunp->sun_family = AF_UNIX;
+    strncpy(sunp->sun_path, path, sizeof(sunp->sun_path) - 1);
+    return 0;
+}
+
+int
+serve_main (const char *path)
+{
+    struct sockaddr_un sun;
+    struct sigaction sa;
+    slax_data_node_t *dnp;
+    int sock, fd;
+
+    if (serve_address(&sun, path) < 0)
+	return -1;
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+	warn("cannot create socket");
+	return -1;
+    }
+
+    unlink(path);
+    if (bind(sock, (struct sockaddr *) &sun, sizeof(sun)) < 0
+	    || listen(sock, SOMAXCONN) < 0) {
+	warn("cannot listen on '%s'", path);
+	close(sock);
+	return -1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);	/* Clients may go away */
+
+    bzero(&sa, sizeof(sa));
+    sa.sa_handler = serve_signal;	/* No SA_RESTART, so accept stops */
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    /* Keep the start-up features, since each request starts over */
+    slaxDataListInit(&serve_features);
+    SLAXDATALIST_FOREACH(dnp, &yangSession()->ysn_features) {
+	slaxDataListAddNul(&serve_features, dnp->dn_data);
+    }
+
+    yangTrace(YTF_EVAL, "serve: listening on '%s'", path);
+
+    while (!serve_done) {
+	fd = accept(sock, NULL, NULL);
+	if (fd < 0) {
+	    if (errno == EINTR || errno == ECONNABORTED)
+		continue;
+	    warn("accept failed");
+	    break;
+	}
+
+	serve_request(fd);
+	close(fd);
+    }
+
+    close(sock);
+    unlink(path);
+    serve_flush("shutting down");
+    slaxDataListClean(&serve_features);
+
+    return 0;
+}
+
+/*
+ * The thin client: pass our arguments to the server and relay its
+ * answer.  Returns the exit status.
+ */
+int
+client_main (const char *path, char **argv)
+{
+    struct sockaddr_un sun;
+    char cwd[MAXPATHLEN], buf[BUFSIZ], reason[BUFSIZ], *cp;
+    int fd, status;
+    long elen;
+    size_t len;
+    FILE *fp;
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+	err(1, "cannot get working directory");
+
+    if (serve_address(&sun, path) < 0)
+	return 1;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+	err(1, "cannot create socket");
+
+    if (connect(fd, (struct sockaddr *) &sun, sizeof(sun)) < 0)
+	err(1, "cannot connect to '%s'", path);
+
+    if (serve_write(fd, cwd, strlen(cwd) + 1) < 0)
+	err(1, "cannot send request");
+
+    for ( ; *argv; argv++)
+	if (serve_write(fd, *argv, strlen(*argv) + 1) < 0)
+	    err(1, "cannot send request");
+
+    shutdown(fd, SHUT_WR);
+
+    fp = fdopen(fd, "r");
+    if (fp == NULL)
+	err(1, "cannot read reply");
+
+    if (fgets(buf, sizeof(buf), fp) == NULL
+	    || sscanf(buf, "status %d", &status) != 1)
+	errx(1, "no reply from server");
+
+    cp = strchr(buf + sizeof("status"), ' ');
+    snprintf(reason, sizeof(reason), "%s", cp ? cp + 1 : "");
+    reason[strcspn(reason, "\n")] = '\0';
+
+    /* The errors the request reported come before the reason */
+    if (fgets(buf, sizeof(buf), fp) == NULL
+	    || sscanf(buf, "errors %ld", &elen) != 1)
+	errx(1, "bad reply from server");
+
+    for ( ; elen > 0; elen -= len) {
+	len = fread(buf, 1, MIN((size_t) elen, sizeof(buf)), fp);
+	if (len == 0)
+	    break;
+	fwrite(buf, 1, len, stderr);
+    }
+
+    if (*reason)
+	warnx("%s", reason);
+
+    while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+	fwrite(buf, 1, len, stdout);
+
+    fclose(fp);
+    return status;
+}